@@ -0,0 +1,52 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Function to initialize 2D array
+// Rows point into one contiguous block so the whole array can be passed to
+// MPI or memcpy as &arr[0][0].
+static inline double ** init_2Darray(int m, int n) {
+    double ** arr = (double **)malloc((m > 0 ? m : 1) * sizeof(double *));
+    double * block = (double *)malloc(((size_t)m * n > 0 ? (size_t)m * n : 1) * sizeof(double));
+    if (arr == NULL || block == NULL) {
+        printf("Unable to allocate %d x %d array\n", m, n);
+        exit(1);
+    }
+    arr[0] = block;
+    for (int i = 0; i < m; i++) {
+        arr[i] = block + (size_t)i * n;
+    }
+    return arr;
+}
+
+// Function to initialize 3D array
+static inline double *** init_3Darray(int a, int b, int c) {
+    double *** arr = (double ***)malloc(a * sizeof(double **));
+    if (arr == NULL) {
+        printf("Unable to allocate %d x %d x %d array\n", a, b, c);
+        exit(1);
+    }
+    for (int i = 0; i < a; i++) {
+        arr[i] = init_2Darray(b, c);
+    }
+    return arr;
+}
+
+static inline void free_2Darray(double ** arr) {
+    if (arr != NULL) {
+        free(arr[0]);
+        free(arr);
+    }
+}
+
+static inline void free_3Darray(double *** arr, int a) {
+    if (arr != NULL) {
+        for (int i = 0; i < a; i++) {
+            free_2Darray(arr[i]);
+        }
+        free(arr);
+    }
+}
+#endif // ALLOC_H
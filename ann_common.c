@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>  // For getrusage
+
+#include "ann_common.h"
+#include "ann_prof.h"
+
+#ifdef ANN_HAVE_STB_IMAGE_WRITE
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#endif
+
+static void usage(const char* program) {
+    printf("Usage: %s [--train FILE] [--test FILE] [--output FILE] [--report FILE]\n"
+           "          [--places cores|sockets|threads|none] [--proc-bind close|spread] [--replicas]\n"
+           "          [--batch N] [--hidden N] [--depth N] [--micro-batches N] [--schedule gpipe|1f1b]\n"
+           "          [--ps SERVERS] [--staleness N] [--sync N] [--compress none|fp16|bf16|topk]\n"
+           "          [--topk FRACTION] [--model FILE] [--save-model FILE]\n"
+           "          [--socket PATH] [--port N] [--max-latency US] [--seed N]\n"
+           "          [--prune FRACTION] [--prune-block N] [--finetune PASSES]\n"
+           "          [--eval FILE] [--misclassified FILE] [--mpiio]\n"
+           "          [--rates LIST] [--hidden-sizes LIST] [--groups N] [--epochs N]\n"
+           "          [--profile FILE] [--autotune] [--counters] [--ensemble outputs|weights]\n"
+           "          [--resume]\n", program);
+    exit(1);
+}
+
+// Driver-specific flags and the ANN_ACCEPT_* bit that lets a driver take each
+static const struct {
+    const char* flag;
+    unsigned long long bit;
+} driver_flags[] = {
+    { "--train", ANN_ACCEPT_TRAIN },
+    { "--test", ANN_ACCEPT_TEST },
+    { "--output", ANN_ACCEPT_OUTPUT },
+    { "--places", ANN_ACCEPT_AFFINITY },
+    { "--proc-bind", ANN_ACCEPT_AFFINITY },
+    { "--replicas", ANN_ACCEPT_REPLICAS },
+    { "--batch", ANN_ACCEPT_BATCH },
+    { "--hidden", ANN_ACCEPT_HIDDEN },
+    { "--depth", ANN_ACCEPT_DEPTH },
+    { "--micro-batches", ANN_ACCEPT_MICRO_BATCHES },
+    { "--schedule", ANN_ACCEPT_SCHEDULE },
+    { "--ps", ANN_ACCEPT_PS },
+    { "--staleness", ANN_ACCEPT_STALENESS },
+    { "--sync", ANN_ACCEPT_SYNC },
+    { "--compress", ANN_ACCEPT_COMPRESS },
+    { "--topk", ANN_ACCEPT_TOPK },
+    { "--model", ANN_ACCEPT_MODEL },
+    { "--save-model", ANN_ACCEPT_SAVE_MODEL },
+    { "--socket", ANN_ACCEPT_SOCKET },
+    { "--port", ANN_ACCEPT_PORT },
+    { "--max-latency", ANN_ACCEPT_MAX_LATENCY },
+    { "--seed", ANN_ACCEPT_SEED },
+    { "--prune", ANN_ACCEPT_PRUNE },
+    { "--prune-block", ANN_ACCEPT_PRUNE_BLOCK },
+    { "--finetune", ANN_ACCEPT_FINETUNE },
+    { "--eval", ANN_ACCEPT_EVAL },
+    { "--misclassified", ANN_ACCEPT_MISCLASSIFIED },
+    { "--mpiio", ANN_ACCEPT_MPIIO },
+    { "--rates", ANN_ACCEPT_RATES },
+    { "--hidden-sizes", ANN_ACCEPT_HIDDEN_SIZES },
+    { "--groups", ANN_ACCEPT_GROUPS },
+    { "--epochs", ANN_ACCEPT_EPOCHS },
+    { "--profile", ANN_ACCEPT_PROFILE },
+    { "--autotune", ANN_ACCEPT_AUTOTUNE },
+    { "--ensemble", ANN_ACCEPT_ENSEMBLE },
+    { "--resume", ANN_ACCEPT_RESUME },
+};
+
+static const char* option_value(int argc, char* argv[], int* i) {
+    if (*i + 1 >= argc) {
+        usage(argv[0]);
+    }
+    return argv[++*i];
+}
+
+void ann_parse_options(int argc, char* argv[], ann_options* opts) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        for (size_t f = 0; f < sizeof(driver_flags) / sizeof(driver_flags[0]); f++) {
+            if (strcmp(arg, driver_flags[f].flag) == 0 && !(opts->accepts & driver_flags[f].bit)) {
+                printf("%s does not implement %s\n", argv[0], arg);
+                exit(1);
+            }
+        }
+        if (strcmp(arg, "--train") == 0) {
+            opts->train_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--test") == 0) {
+            opts->test_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--output") == 0) {
+            opts->output_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--report") == 0) {
+            opts->report_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--places") == 0) {
+            opts->places = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--proc-bind") == 0) {
+            opts->proc_bind = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--replicas") == 0) {
+            opts->replicas = 1;
+        } else if (strcmp(arg, "--hidden") == 0) {
+            opts->hidden_size = atoi(option_value(argc, argv, &i));
+            if (opts->hidden_size < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--depth") == 0) {
+            opts->depth = atoi(option_value(argc, argv, &i));
+            if (opts->depth < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--micro-batches") == 0) {
+            opts->micro_batches = atoi(option_value(argc, argv, &i));
+            if (opts->micro_batches < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--schedule") == 0) {
+            opts->schedule = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--ps") == 0) {
+            opts->ps_servers = atoi(option_value(argc, argv, &i));
+            if (opts->ps_servers < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--staleness") == 0) {
+            opts->staleness = atoi(option_value(argc, argv, &i));
+            if (opts->staleness < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--sync") == 0) {
+            opts->sync_interval = atoi(option_value(argc, argv, &i));
+            if (opts->sync_interval < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--compress") == 0) {
+            opts->compress = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--topk") == 0) {
+            opts->topk_ratio = atof(option_value(argc, argv, &i));
+            if (opts->topk_ratio <= 0 || opts->topk_ratio > 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--model") == 0) {
+            opts->model_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--save-model") == 0) {
+            opts->save_model = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--socket") == 0) {
+            opts->socket_path = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--port") == 0) {
+            opts->port = atoi(option_value(argc, argv, &i));
+            if (opts->port < 1 || opts->port > 65535) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--max-latency") == 0) {
+            opts->max_latency_us = atoi(option_value(argc, argv, &i));
+            if (opts->max_latency_us < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--seed") == 0) {
+            opts->seed = strtoull(option_value(argc, argv, &i), NULL, 10);
+            if (opts->seed == 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--prune") == 0) {
+            opts->prune = atof(option_value(argc, argv, &i));
+            if (opts->prune < 0 || opts->prune >= 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--prune-block") == 0) {
+            opts->prune_block = atoi(option_value(argc, argv, &i));
+            if (opts->prune_block < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--finetune") == 0) {
+            opts->finetune = atoi(option_value(argc, argv, &i));
+            if (opts->finetune < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--eval") == 0) {
+            opts->eval_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--misclassified") == 0) {
+            opts->misclassified_file = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--mpiio") == 0) {
+            opts->mpiio = 1;
+        } else if (strcmp(arg, "--rates") == 0) {
+            opts->rates = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--hidden-sizes") == 0) {
+            opts->hidden_sizes = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--groups") == 0) {
+            opts->groups = atoi(option_value(argc, argv, &i));
+            if (opts->groups < 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--epochs") == 0) {
+            opts->epochs = atoi(option_value(argc, argv, &i));
+            if (opts->epochs < 1) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--profile") == 0) {
+            opts->tune_profile = option_value(argc, argv, &i);
+        } else if (strcmp(arg, "--autotune") == 0) {
+            opts->autotune = 1;
+        } else if (strcmp(arg, "--counters") == 0) {
+            opts->counters = 1;
+        } else if (strcmp(arg, "--resume") == 0) {
+            opts->resume = 1;
+        } else if (strcmp(arg, "--ensemble") == 0) {
+            opts->ensemble = option_value(argc, argv, &i);
+            if (strcmp(opts->ensemble, "outputs") != 0 && strcmp(opts->ensemble, "weights") != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(arg, "--batch") == 0) {
+            opts->batch_size = atoi(option_value(argc, argv, &i));
+            if (opts->batch_size < 1) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (opts->report_file == NULL) {
+        opts->report_file = getenv("ANN_REPORT");
+    }
+    const char* counters = getenv("ANN_COUNTERS");
+    if (counters != NULL && strcmp(counters, "0") != 0) {
+        opts->counters = 1;
+    }
+    // Before any phase runs, so every thread opens its counters on first use
+    if (opts->counters) {
+        ann_prof_enable_counters();
+    }
+}
+
+unsigned long long ann_seed(const ann_options* opts) {
+    if (opts->seed != 0) {
+        return opts->seed;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((unsigned long long)ts.tv_sec << 32) ^ (unsigned long long)ts.tv_nsec;
+}
+
+long get_memory_usage(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024L;
+}
+
+void save_image_as_png(const char *filename, double *pixels, int width, int height) {
+#ifdef ANN_HAVE_STB_IMAGE_WRITE
+    unsigned char *image_data = (unsigned char*)malloc(width * height * sizeof(unsigned char));
+    for (int i = 0; i < width * height; i++) {
+        image_data[i] = (unsigned char)(pixels[i] * 255);
+    }
+
+    stbi_write_png(filename, width, height, 1, image_data, width);
+    free(image_data);
+#else
+    (void)pixels;
+    (void)width;
+    (void)height;
+    printf("Skipping %s: built without stb_image_write.h\n", filename);
+#endif
+}
@@ -0,0 +1,101 @@
+#ifndef ANN_COMMON_H
+#define ANN_COMMON_H
+
+// Helpers shared by every driver, built once into the ann_core library.
+
+//Flags a driver implements. Each driver lists its own in ann_options.accepts
+//and ann_parse_options rejects any other flag rather than letting it be
+//silently ignored; --report and --counters work everywhere.
+#define ANN_ACCEPT_TRAIN         (1ull << 0)
+#define ANN_ACCEPT_TEST          (1ull << 1)
+#define ANN_ACCEPT_OUTPUT        (1ull << 2)
+#define ANN_ACCEPT_AFFINITY      (1ull << 3)
+#define ANN_ACCEPT_REPLICAS      (1ull << 4)
+#define ANN_ACCEPT_BATCH         (1ull << 5)
+#define ANN_ACCEPT_HIDDEN        (1ull << 6)
+#define ANN_ACCEPT_DEPTH         (1ull << 7)
+#define ANN_ACCEPT_MICRO_BATCHES (1ull << 8)
+#define ANN_ACCEPT_SCHEDULE      (1ull << 9)
+#define ANN_ACCEPT_PS            (1ull << 10)
+#define ANN_ACCEPT_STALENESS     (1ull << 11)
+#define ANN_ACCEPT_SYNC          (1ull << 12)
+#define ANN_ACCEPT_COMPRESS      (1ull << 13)
+#define ANN_ACCEPT_TOPK          (1ull << 14)
+#define ANN_ACCEPT_MODEL         (1ull << 15)
+#define ANN_ACCEPT_SAVE_MODEL    (1ull << 16)
+#define ANN_ACCEPT_SOCKET        (1ull << 17)
+#define ANN_ACCEPT_PORT          (1ull << 18)
+#define ANN_ACCEPT_MAX_LATENCY   (1ull << 19)
+#define ANN_ACCEPT_SEED          (1ull << 20)
+#define ANN_ACCEPT_PRUNE         (1ull << 21)
+#define ANN_ACCEPT_PRUNE_BLOCK   (1ull << 22)
+#define ANN_ACCEPT_FINETUNE      (1ull << 23)
+#define ANN_ACCEPT_EVAL          (1ull << 24)
+#define ANN_ACCEPT_MISCLASSIFIED (1ull << 25)
+#define ANN_ACCEPT_MPIIO         (1ull << 26)
+#define ANN_ACCEPT_RATES         (1ull << 27)
+#define ANN_ACCEPT_HIDDEN_SIZES  (1ull << 28)
+#define ANN_ACCEPT_GROUPS        (1ull << 29)
+#define ANN_ACCEPT_EPOCHS        (1ull << 30)
+#define ANN_ACCEPT_PROFILE       (1ull << 31)
+#define ANN_ACCEPT_AUTOTUNE      (1ull << 32)
+#define ANN_ACCEPT_ENSEMBLE      (1ull << 33)
+#define ANN_ACCEPT_RESUME        (1ull << 34)
+
+//Command line options, parsed for every driver
+typedef struct ann_options {
+    const char* train_file;
+    const char* test_file;
+    const char* output_file;
+    const char* report_file;   // JSON instrumentation report, NULL to skip
+    const char* places;        // OMP_PLACES to pin threads to, "none" to leave unpinned
+    const char* proc_bind;     // OMP_PROC_BIND policy used with places
+    int replicas;              // keep one copy of the weights per socket for inference
+    int batch_size;            // mini-batch rows for drivers that train in batches
+    int hidden_size;           // hidden layer width for drivers without a fixed MAX_SIZE
+    int depth;                 // number of hidden layers for the pipelined driver
+    int micro_batches;         // micro-batches per mini-batch for the pipelined driver
+    const char* schedule;      // pipeline schedule, "gpipe" or "1f1b"
+    int ps_servers;            // parameter-server ranks for asynchronous training, 0 for off
+    int staleness;             // syncs a parameter-server worker may run ahead of the slowest
+    int sync_interval;         // samples between synchronous model averaging, 0 for off
+    const char* compress;      // codec for averaged updates: none, fp16, bf16 or topk
+    double topk_ratio;         // fraction of entries each rank sends with topk
+    const char* model_file;    // trained model to load (ann_model.h format)
+    const char* save_model;    // where to write the trained model, NULL to skip
+    const char* socket_path;   // Unix domain socket the inference server listens on
+    int port;                  // localhost TCP port for the inference server, 0 for the socket
+    int max_latency_us;        // longest a request waits for its dynamic batch to fill
+    double prune;              // fraction of hidden-layer weights to prune after training, 0 for none
+    int prune_block;           // prune block x block tiles and store them as BSR; 1 for CSR
+    int finetune;              // passes over the training file after pruning
+    unsigned long long seed;   // seed for the random weights, 0 to take one from the clock
+    const char* eval_file;     // labelled CSV to evaluate after training, NULL to skip
+    const char* misclassified_file;   // where to list the IDs eval_file got wrong, NULL to skip
+    int mpiio;                 // every rank writes its own predictions with collective MPI-IO
+    const char* rates;         // comma-separated learning rates for the sweep
+    const char* hidden_sizes;  // comma-separated hidden widths for the sweep
+    int groups;                // models the sweep trains at once, 0 for one per thread
+    int epochs;                // passes over the training rows
+    const char* tune_profile;  // tuning profile to load at startup (ann_tune.h), "none" to skip
+    int autotune;              // time the kernel settings on this host and save them to tune_profile
+    int counters;              // collect hardware performance counters per phase (ann_prof.h)
+    const char* ensemble;      // ann_mpi inference from all ranks' models: "outputs" or "weights", NULL for rank 0's
+    int resume;                // continue training model_file on the rows added since its offset sidecar
+    unsigned long long accepts;   // ANN_ACCEPT_* flags this driver implements
+} ann_options;
+
+//Parses argv into opts; opts must already hold the driver's defaults
+void ann_parse_options(int argc, char* argv[], ann_options* opts);
+
+//Returns opts->seed, or a clock-based seed when none was given. MPI drivers
+//call it on one rank and broadcast the result.
+unsigned long long ann_seed(const ann_options* opts);
+
+//Returns the peak resident set size of this process in bytes
+long get_memory_usage(void);
+
+//Writes a grayscale image with pixel values in [0, 1] as PNG
+void save_image_as_png(const char *filename, double *pixels, int width, int height);
+
+#endif // ANN_COMMON_H
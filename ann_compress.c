@@ -0,0 +1,169 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_compress.h"
+
+int ann_codec_from_name(const char* name, ann_codec* codec) {
+    static const char* names[] = { "none", "fp16", "bf16", "topk" };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *codec = (ann_codec)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* ann_codec_name(ann_codec codec) {
+    switch (codec) {
+    case ANN_CODEC_FP16: return "fp16";
+    case ANN_CODEC_BF16: return "bf16";
+    case ANN_CODEC_TOPK: return "topk";
+    default: return "none";
+    }
+}
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint16_t ann_float_to_half(float value) {
+    uint32_t x = float_bits(value);
+    uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+    uint32_t abs = x & 0x7FFFFFFF;
+    if (abs >= 0x7F800000) {                // inf or nan
+        return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477FF000) {                // rounds past the largest half
+        return sign | 0x7C00;
+    }
+    if (abs < 0x38800000) {                 // subnormal half or zero
+        if (abs < 0x33000000) {
+            return sign;
+        }
+        // Align the implicit-one mantissa to the half subnormal step of 2^-24
+        uint32_t mant = (abs & 0x7FFFFF) | 0x800000;
+        int shift = 126 - (int)(abs >> 23);
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return sign | (uint16_t)half;
+    }
+    // Normal: rebias the exponent from 127 to 15 and round the mantissa
+    uint32_t half = ((abs >> 13) - (112u << 10));
+    uint32_t rest = abs & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return sign | (uint16_t)half;
+}
+
+float ann_half_to_float(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1F;
+    uint32_t mant = half & 0x3FF;
+    if (exp == 0x1F) {
+        return bits_float(sign | 0x7F800000 | (mant << 13));
+    }
+    if (exp == 0) {
+        float value = ldexpf((float)mant, -24);
+        return sign ? -value : value;
+    }
+    return bits_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+uint16_t ann_float_to_bf16(float value) {
+    uint32_t x = float_bits(value);
+    if ((x & 0x7FFFFFFF) > 0x7F800000) {
+        return (uint16_t)((x >> 16) | 0x40);   // keep nan quiet
+    }
+    x += 0x7FFF + ((x >> 16) & 1);
+    return (uint16_t)(x >> 16);
+}
+
+float ann_bf16_to_float(uint16_t bf16) {
+    return bits_float((uint32_t)bf16 << 16);
+}
+
+void ann_encode_16(const double* in, uint16_t* out, int n, int bf16) {
+    for (int i = 0; i < n; i++) {
+        out[i] = bf16 ? ann_float_to_bf16((float)in[i]) : ann_float_to_half((float)in[i]);
+    }
+}
+
+void ann_decode_16(const uint16_t* in, double* out, int n, int bf16) {
+    for (int i = 0; i < n; i++) {
+        out[i] = bf16 ? ann_bf16_to_float(in[i]) : ann_half_to_float(in[i]);
+    }
+}
+
+// Quickselect: after the call, a[k] holds the k-th largest value and every
+// value before it is at least as large
+static void select_largest(double* a, int n, int k) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        double pivot = a[lo + (hi - lo) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (a[i] > pivot) i++;
+            while (a[j] < pivot) j--;
+            if (i <= j) {
+                double t = a[i]; a[i] = a[j]; a[j] = t;
+                i++;
+                j--;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+int ann_topk_select(const double* v, int n, int k, int32_t* idx, float* val) {
+    if (k <= 0 || n <= 0) {
+        return 0;
+    }
+    if (k > n) {
+        k = n;
+    }
+    double* mag = (double*)malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        mag[i] = fabs(v[i]);
+    }
+    select_largest(mag, n, k - 1);
+    double threshold = mag[k - 1];
+    free(mag);
+
+    // Everything above the threshold, then ties until k entries
+    int above = 0;
+    for (int i = 0; i < n; i++) {
+        above += fabs(v[i]) > threshold;
+    }
+    int ties = k - above;
+    int count = 0;
+    for (int i = 0; i < n && count < k; i++) {
+        double m = fabs(v[i]);
+        if (m > threshold || (m == threshold && ties-- > 0)) {
+            idx[count] = i;
+            val[count] = (float)v[i];
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,34 @@
+#ifndef ANN_COMPRESS_H
+#define ANN_COMPRESS_H
+
+#include <stdint.h>
+
+// Codecs for compressing weight updates exchanged between ranks. They are
+// MPI-free; the exchange itself lives with the trainer that uses them.
+
+typedef enum ann_codec {
+    ANN_CODEC_NONE,   // raw doubles
+    ANN_CODEC_FP16,   // IEEE half precision, 2 bytes per value
+    ANN_CODEC_BF16,   // bfloat16, 2 bytes per value, float's exponent range
+    ANN_CODEC_TOPK,   // k largest magnitudes as (index, float) pairs
+} ann_codec;
+
+//Parses "none", "fp16", "bf16" or "topk"; returns 0 on success, -1 otherwise
+int ann_codec_from_name(const char* name, ann_codec* codec);
+const char* ann_codec_name(ann_codec codec);
+
+//Round-to-nearest-even conversions between float and the 16-bit formats
+uint16_t ann_float_to_half(float value);
+float ann_half_to_float(uint16_t half);
+uint16_t ann_float_to_bf16(float value);
+float ann_bf16_to_float(uint16_t bf16);
+
+//Converts n values to or from FP16 (bf16 == 0) or BF16 (bf16 != 0)
+void ann_encode_16(const double* in, uint16_t* out, int n, int bf16);
+void ann_decode_16(const uint16_t* in, double* out, int n, int bf16);
+
+//Writes the k entries of v with the largest magnitude to idx/val (in index
+//order) and returns how many were written
+int ann_topk_select(const double* v, int n, int k, int32_t* idx, float* val);
+
+#endif // ANN_COMPRESS_H
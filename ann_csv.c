@@ -0,0 +1,55 @@
+#include <stdlib.h>
+
+#include "ann_csv.h"
+
+static int end_of_line(char c) {
+    return c == '\n' || c == '\r' || c == '\0';
+}
+
+static int end_of_field(char c) {
+    return c == ',' || end_of_line(c);
+}
+
+// MNIST fields are small unsigned integers, so take the fast path for those
+// and fall back to strtod for anything else
+static const char* parse_field(const char* p, double* value) {
+    const char* start = p;
+    unsigned v = 0;
+    int digits = 0;
+    while (*p >= '0' && *p <= '9' && digits < 9) {
+        v = v * 10 + (unsigned)(*p - '0');
+        p++;
+        digits++;
+    }
+    if (digits > 0 && end_of_field(*p)) {
+        *value = (double)v;
+    } else {
+        char* end;
+        *value = strtod(start, &end);
+        p = end;
+    }
+    while (!end_of_field(*p)) {
+        p++;
+    }
+    if (*p == ',') {
+        p++;
+    }
+    return p;
+}
+
+int parse_csv_row(const char* line, double* row, int n_pixels, int has_label) {
+    const char* p = line;
+    if (has_label) {
+        p = parse_field(p, &row[n_pixels]);
+    }
+    int i = 0;
+    for (; i < n_pixels && !end_of_line(*p); i++) {
+        double v;
+        p = parse_field(p, &v);
+        row[i] = v / 255.0;
+    }
+    for (int j = i; j < n_pixels; j++) {
+        row[j] = 0;
+    }
+    return i;
+}
@@ -0,0 +1,9 @@
+#ifndef ANN_CSV_H
+#define ANN_CSV_H
+
+//Parses one CSV record of n_pixels values, optionally preceded by a label.
+//Pixels are scaled from 0..255 to [0, 1]; the label is stored unscaled at
+//row[n_pixels]. Returns the number of pixel fields found on the line.
+int parse_csv_row(const char* line, double* row, int n_pixels, int has_label);
+
+#endif // ANN_CSV_H
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_eval.h"
+
+void ann_eval_init(ann_eval* e, int n_out, int track_misclassified) {
+    memset(e, 0, sizeof(*e));
+    e->n_classes = n_out == 1 ? 2 : n_out;
+    if (e->n_classes > ANN_EVAL_MAX_CLASSES) {
+        e->n_classes = ANN_EVAL_MAX_CLASSES;
+    }
+    e->track_misclassified = track_misclassified;
+}
+
+void ann_eval_free(ann_eval* e) {
+    free(e->misclassified);
+    e->misclassified = NULL;
+    e->n_misclassified = 0;
+    e->cap_misclassified = 0;
+}
+
+static void push_misclassified(ann_eval* e, long id) {
+    if (e->n_misclassified == e->cap_misclassified) {
+        e->cap_misclassified = e->cap_misclassified ? 2 * e->cap_misclassified : 64;
+        e->misclassified = (long*)realloc(e->misclassified, e->cap_misclassified * sizeof(long));
+    }
+    e->misclassified[e->n_misclassified++] = id;
+}
+
+int ann_eval_add(ann_eval* e, const double* out, int n_out, int label, long id) {
+    int predicted = 0;
+    double loss = 0;
+    if (n_out == 1) {
+        predicted = out[0] >= 0.5;
+        double diff = out[0] - (label == 1);
+        loss = diff * diff;
+    } else {
+        for (int i = 0; i < n_out; i++) {
+            if (out[i] > out[predicted]) {
+                predicted = i;
+            }
+            double diff = out[i] - (i == label);
+            loss += diff * diff;
+        }
+    }
+    // The training objective, 1/2 * sum of squared errors
+    e->loss += 0.5 * loss;
+    e->count++;
+    if (predicted == label) {
+        e->correct++;
+    } else if (e->track_misclassified) {
+        push_misclassified(e, id);
+    }
+    if (label >= 0 && label < e->n_classes && predicted < e->n_classes) {
+        e->confusion[label][predicted]++;
+    }
+    return predicted;
+}
+
+void ann_eval_merge(ann_eval* into, const ann_eval* from) {
+    into->count += from->count;
+    into->correct += from->correct;
+    into->loss += from->loss;
+    for (int i = 0; i < ANN_EVAL_MAX_CLASSES; i++) {
+        for (int j = 0; j < ANN_EVAL_MAX_CLASSES; j++) {
+            into->confusion[i][j] += from->confusion[i][j];
+        }
+    }
+    if (into->track_misclassified) {
+        for (long i = 0; i < from->n_misclassified; i++) {
+            push_misclassified(into, from->misclassified[i]);
+        }
+    }
+}
+
+double ann_eval_accuracy(const ann_eval* e) {
+    return e->count > 0 ? (double)e->correct / e->count : 0;
+}
+
+double ann_eval_mean_loss(const ann_eval* e) {
+    return e->count > 0 ? e->loss / e->count : 0;
+}
+
+double ann_eval_precision(const ann_eval* e, int c) {
+    long predicted = 0;
+    for (int i = 0; i < e->n_classes; i++) {
+        predicted += e->confusion[i][c];
+    }
+    return predicted > 0 ? (double)e->confusion[c][c] / predicted : 0;
+}
+
+double ann_eval_recall(const ann_eval* e, int c) {
+    long present = 0;
+    for (int j = 0; j < e->n_classes; j++) {
+        present += e->confusion[c][j];
+    }
+    return present > 0 ? (double)e->confusion[c][c] / present : 0;
+}
+
+void ann_eval_print(const ann_eval* e, const char* label, FILE* out) {
+    fprintf(out, "%s: accuracy %.2f%% (%ld of %ld), loss %.4f\n", label,
+            100 * ann_eval_accuracy(e), e->correct, e->count, ann_eval_mean_loss(e));
+    fprintf(out, "  class    ");
+    for (int c = 0; c < e->n_classes; c++) {
+        fprintf(out, " %6d", c);
+    }
+    fprintf(out, "\n  precision");
+    for (int c = 0; c < e->n_classes; c++) {
+        fprintf(out, " %6.3f", ann_eval_precision(e, c));
+    }
+    fprintf(out, "\n  recall   ");
+    for (int c = 0; c < e->n_classes; c++) {
+        fprintf(out, " %6.3f", ann_eval_recall(e, c));
+    }
+    fprintf(out, "\n  confusion (rows true, columns predicted)\n");
+    for (int i = 0; i < e->n_classes; i++) {
+        fprintf(out, "  %-9d", i);
+        for (int j = 0; j < e->n_classes; j++) {
+            fprintf(out, " %6ld", e->confusion[i][j]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+int ann_eval_write_misclassified(ann_eval* e, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    // Threads and ranks append in completion order
+    if (e->n_misclassified > 1) {
+        qsort(e->misclassified, e->n_misclassified, sizeof(long), compare_long);
+    }
+    fprintf(out, "ImageId\n");
+    for (long i = 0; i < e->n_misclassified; i++) {
+        fprintf(out, "%ld\n", e->misclassified[i]);
+    }
+    return fclose(out) == 0 ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef ANN_EVAL_H
+#define ANN_EVAL_H
+
+#include <stdio.h>
+
+// Evaluation of a classifier on labelled samples. A tally holds only counts
+// and sums, so tallies kept per thread or per rank merge by adding them up;
+// the metrics are derived from the merged tally. MPI-free: ann_mpi_util.h
+// reduces tallies across ranks.
+
+#define ANN_EVAL_MAX_CLASSES 16
+
+typedef struct ann_eval {
+    int n_classes;
+    long count;
+    long correct;
+    double loss;               // squared error summed over samples
+    long confusion[ANN_EVAL_MAX_CLASSES][ANN_EVAL_MAX_CLASSES];   // [true][predicted]
+    // IDs of misclassified samples, kept only when track_misclassified is set
+    int track_misclassified;
+    long* misclassified;
+    long n_misclassified;
+    long cap_misclassified;
+} ann_eval;
+
+//Starts an empty tally. n_out is the width of the output layer; a single
+//sigmoid output is treated as two classes split at 0.5.
+void ann_eval_init(ann_eval* e, int n_out, int track_misclassified);
+void ann_eval_free(ann_eval* e);
+
+//Tallies one sample from its output layer and label, and returns the
+//predicted class. id identifies the sample in the misclassified dump.
+int ann_eval_add(ann_eval* e, const double* out, int n_out, int label, long id);
+
+//Adds the tally in from to into
+void ann_eval_merge(ann_eval* into, const ann_eval* from);
+
+double ann_eval_accuracy(const ann_eval* e);
+double ann_eval_mean_loss(const ann_eval* e);
+//Per-class metrics; 0 when the class was never predicted or never present
+double ann_eval_precision(const ann_eval* e, int c);
+double ann_eval_recall(const ann_eval* e, int c);
+
+//Prints accuracy, loss, per-class precision and recall and the confusion
+//matrix in a few lines
+void ann_eval_print(const ann_eval* e, const char* label, FILE* out);
+
+//Writes the misclassified IDs in ascending order, one per line; returns 0 on
+//success
+int ann_eval_write_misclassified(ann_eval* e, const char* path);
+
+#endif // ANN_EVAL_H
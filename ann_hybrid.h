@@ -0,0 +1,187 @@
+#ifndef ANN_HYBRID_H
+#define ANN_HYBRID_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <omp.h>
+
+#include "ann_prof.h"
+#include "ann_openmp1.h"
+
+// Hybrid MPI + OpenMP training on top of the dynamic network of
+// ann_openmp1.h. Every rank holds one copy of the model and trains it with
+// synchronous mini-batch SGD: OpenMP threads split the rank's share of a
+// batch, and the summed gradient is exchanged with one MPI_Allreduce per
+// batch from the master thread (MPI_THREAD_FUNNELED is enough). All ranks
+// therefore keep identical weights, and since batches are global the result
+// does not depend on how many ranks or threads took part.
+
+//Number of weights and biases, i.e. the length of a flattened gradient
+int ann_param_count(network*);
+//Copies root's weights and biases to every rank of comm
+void bcast_ann(network*, int root, MPI_Comm comm);
+//Adds one sample's weight and bias gradients to grad
+void accumulate_gradient(network*, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double* grad);
+//Trains on the rows dealt round-robin over comm (this rank holds global rows
+//rank, rank + size, ...) in global batches of batch_size rows
+void train_hybrid(network*, double** data, int length, double learning_rate, int batch_size, MPI_Comm comm);
+
+
+int ann_param_count(network* ann){
+    int n = 0;
+    for(int i=1; i<ann->n_layers; i++) {
+        n += ann->dim[i] * ann->dim[i-1] + ann->dim[i];
+    }
+    return n;
+}
+
+void bcast_ann(network* ann, int root, MPI_Comm comm){
+    for(int i=1; i<ann->n_layers; i++) {
+        MPI_Bcast(ann->weights[i-1][0], ann->dim[i] * ann->dim[i-1], MPI_DOUBLE, root, comm);
+        MPI_Bcast(ann->biases[i], ann->dim[i], MPI_DOUBLE, root, comm);
+    }
+}
+
+//Gradient layout per layer i >= 1: dim[i] x dim[i-1] weights, then dim[i] biases
+void accumulate_gradient(network* ann, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double* grad){
+    // Zero pixels contribute nothing to the layer 1 gradient
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for(int i=1; i<ann->n_layers; i++) {
+        int rows = ann->dim[i];
+        int cols = ann->dim[i-1];
+        for(int j=0; j<rows; j++) {
+            double dj = d[i][j];
+            double* g = grad + (size_t)j * cols;
+            if(i == 1 && 2 * n_nz <= cols) {
+                for(int e=0; e<n_nz; e++) {
+                    g[nz[e]] += output[0][nz[e]] * dj;
+                }
+            }
+            else {
+                for(int k=0; k<cols; k++) {
+                    g[k] += output[i-1][k] * dj;
+                }
+            }
+        }
+        grad += (size_t)rows * cols;
+        for(int j=0; j<rows; j++) {
+            grad[j] += d[i][j];
+        }
+        grad += rows;
+    }
+}
+
+void train_hybrid(network* ann, double** data, int length, double learning_rate, int batch_size, MPI_Comm comm){
+    double forward_flops = ann_flops_forward(ann->dim, ann->n_layers);
+    double backward_flops = ann_flops_backward(ann->dim, ann->n_layers);
+    double update_flops = ann_flops_update(ann->dim, ann->n_layers);
+
+    // One gradient buffer per thread plus the sample count in the last slot,
+    // padded to whole cache lines so threads never share one
+    int n_params = ann_param_count(ann);
+    int n_threads = omp_get_max_threads();
+    size_t stride = ((size_t)n_params + 1 + 7) & ~(size_t)7;
+    double* thread_grads = (double*)aligned_alloc(64, n_threads * stride * sizeof(double));
+    double* grad = (double*)aligned_alloc(64, stride * sizeof(double));
+    if (thread_grads == NULL || grad == NULL) {
+        printf("Unable to allocate gradient buffers\n");
+        MPI_Abort(comm, 1);
+    }
+
+    int rank, size, total = 0;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    double t0 = ann_prof_begin();
+    MPI_Allreduce(&length, &total, 1, MPI_INT, MPI_SUM, comm);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    int steps = (total + batch_size - 1) / batch_size;
+
+    for(int s=0; s<steps; s++) {
+        // Local rows whose global index falls in [s, s+1) * batch_size
+        long first = (long)s * batch_size, last = first + batch_size;
+        int start = (int)((first - rank + size - 1) / size);
+        int end = (int)((last - rank + size - 1) / size);
+        if (end > length) end = length;
+        if (start > end) start = end;
+
+        #pragma omp parallel num_threads(n_threads)
+        {
+            int tid = omp_get_thread_num();
+            int team = omp_get_num_threads();
+            double* g = thread_grads + tid * stride;
+            memset(g, 0, (n_params + 1) * sizeof(double));
+            double output[LAYER_SIZE][MAX_SIZE];
+            double d[LAYER_SIZE][MAX_SIZE];
+            int samples = 0;
+
+            #pragma omp for schedule(static)
+            for(int t=start; t<end; t++) {
+                arrayCopy(output[0], data[t], ann->dim[0]);
+                double t1 = ann_prof_begin();
+                feed_forward(ann, output);
+                ann_prof_end(ANN_PHASE_FORWARD, t1, forward_flops);
+
+                t1 = ann_prof_begin();
+                compute_deltas(ann, output, d, data[t][ann->dim[0]]);
+                ann_prof_end(ANN_PHASE_BACKWARD, t1, backward_flops);
+
+                t1 = ann_prof_begin();
+                accumulate_gradient(ann, output, d, g);
+                ann_prof_end(ANN_PHASE_UPDATE, t1, update_flops);
+                samples++;
+            }
+            g[n_params] = samples;
+            ann_prof_samples(samples);
+            #pragma omp barrier
+
+            // Sum the thread buffers, each thread owning a slice of parameters
+            #pragma omp for schedule(static)
+            for(int p=0; p<=n_params; p++) {
+                double sum = 0;
+                for(int i=0; i<team; i++) {
+                    sum += thread_grads[i * stride + p];
+                }
+                grad[p] = sum;
+            }
+
+            #pragma omp master
+            {
+                double t1 = ann_prof_begin();
+                MPI_Allreduce(MPI_IN_PLACE, grad, n_params + 1, MPI_DOUBLE, MPI_SUM, comm);
+                ann_prof_end(ANN_PHASE_COMM, t1, 0);
+            }
+            #pragma omp barrier
+
+            // Every rank applies the same mean gradient
+            double count = grad[n_params];
+            if (count > 0) {
+                double t1 = ann_prof_begin();
+                double scale = learning_rate / count;
+                double* gl = grad;
+                for(int i=1; i<ann->n_layers; i++) {
+                    int rows = ann->dim[i];
+                    int cols = ann->dim[i-1];
+                    double* w = ann->weights[i-1][0];
+                    #pragma omp for schedule(static) nowait
+                    for(int p=0; p<rows * cols; p++) {
+                        w[p] -= scale * gl[p];
+                    }
+                    gl += (size_t)rows * cols;
+                    #pragma omp for schedule(static)
+                    for(int j=0; j<rows; j++) {
+                        ann->biases[i][j] -= scale * gl[j];
+                    }
+                    gl += rows;
+                }
+                ann_prof_end(ANN_PHASE_UPDATE, t1, 0);
+            }
+        }
+    }
+
+    free(thread_grads);
+    free(grad);
+}
+
+#endif // ANN_HYBRID_H
@@ -0,0 +1,141 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_infer.h"
+#include "ann_sparse.h"
+
+static double* alloc_aligned(size_t n) {
+    size_t bytes = n * sizeof(double);
+    bytes = (bytes + ANN_INFER_ALIGN - 1) / ANN_INFER_ALIGN * ANN_INFER_ALIGN;
+    return (double*)aligned_alloc(ANN_INFER_ALIGN, bytes > 0 ? bytes : ANN_INFER_ALIGN);
+}
+
+static int n_panels(int rows) {
+    return (rows + ANN_INFER_LANES - 1) / ANN_INFER_LANES;
+}
+
+int ann_infer_init(ann_infer* inf, int n_layers, const int* dim,
+                   const double* const* weights, const double* const* biases) {
+    memset(inf, 0, sizeof(*inf));
+    inf->n_layers = n_layers;
+    inf->dim = (int*)malloc(n_layers * sizeof(int));
+    inf->panels = (double**)calloc(n_layers, sizeof(double*));
+    inf->biases = (double**)calloc(n_layers, sizeof(double*));
+    if (inf->dim == NULL || inf->panels == NULL || inf->biases == NULL) {
+        ann_infer_free(inf);
+        return -1;
+    }
+    memcpy(inf->dim, dim, n_layers * sizeof(int));
+
+    int max_dim = 0;
+    for (int i = 1; i < n_layers; i++) {
+        int rows = dim[i], cols = dim[i - 1];
+        int padded = n_panels(rows) * ANN_INFER_LANES;
+        max_dim = padded > max_dim ? padded : max_dim;
+        inf->panels[i - 1] = alloc_aligned((size_t)padded * cols);
+        inf->biases[i - 1] = alloc_aligned(padded);
+        if (inf->panels[i - 1] == NULL || inf->biases[i - 1] == NULL) {
+            ann_infer_free(inf);
+            return -1;
+        }
+        // Panel p holds rows p * LANES .. + LANES - 1, column-major; the
+        // padding rows are zero and never read back
+        for (int p = 0; p < n_panels(rows); p++) {
+            double* panel = inf->panels[i - 1] + (size_t)p * cols * ANN_INFER_LANES;
+            for (int k = 0; k < cols; k++) {
+                for (int l = 0; l < ANN_INFER_LANES; l++) {
+                    int r = p * ANN_INFER_LANES + l;
+                    panel[(size_t)k * ANN_INFER_LANES + l] = r < rows ? weights[i - 1][(size_t)r * cols + k] : 0;
+                }
+            }
+        }
+        for (int r = 0; r < padded; r++) {
+            inf->biases[i - 1][r] = r < rows ? biases[i - 1][r] : 0;
+        }
+    }
+    inf->act[0] = alloc_aligned(max_dim);
+    inf->act[1] = alloc_aligned(max_dim);
+    inf->nz = (int*)malloc((dim[0] > 0 ? dim[0] : 1) * sizeof(int));
+    if (inf->act[0] == NULL || inf->act[1] == NULL || inf->nz == NULL) {
+        ann_infer_free(inf);
+        return -1;
+    }
+    return 0;
+}
+
+void ann_infer_free(ann_infer* inf) {
+    for (int i = 0; i < inf->n_layers && inf->panels != NULL; i++) {
+        free(inf->panels[i]);
+        free(inf->biases[i]);
+    }
+    free(inf->panels);
+    free(inf->biases);
+    free(inf->dim);
+    free(inf->act[0]);
+    free(inf->act[1]);
+    free(inf->nz);
+    memset(inf, 0, sizeof(*inf));
+}
+
+// One layer: out = sigmoid(W in + b), reading only the inputs listed in idx
+// when idx is not NULL
+static void layer_forward(const double* restrict panels, const double* restrict bias, int rows, int cols,
+                          const double* restrict in, const int* idx, int n_idx, double* restrict out) {
+    for (int p = 0; p < n_panels(rows); p++) {
+        const double* panel = (const double*)__builtin_assume_aligned(
+            panels + (size_t)p * cols * ANN_INFER_LANES, ANN_INFER_ALIGN);
+        double acc[ANN_INFER_LANES];
+        memcpy(acc, bias + p * ANN_INFER_LANES, sizeof(acc));
+        if (idx != NULL) {
+            for (int e = 0; e < n_idx; e++) {
+                const double* w = panel + (size_t)idx[e] * ANN_INFER_LANES;
+                double xk = in[idx[e]];
+                for (int l = 0; l < ANN_INFER_LANES; l++) {
+                    acc[l] += w[l] * xk;
+                }
+            }
+        } else {
+            for (int k = 0; k < cols; k++) {
+                const double* w = panel + (size_t)k * ANN_INFER_LANES;
+                double xk = in[k];
+                for (int l = 0; l < ANN_INFER_LANES; l++) {
+                    acc[l] += w[l] * xk;
+                }
+            }
+        }
+        // The activation is applied while the panel is still in registers
+        int live = rows - p * ANN_INFER_LANES < ANN_INFER_LANES ? rows - p * ANN_INFER_LANES : ANN_INFER_LANES;
+        for (int l = 0; l < live; l++) {
+            out[p * ANN_INFER_LANES + l] = 1 / (1 + exp(-acc[l]));
+        }
+    }
+}
+
+const double* ann_infer_forward(ann_infer* inf, const double* x) {
+    // Pixel inputs are mostly zero, so layer 1 walks the nonzero ones
+    int n_nz = ann_nonzero_index(x, inf->dim[0], inf->nz);
+    const double* in = x;
+    for (int i = 1; i < inf->n_layers; i++) {
+        double* out = inf->act[i & 1];
+        layer_forward(inf->panels[i - 1], inf->biases[i - 1], inf->dim[i], inf->dim[i - 1], in,
+                      i == 1 ? inf->nz : NULL, n_nz, out);
+        in = out;
+    }
+    return in;
+}
+
+int ann_infer_predict(ann_infer* inf, const double* x) {
+    const double* out = ann_infer_forward(inf, x);
+    int n_out = inf->dim[inf->n_layers - 1];
+    if (n_out == 1) {
+        return out[0] >= 0.5;
+    }
+    int best = 0;
+    for (int i = 1; i < n_out; i++) {
+        if (out[i] > out[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
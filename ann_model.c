@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_model.h"
+
+static const char model_magic[8] = { 'A', 'N', 'N', 'M', 'O', 'D', 'E', 'L' };
+static const uint32_t byte_order_mark = 0x01020304;
+
+size_t ann_model_param_count(int n_layers, const int* dim) {
+    size_t n = 0;
+    for (int i = 1; i < n_layers; i++) {
+        size_t rows = (size_t)dim[i], cols = (size_t)dim[i - 1];
+        if (cols + 1 > (SIZE_MAX / sizeof(double) - n) / rows) {
+            return 0;
+        }
+        n += rows * cols + rows;
+    }
+    return n;
+}
+
+int ann_model_save(const char* path, int n_layers, const int* dim, const double* params) {
+    if (n_layers < 2 || n_layers > ANN_MODEL_MAX_LAYERS || ann_model_param_count(n_layers, dim) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    uint32_t header[3 + ANN_MODEL_MAX_LAYERS];
+    header[0] = ANN_MODEL_VERSION;
+    header[1] = byte_order_mark;
+    header[2] = (uint32_t)n_layers;
+    for (int i = 0; i < n_layers; i++) {
+        header[3 + i] = (uint32_t)dim[i];
+    }
+    size_t n_params = ann_model_param_count(n_layers, dim);
+    int ok = fwrite(model_magic, sizeof(model_magic), 1, f) == 1
+          && fwrite(header, sizeof(uint32_t), 3 + n_layers, f) == (size_t)(3 + n_layers)
+          && fwrite(params, sizeof(double), n_params, f) == n_params;
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+int ann_model_load(const char* path, ann_model* model) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    char magic[sizeof(model_magic)];
+    uint32_t header[3];
+    model->params = NULL;
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, model_magic, sizeof(magic)) != 0
+        || fread(header, sizeof(uint32_t), 3, f) != 3 || header[0] != ANN_MODEL_VERSION
+        || header[1] != byte_order_mark || header[2] < 2 || header[2] > ANN_MODEL_MAX_LAYERS) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    model->n_layers = (int)header[2];
+    uint32_t dim[ANN_MODEL_MAX_LAYERS];
+    if (fread(dim, sizeof(uint32_t), model->n_layers, f) != (size_t)model->n_layers) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < model->n_layers; i++) {
+        if (dim[i] < 1 || dim[i] > 1 << 20) {
+            fclose(f);
+            errno = EINVAL;
+            return -1;
+        }
+        model->dim[i] = (int)dim[i];
+    }
+    size_t n_params = ann_model_param_count(model->n_layers, model->dim);
+    model->params = n_params > 0 ? (double*)malloc(n_params * sizeof(double)) : NULL;
+    if (model->params == NULL || fread(model->params, sizeof(double), n_params, f) != n_params) {
+        free(model->params);
+        model->params = NULL;
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+void ann_model_free(ann_model* model) {
+    free(model->params);
+    model->params = NULL;
+}
+
+static void offset_path(char* buf, size_t size, const char* path, const char* suffix) {
+    snprintf(buf, size, "%s.offset%s", path, suffix);
+}
+
+int ann_model_read_offset(const char* path, long long* offset, long long* rows) {
+    char name[4096];
+    offset_path(name, sizeof(name), path, "");
+    FILE* f = fopen(name, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    int ok = fscanf(f, "offset %lld rows %lld", offset, rows) == 2 && *offset >= 0 && *rows >= 0;
+    fclose(f);
+    if (!ok) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int ann_model_write_offset(const char* path, long long offset, long long rows) {
+    char name[4096], tmp[4096];
+    offset_path(name, sizeof(name), path, "");
+    offset_path(tmp, sizeof(tmp), path, ".tmp");
+    FILE* f = fopen(tmp, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    int ok = fprintf(f, "offset %lld\nrows %lld\n", offset, rows) > 0;
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, name) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef ANN_MODEL_H
+#define ANN_MODEL_H
+
+#include <stddef.h>
+
+// Variant-neutral model files, so a network trained by any driver can be
+// loaded by another (for example by the inference server).
+//
+// Layout: the 8-byte magic "ANNMODEL", a uint32 format version, a uint32
+// byte-order mark (0x01020304 as written by the host), a uint32 layer count
+// and one uint32 width per layer, followed by the parameters as doubles. For
+// every layer i >= 1 the parameters are the dim[i] x dim[i-1] weights row by
+// row, then the dim[i] biases. This is the same flat layout pack_ann uses.
+
+#define ANN_MODEL_VERSION 1
+#define ANN_MODEL_MAX_LAYERS 64
+
+typedef struct ann_model {
+    int n_layers;
+    int dim[ANN_MODEL_MAX_LAYERS];
+    double* params;
+} ann_model;
+
+//Number of weights and biases for the given layer widths, or 0 if it does
+//not fit in memory
+size_t ann_model_param_count(int n_layers, const int* dim);
+
+//Writes a model file; returns 0 on success, -1 on error (with errno set)
+int ann_model_save(const char* path, int n_layers, const int* dim, const double* params);
+
+//Reads a model file into model, allocating model->params. Returns 0 on
+//success, -1 if the file cannot be read or is not a compatible model file.
+int ann_model_load(const char* path, ann_model* model);
+
+void ann_model_free(ann_model* model);
+
+//Incremental training keeps a text sidecar next to the model, path plus
+//".offset", holding the byte offset just past the last training row the
+//model has seen and the number of rows seen in total. Returns 0 on success,
+//-1 if there is no sidecar or it is malformed.
+int ann_model_read_offset(const char* path, long long* offset, long long* rows);
+//Replaces the sidecar through a temporary file and rename, so a crash leaves
+//either the old offset or the new one; returns 0 on success
+int ann_model_write_offset(const char* path, long long offset, long long rows);
+
+#endif // ANN_MODEL_H
@@ -1,219 +1,914 @@
-#ifndef ANN_MPI_H
-#define ANN_MPI_H
-
-#include <time.h>
-#include <stdlib.h>
-#include <mpi.h>
-#include <math.h>
-#define MAX_SIZE  1000
-#define LAYER_SIZE 10
-
-//Declarations ANN structure
-typedef struct networks {
-    int n_layers;
-    int dim[LAYER_SIZE];
-    double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE];
-    double biases[LAYER_SIZE][MAX_SIZE];
-} network;
-
-//Function prototypes
-double sigmoid(double x);
-void init_ann(network*, int[], int);
-void init_ann_with_weights(network*, int[], double[LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE], int);
-void feed_forward(network*, double output[LAYER_SIZE][MAX_SIZE]);
-void train(network*, double**, int, double, int rank, int size);
-int predict(network*, double[MAX_SIZE]);
-void test(network*, double**, int);
-void arrayCopy(double dest[], double source[], int length);
-void free_ann(network* ann);
-
-void init_ann(network* ann, int dim[], int n_layers) {
-    time_t t;
-    srand((unsigned)time(&t));
-    ann->n_layers = n_layers;
-
-    for (int i = 0; i < n_layers; i++) {
-        ann->dim[i] = dim[i];
-    }
-    for (int i = 1; i < n_layers; i++) {
-        for (int j = 0; j < dim[i]; j++) {
-            for (int k = 0; k < dim[i - 1]; k++) {
-                ann->weights[i - 1][j][k] = ((double)rand() / (double)RAND_MAX) * (1 / sqrt(dim[i - 1] + dim[i]));
-            }
-        }
-    }
-    for (int i = 0; i < n_layers; i++) {
-        int val = 1;
-        for (int j = 0; j < ann->dim[i]; j++) {
-            if (i == 0) {
-                ann->biases[i][j] = 0;
-            } else {
-                ann->biases[i][j] = val;
-            }
-        }
-    }
-}
-
-void init_ann_with_weights(network* ann, int dim[], double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE], double biases[LAYER_SIZE][MAX_SIZE], int n_layers) {
-    ann->n_layers = n_layers;
-    for (int i = 0; i < n_layers; i++) {
-        ann->dim[i] = dim[i];
-    }
-    for (int i = 1; i < n_layers; i++) {
-        for (int j = 0; j < dim[i]; j++) {
-            for (int k = 0; k < dim[i - 1]; k++) {
-                ann->weights[i - 1][j][k] = weights[i - 1][j][k];
-            }
-        }
-    }
-    for (int i = 0; i < n_layers; i++) {
-        for (int j = 0; j < ann->dim[i]; j++) {
-            if (i == 0) {
-                ann->biases[i][j] = 0;
-            } else {
-                ann->biases[i][j] = biases[i][j];
-            }
-        }
-    }
-}
-
-void train(network* ann, double **data, int length, double learning_rate, int rank, int size) {
-    int local_start = rank * (length / size);
-    int local_end = (rank == size - 1) ? length : (rank + 1) * (length / size);
-
-    for (int t = local_start; t < local_end; t++) {
-        double output[ann->n_layers][MAX_SIZE];
-        //Set first layer output as input data
-        arrayCopy(output[0], data[t], ann->dim[0]);
-        // feed forward pass to determine values in all nodes.
-        feed_forward(ann, output);
-
-        //delta values
-        double d[ann->n_layers][MAX_SIZE];
-
-        //last layer delta computation
-        if (ann->dim[ann->n_layers - 1] == 1) {
-            double expected_value = data[t][ann->dim[0]];
-            double observed_value = output[ann->n_layers - 1][0];
-            d[ann->n_layers - 1][0] = observed_value * (1 - observed_value) * (observed_value - expected_value);
-
-        } else {
-            for (int i = 0; i < ann->dim[ann->n_layers - 1]; i++) {
-                double expected_value = (i == data[t][ann->dim[0]]) ? 1 : 0;
-                double observed_value = output[ann->n_layers - 1][i];
-                d[ann->n_layers - 1][i] = observed_value * (1 - observed_value) * (observed_value - expected_value);
-
-            }
-        }
-        //Hidden layers delta computation
-        for (int i = ann->n_layers - 2; i >= 0; i--) {
-            for (int j = 0; j < ann->dim[i]; j++) {
-                double fsum = 0;
-                for (int k = 0; k < ann->dim[i + 1]; k++) {
-                    fsum += d[i + 1][k] * ann->weights[i][k][j];
-                }
-                d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
-
-            }
-        }
-
-        //Updating weights and biases
-        for (int i = ann->n_layers - 2; i >= 0; i--) {
-            for (int j = 0; j < ann->dim[i + 1]; j++) {
-                for (int k = 0; k < ann->dim[i]; k++) {
-                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
-                }
-                ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
-            }
-        }
-    }
-    //Synchronize after each training pass
-    MPI_Barrier(MPI_COMM_WORLD);
-}
-
-int predict(network* ann, double data[MAX_SIZE]) {
-    double output[ann->n_layers][MAX_SIZE];
-    arrayCopy(output[0], data, ann->dim[0]);
-    feed_forward(ann, output);
-    int maxval = 0;
-    if (ann->dim[ann->n_layers - 1] == 1) {
-        if (output[ann->n_layers - 1][0] >= 0.5) {
-            return 1;
-        } else {
-            return 0;
-        }
-    } else {
-        for (int i = 0; i < ann->dim[ann->n_layers - 1]; i++) {
-            if (output[ann->n_layers - 1][i] > output[ann->n_layers - 1][maxval]) {
-                maxval = i;
-            }
-        }
-        return maxval;
-    }
-}
-
-void test(network* ann, double **data, int length) {
-    int correct = 0;
-    int incorrect = 0;
-    for (int t = 0; t < length; t++) {
-        double output[ann->n_layers][MAX_SIZE];
-        arrayCopy(output[0], data[t], ann->dim[0]);
-        feed_forward(ann, output);
-        int maxval = 0;
-        if (ann->dim[ann->n_layers - 1] == 1) {
-            printf("Object %lf is classified as %lf\n", data[t][ann->dim[0]], output[ann->n_layers - 1][0]);
-            if ((output[ann->n_layers - 1][0] >= 0.5 && data[t][ann->dim[0]] == 1) || (output[ann->n_layers - 1][0] < 0.5 && data[t][ann->dim[0]] == 0)) {
-                correct += 1;
-            } else {
-                incorrect += 1;
-            }
-        } else {
-            for (int i = 0; i < ann->dim[ann->n_layers - 1]; i++) {
-                if (output[ann->n_layers - 1][i] > output[ann->n_layers - 1][maxval]) {
-                    maxval = i;
-                }
-            }
-
-            printf("Object %lf is classified as %d\n", data[t][ann->dim[0]], maxval);
-            if (maxval == data[t][ann->dim[0]]) {
-                correct += 1;
-            } else {
-                incorrect += 1;
-            }
-        }
-    }
-    double accuracy = ((double)correct / (double)length) * 100;
-    printf("correct: %d, incorrect: %d, accuracy: %lf\n", correct, incorrect, accuracy);
-}
-
-void feed_forward(network* ann, double output[LAYER_SIZE][MAX_SIZE]) {
-    double* input;
-    for (int i = 1; i < ann->n_layers; i++) {
-        input = output[i - 1];
-        for (int j = 0; j < ann->dim[i]; j++) {
-            double f_sum = 0;
-            for (int k = 0; k < ann->dim[i - 1]; k++) {
-                f_sum += ann->weights[i - 1][j][k] * input[k];
-            }
-            f_sum += ann->biases[i][j];
-            output[i][j] = sigmoid(f_sum);
-        }
-    }
-}
-
-double sigmoid(double x) {
-    return 1 / (1 + exp(-x));
-}
-
-void arrayCopy(double dest[], double source[], int length) {
-    for (int i = 0; i < length; i++) {
-        dest[i] = source[i];
-    }
-}
-
-void free_ann(network* ann) {
-    // Since the network structure uses static arrays, we just need to free the pointer if it was dynamically allocated
-    // Add any additional cleanup needed for your specific implementation
-}
-
+#ifndef ANN_MPI_H
+#define ANN_MPI_H
+
+#include <time.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "ann_compress.h"
+#include "ann_eval.h"
+#include "ann_model.h"
+#include "ann_rng.h"
+#include "ann_sparse.h"
+#include "ann_prof.h"
+#define MAX_SIZE  1000
+#define LAYER_SIZE 10
+
+//Declarations ANN structure
+typedef struct networks {
+    int n_layers;
+    int dim[LAYER_SIZE];
+    double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE];
+    double biases[LAYER_SIZE][MAX_SIZE];
+} network;
+
+//Function prototypes
+double sigmoid(double x);
+//Random weights drawn from ann_rng.h; ranks given the same seed build the
+//same network without communicating
+void init_ann(network*, int[], int, uint64_t seed);
+void init_ann_with_weights(network*, int[], double[LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE], int);
+void feed_forward(network*, double output[LAYER_SIZE][MAX_SIZE]);
+void compute_deltas(network*, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double label);
+void update_weights(network*, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double learning_rate);
+//compute_deltas and update_weights fused: each weight is read once, its old
+//value feeds the lower layer's delta and the new one is stored in place
+void backward_update(network*, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double label, double learning_rate);
+void train_sample(network*, double* row, double learning_rate);
+void train(network*, double**, int, double, int rank, int size);
+int predict(network*, double[MAX_SIZE]);
+//Tallies this rank's block of the labelled rows into e; row t is sample
+//first_id + t. Merge the ranks' tallies with reduce_eval (ann_mpi_util.h).
+void evaluate(network*, double**, int length, long first_id, ann_eval* e, int rank, int size);
+//Evaluates every row on this rank and prints a one-block summary
+void test(network*, double**, int);
+void arrayCopy(double dest[], double source[], int length);
+void free_ann(network* ann);
+
+//Read-only copy of a network shared by all ranks of a node through an MPI-3
+//shared-memory window, so inference holds one model per node instead of one
+//per rank
+typedef struct shared_network {
+    network* ann;        // this node's copy, mapped into every local rank
+    MPI_Win win;
+    MPI_Comm node_comm;
+} shared_network;
+
+void bcast_ann(network*, int root, MPI_Comm comm);
+network* share_ann(shared_network*, network* ann, int root, MPI_Comm comm);
+void free_shared_ann(shared_network*);
+
+//Asynchronous parameter server. The master weights, flattened, are sharded
+//over the RMA windows of the first n_servers ranks. Every rank is a worker:
+//it trains its local copy and, every interval samples, adds its (1/size
+//weighted) change to the master weights and reads them back with one
+//MPI_Get_accumulate per shard, with no collective call. A stale-synchronous clock bounds drift: a
+//worker that has synced more than staleness times more often than the
+//slowest unfinished worker waits for it.
+typedef struct param_server {
+    int n_params;
+    int n_servers;
+    int* shard_start;     // first parameter held by each server rank
+    int* shard_count;
+    double* shard;        // this rank's shard, NULL on workers
+    MPI_Win win;
+    int* clocks;          // sync count of every worker, on rank 0
+    MPI_Win clock_win;
+    double* snapshot;     // master weights as of this worker's last sync
+    double* delta;
+    int interval;         // samples between syncs
+    int staleness;        // allowed clock lead over the slowest worker
+    int since_sync;
+    int clock;
+    MPI_Comm comm;
+    int rank, size;
+} param_server;
+
+int ann_param_count(network*);
+void pack_ann(network*, double* flat);
+void unpack_ann(network*, const double* flat);
+//Writes the variant-neutral model file of ann_model.h; returns 0 on success
+int save_ann(network*, const char* path);
+void ps_init(param_server*, network* ann, int n_servers, int interval, int staleness, MPI_Comm comm);
+void ps_sync(param_server*, network* ann);
+void train_async(network*, param_server*, double** data, int length, double learning_rate);
+void ps_finish(param_server*, network* ann);
+
+//Synchronous model averaging: every interval samples all ranks average the
+//change they made to their local copy since the last sync, so the copies
+//stay identical. The changes are exchanged through a codec; lossy codecs
+//keep what they dropped in a per-rank residual that is added to the next
+//change (error feedback), so no update is lost, only delayed. FP16 and BF16
+//are summed in double by the rank owning each shard, which also keeps the
+//rounding of the summed shard in its residual.
+typedef struct model_sync {
+    int n_params;
+    ann_codec codec;
+    int topk;             // entries each rank sends with ANN_CODEC_TOPK
+    int interval;         // samples between syncs
+    double* snapshot;     // common weights after the last sync
+    double* delta;
+    double* residual;     // error-feedback residual for lossy codecs
+    double* sum;
+    void* send;           // encoded buffers
+    void* recv;
+    int* shard_start;     // FP16/BF16: rank r sums entries shard_start[r] .. + shard_count[r]
+    int* shard_count;
+    int* from_start;      // where each rank's copy of this rank's shard lands in shard
+    int* from_count;
+    uint16_t* shard;      // every rank's encoded entries of this rank's shard
+    double bytes;         // bytes this rank put on the wire
+    double raw_bytes;     // bytes the same exchanges would take as doubles
+    MPI_Comm comm;
+    int rank, size;
+} model_sync;
+
+void sync_init(model_sync*, network* ann, ann_codec codec, double topk_ratio, int interval, MPI_Comm comm);
+void sync_ann(model_sync*, network* ann);
+void train_sync(network*, model_sync*, double** data, int length, double learning_rate);
+//Trains on rows this rank read itself; steps is the most rows any rank has
+//this round, so every rank syncs the same number of times
+void train_sync_rows(network*, model_sync*, double** rows, int length, int steps, double learning_rate);
+void sync_finish(model_sync*);
+
+//Ensemble of the models the ranks trained independently. Rather than send
+//every input row to every rank, the ranks exchange their packed models with
+//one MPI_Allgather and each rank scores its own rows with all of them, so the
+//averaged outputs are the same at a per-rank cost that does not grow with
+//the number of ranks.
+typedef struct ensemble {
+    int n_models;
+    int n_params;
+    double* params;     // n_models x n_params, in rank order
+    network* scratch;   // the model being applied
+} ensemble;
+
+//Gathers every rank's model; ann becomes the scratch network, so its
+//weights are overwritten by the first ensemble call
+void ensemble_init(ensemble*, network* ann, MPI_Comm comm);
+//Mean output layer of all models for n rows, n x dim[n_layers-1]
+void ensemble_outputs(ensemble*, double** rows, int n, double* out);
+void ensemble_predict(ensemble*, double** rows, int n, int* labels);
+//Tallies the mean outputs of n labelled rows; row t is sample first_id + t
+void ensemble_evaluate(ensemble*, double** rows, int n, long first_id, ann_eval* e);
+void ensemble_free(ensemble*);
+//Replaces every rank's model by the parameter mean over all ranks
+void average_ann(network*, MPI_Comm comm);
+
+void init_ann(network* ann, int dim[], int n_layers, uint64_t seed) {
+    ann->n_layers = n_layers;
+
+    for (int i = 0; i < n_layers; i++) {
+        ann->dim[i] = dim[i];
+    }
+    for (int i = 1; i < n_layers; i++) {
+        double scale = 1 / sqrt(dim[i - 1] + dim[i]);
+        for (int j = 0; j < dim[i]; j++) {
+            for (int k = 0; k < dim[i - 1]; k++) {
+                ann->weights[i - 1][j][k] = ann_rng_weight(seed, i, j, k) * scale;
+            }
+        }
+    }
+    for (int i = 0; i < n_layers; i++) {
+        int val = 1;
+        for (int j = 0; j < ann->dim[i]; j++) {
+            if (i == 0) {
+                ann->biases[i][j] = 0;
+            } else {
+                ann->biases[i][j] = val;
+            }
+        }
+    }
+}
+
+void init_ann_with_weights(network* ann, int dim[], double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE], double biases[LAYER_SIZE][MAX_SIZE], int n_layers) {
+    ann->n_layers = n_layers;
+    for (int i = 0; i < n_layers; i++) {
+        ann->dim[i] = dim[i];
+    }
+    for (int i = 1; i < n_layers; i++) {
+        for (int j = 0; j < dim[i]; j++) {
+            for (int k = 0; k < dim[i - 1]; k++) {
+                ann->weights[i - 1][j][k] = weights[i - 1][j][k];
+            }
+        }
+    }
+    for (int i = 0; i < n_layers; i++) {
+        for (int j = 0; j < ann->dim[i]; j++) {
+            if (i == 0) {
+                ann->biases[i][j] = 0;
+            } else {
+                ann->biases[i][j] = biases[i][j];
+            }
+        }
+    }
+}
+
+static void output_deltas(network* ann, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double label) {
+    //last layer delta computation
+    if (ann->dim[ann->n_layers - 1] == 1) {
+        double expected_value = label;
+        double observed_value = output[ann->n_layers - 1][0];
+        d[ann->n_layers - 1][0] = observed_value * (1 - observed_value) * (observed_value - expected_value);
+
+    } else {
+        for (int i = 0; i < ann->dim[ann->n_layers - 1]; i++) {
+            double expected_value = (i == label) ? 1 : 0;
+            double observed_value = output[ann->n_layers - 1][i];
+            d[ann->n_layers - 1][i] = observed_value * (1 - observed_value) * (observed_value - expected_value);
+
+        }
+    }
+}
+
+void compute_deltas(network* ann, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double label) {
+    output_deltas(ann, output, d, label);
+    //Hidden layers delta computation; the input layer's would never be read
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        for (int j = 0; j < ann->dim[i]; j++) {
+            double fsum = 0;
+            for (int k = 0; k < ann->dim[i + 1]; k++) {
+                fsum += d[i + 1][k] * ann->weights[i][k][j];
+            }
+            d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
+
+        }
+    }
+}
+
+void update_weights(network* ann, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double learning_rate) {
+    // The gradient of a weight from a zero pixel is zero
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = ann->n_layers - 2; i >= 0; i--) {
+        int sparse_input = (i == 0 && 2 * n_nz <= ann->dim[0]);
+        for (int j = 0; j < ann->dim[i + 1]; j++) {
+            if (sparse_input) {
+                for (int e = 0; e < n_nz; e++) {
+                    ann->weights[0][j][nz[e]] -= learning_rate * output[0][nz[e]] * d[1][j];
+                }
+            } else {
+                for (int k = 0; k < ann->dim[i]; k++) {
+                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
+                }
+            }
+            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+        }
+    }
+}
+
+void backward_update(network* ann, double output[LAYER_SIZE][MAX_SIZE], double d[LAYER_SIZE][MAX_SIZE], double label, double learning_rate) {
+    output_deltas(ann, output, d, label);
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        // Row j of the weights holds the connections into unit j of layer
+        // i + 1; column k's old values sum into the delta of unit k below
+        double fsum[MAX_SIZE];
+        memset(fsum, 0, ann->dim[i] * sizeof(double));
+        for (int j = 0; j < ann->dim[i + 1]; j++) {
+            double dj = d[i + 1][j];
+            double* w = ann->weights[i][j];
+            for (int k = 0; k < ann->dim[i]; k++) {
+                fsum[k] += dj * w[k];
+                w[k] -= learning_rate * output[i][k] * dj;
+            }
+            ann->biases[i + 1][j] -= learning_rate * dj;
+        }
+        for (int k = 0; k < ann->dim[i]; k++) {
+            d[i][k] = output[i][k] * (1 - output[i][k]) * fsum[k];
+        }
+    }
+    // The input layer needs no delta, only the update, on its nonzero pixels
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int j = 0; j < ann->dim[1]; j++) {
+        double dj = d[1][j];
+        double* w = ann->weights[0][j];
+        if (2 * n_nz <= ann->dim[0]) {
+            for (int e = 0; e < n_nz; e++) {
+                w[nz[e]] -= learning_rate * output[0][nz[e]] * dj;
+            }
+        } else {
+            for (int k = 0; k < ann->dim[0]; k++) {
+                w[k] -= learning_rate * output[0][k] * dj;
+            }
+        }
+        ann->biases[1][j] -= learning_rate * dj;
+    }
+}
+
+//One timed SGD step on a single labelled row
+void train_sample(network* ann, double* row, double learning_rate) {
+    double output[ann->n_layers][MAX_SIZE];
+    //Set first layer output as input data
+    arrayCopy(output[0], row, ann->dim[0]);
+    // feed forward pass to determine values in all nodes.
+    double t0 = ann_prof_begin();
+    feed_forward(ann, output);
+    ann_prof_end(ANN_PHASE_FORWARD, t0, ann_flops_forward(ann->dim, ann->n_layers));
+
+    //Deltas and weight updates in one pass over the weights
+    double d[ann->n_layers][MAX_SIZE];
+    t0 = ann_prof_begin();
+    backward_update(ann, output, d, row[ann->dim[0]], learning_rate);
+    ann_prof_end(ANN_PHASE_BACKWARD, t0, ann_flops_backward(ann->dim, ann->n_layers) + ann_flops_update(ann->dim, ann->n_layers));
+}
+
+void train(network* ann, double **data, int length, double learning_rate, int rank, int size) {
+    int local_start = rank * (length / size);
+    int local_end = (rank == size - 1) ? length : (rank + 1) * (length / size);
+
+    for (int t = local_start; t < local_end; t++) {
+        train_sample(ann, data[t], learning_rate);
+    }
+    ann_prof_samples(local_end - local_start);
+    //Synchronize after each training pass
+    double t0 = ann_prof_begin();
+    MPI_Barrier(MPI_COMM_WORLD);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+}
+
+int predict(network* ann, double data[MAX_SIZE]) {
+    double output[ann->n_layers][MAX_SIZE];
+    arrayCopy(output[0], data, ann->dim[0]);
+    double t0 = ann_prof_begin();
+    feed_forward(ann, output);
+    ann_prof_end(ANN_PHASE_FORWARD, t0, ann_flops_forward(ann->dim, ann->n_layers));
+    ann_prof_samples(1);
+    int maxval = 0;
+    if (ann->dim[ann->n_layers - 1] == 1) {
+        if (output[ann->n_layers - 1][0] >= 0.5) {
+            return 1;
+        } else {
+            return 0;
+        }
+    } else {
+        for (int i = 0; i < ann->dim[ann->n_layers - 1]; i++) {
+            if (output[ann->n_layers - 1][i] > output[ann->n_layers - 1][maxval]) {
+                maxval = i;
+            }
+        }
+        return maxval;
+    }
+}
+
+void evaluate(network* ann, double **data, int length, long first_id, ann_eval* e, int rank, int size) {
+    int local_start = rank * (length / size);
+    int local_end = (rank == size - 1) ? length : (rank + 1) * (length / size);
+    int n_out = ann->dim[ann->n_layers - 1];
+    double t0 = ann_prof_begin();
+    for (int t = local_start; t < local_end; t++) {
+        double output[ann->n_layers][MAX_SIZE];
+        arrayCopy(output[0], data[t], ann->dim[0]);
+        feed_forward(ann, output);
+        ann_eval_add(e, output[ann->n_layers - 1], n_out, (int)data[t][ann->dim[0]], first_id + t);
+    }
+    ann_prof_end(ANN_PHASE_FORWARD, t0, (local_end - local_start) * ann_flops_forward(ann->dim, ann->n_layers));
+    ann_prof_samples(local_end - local_start);
+}
+
+void test(network* ann, double **data, int length) {
+    ann_eval e;
+    ann_eval_init(&e, ann->dim[ann->n_layers - 1], 0);
+    evaluate(ann, data, length, 1, &e, 0, 1);
+    ann_eval_print(&e, "test", stdout);
+    ann_eval_free(&e);
+}
+
+void feed_forward(network* ann, double output[LAYER_SIZE][MAX_SIZE]) {
+    double* input;
+    // Zero pixels add nothing to layer 1, so it only reads the nonzero ones
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = 1; i < ann->n_layers; i++) {
+        input = output[i - 1];
+        int sparse_input = (i == 1 && 2 * n_nz <= ann->dim[0]);
+        for (int j = 0; j < ann->dim[i]; j++) {
+            double f_sum = 0;
+            if (sparse_input) {
+                for (int e = 0; e < n_nz; e++) {
+                    f_sum += ann->weights[0][j][nz[e]] * input[nz[e]];
+                }
+            } else {
+                for (int k = 0; k < ann->dim[i - 1]; k++) {
+                    f_sum += ann->weights[i - 1][j][k] * input[k];
+                }
+            }
+            f_sum += ann->biases[i][j];
+            output[i][j] = sigmoid(f_sum);
+        }
+    }
+}
+
+double sigmoid(double x) {
+    return 1 / (1 + exp(-x));
+}
+
+void arrayCopy(double dest[], double source[], int length) {
+    for (int i = 0; i < length; i++) {
+        dest[i] = source[i];
+    }
+}
+
+void free_ann(network* ann) {
+    // Since the network structure uses static arrays, we just need to free the pointer if it was dynamically allocated
+    // Add any additional cleanup needed for your specific implementation
+}
+
+//Broadcasts only the used part of the fixed-size weight and bias arrays
+void bcast_ann(network* ann, int root, MPI_Comm comm) {
+    MPI_Bcast(&ann->n_layers, 1, MPI_INT, root, comm);
+    MPI_Bcast(ann->dim, LAYER_SIZE, MPI_INT, root, comm);
+    for (int i = 1; i < ann->n_layers; i++) {
+        MPI_Datatype rows;
+        MPI_Type_vector(ann->dim[i], ann->dim[i - 1], MAX_SIZE, MPI_DOUBLE, &rows);
+        MPI_Type_commit(&rows);
+        MPI_Bcast(&ann->weights[i - 1][0][0], 1, rows, root, comm);
+        MPI_Type_free(&rows);
+        MPI_Bcast(ann->biases[i], ann->dim[i], MPI_DOUBLE, root, comm);
+    }
+}
+
+network* share_ann(shared_network* shared, network* ann, int root, MPI_Comm comm) {
+    int rank, node_rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shared->node_comm);
+    MPI_Comm_rank(shared->node_comm, &node_rank);
+
+    // Node rank 0 owns the memory; everyone else maps it
+    network* base;
+    MPI_Aint window_size = (node_rank == 0) ? (MPI_Aint)sizeof(network) : 0;
+    MPI_Win_allocate_shared(window_size, sizeof(double), MPI_INFO_NULL, shared->node_comm, &base, &shared->win);
+    MPI_Aint owner_size;
+    int disp_unit;
+    MPI_Win_shared_query(shared->win, 0, &owner_size, &disp_unit, &shared->ann);
+
+    // One leader per node; the leader of root's node broadcasts to the others
+    MPI_Comm leaders;
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+    int has_root = (rank == root), node_has_root = 0;
+    MPI_Allreduce(&has_root, &node_has_root, 1, MPI_INT, MPI_MAX, shared->node_comm);
+
+    MPI_Win_fence(0, shared->win);
+    if (rank == root) {
+        shared->ann->n_layers = ann->n_layers;
+        memcpy(shared->ann->dim, ann->dim, sizeof(ann->dim));
+        for (int i = 1; i < ann->n_layers; i++) {
+            for (int j = 0; j < ann->dim[i]; j++) {
+                memcpy(shared->ann->weights[i - 1][j], ann->weights[i - 1][j], ann->dim[i - 1] * sizeof(double));
+            }
+            memcpy(shared->ann->biases[i], ann->biases[i], ann->dim[i] * sizeof(double));
+        }
+    }
+    MPI_Win_fence(0, shared->win);
+    if (leaders != MPI_COMM_NULL) {
+        int leader_rank, source = -1, bcast_root;
+        MPI_Comm_rank(leaders, &leader_rank);
+        if (node_has_root) {
+            source = leader_rank;
+        }
+        MPI_Allreduce(&source, &bcast_root, 1, MPI_INT, MPI_MAX, leaders);
+        bcast_ann(shared->ann, bcast_root, leaders);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Win_fence(0, shared->win);
+    return shared->ann;
+}
+
+void free_shared_ann(shared_network* shared) {
+    MPI_Win_free(&shared->win);
+    MPI_Comm_free(&shared->node_comm);
+    shared->ann = NULL;
+}
+
+//Flattened layout: for each layer i >= 1, dim[i] rows of dim[i-1] weights,
+//then dim[i] biases
+int ann_param_count(network* ann) {
+    int n = 0;
+    for (int i = 1; i < ann->n_layers; i++) {
+        n += ann->dim[i] * ann->dim[i - 1] + ann->dim[i];
+    }
+    return n;
+}
+
+void pack_ann(network* ann, double* flat) {
+    for (int i = 1; i < ann->n_layers; i++) {
+        for (int j = 0; j < ann->dim[i]; j++) {
+            memcpy(flat, ann->weights[i - 1][j], ann->dim[i - 1] * sizeof(double));
+            flat += ann->dim[i - 1];
+        }
+        memcpy(flat, ann->biases[i], ann->dim[i] * sizeof(double));
+        flat += ann->dim[i];
+    }
+}
+
+void unpack_ann(network* ann, const double* flat) {
+    for (int i = 1; i < ann->n_layers; i++) {
+        for (int j = 0; j < ann->dim[i]; j++) {
+            memcpy(ann->weights[i - 1][j], flat, ann->dim[i - 1] * sizeof(double));
+            flat += ann->dim[i - 1];
+        }
+        memcpy(ann->biases[i], flat, ann->dim[i] * sizeof(double));
+        flat += ann->dim[i];
+    }
+}
+
+int save_ann(network* ann, const char* path) {
+    double* params = (double*)malloc(ann_param_count(ann) * sizeof(double));
+    pack_ann(ann, params);
+    int status = ann_model_save(path, ann->n_layers, ann->dim, params);
+    free(params);
+    return status;
+}
+
+void ensemble_init(ensemble* ens, network* ann, MPI_Comm comm) {
+    MPI_Comm_size(comm, &ens->n_models);
+    ens->n_params = ann_param_count(ann);
+    ens->params = (double*)malloc((size_t)ens->n_models * ens->n_params * sizeof(double));
+    ens->scratch = ann;
+    double* mine = (double*)malloc(ens->n_params * sizeof(double));
+    pack_ann(ann, mine);
+    double t0 = ann_prof_begin();
+    MPI_Allgather(mine, ens->n_params, MPI_DOUBLE, ens->params, ens->n_params, MPI_DOUBLE, comm);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    free(mine);
+}
+
+void ensemble_outputs(ensemble* ens, double** rows, int n, double* out) {
+    network* ann = ens->scratch;
+    int n_out = ann->dim[ann->n_layers - 1];
+    memset(out, 0, (size_t)n * n_out * sizeof(double));
+    // Models outer, rows inner: each model is unpacked once per call
+    for (int m = 0; m < ens->n_models; m++) {
+        unpack_ann(ann, ens->params + (size_t)m * ens->n_params);
+        double t0 = ann_prof_begin();
+        for (int t = 0; t < n; t++) {
+            double output[ann->n_layers][MAX_SIZE];
+            arrayCopy(output[0], rows[t], ann->dim[0]);
+            feed_forward(ann, output);
+            for (int k = 0; k < n_out; k++) {
+                out[(size_t)t * n_out + k] += output[ann->n_layers - 1][k];
+            }
+        }
+        ann_prof_end(ANN_PHASE_FORWARD, t0, n * ann_flops_forward(ann->dim, ann->n_layers));
+    }
+    for (size_t i = 0; i < (size_t)n * n_out; i++) {
+        out[i] /= ens->n_models;
+    }
+    ann_prof_samples(n);
+}
+
+void ensemble_predict(ensemble* ens, double** rows, int n, int* labels) {
+    int n_out = ens->scratch->dim[ens->scratch->n_layers - 1];
+    double* out = (double*)malloc(((size_t)n * n_out > 0 ? (size_t)n * n_out : 1) * sizeof(double));
+    ensemble_outputs(ens, rows, n, out);
+    for (int t = 0; t < n; t++) {
+        const double* o = out + (size_t)t * n_out;
+        int maxval = 0;
+        if (n_out == 1) {
+            maxval = o[0] >= 0.5;
+        } else {
+            for (int k = 1; k < n_out; k++) {
+                if (o[k] > o[maxval]) {
+                    maxval = k;
+                }
+            }
+        }
+        labels[t] = maxval;
+    }
+    free(out);
+}
+
+void ensemble_evaluate(ensemble* ens, double** rows, int n, long first_id, ann_eval* e) {
+    network* ann = ens->scratch;
+    int n_out = ann->dim[ann->n_layers - 1];
+    double* out = (double*)malloc(((size_t)n * n_out > 0 ? (size_t)n * n_out : 1) * sizeof(double));
+    ensemble_outputs(ens, rows, n, out);
+    for (int t = 0; t < n; t++) {
+        ann_eval_add(e, out + (size_t)t * n_out, n_out, (int)rows[t][ann->dim[0]], first_id + t);
+    }
+    free(out);
+}
+
+void ensemble_free(ensemble* ens) {
+    free(ens->params);
+    ens->params = NULL;
+}
+
+void average_ann(network* ann, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    int n = ann_param_count(ann);
+    double* params = (double*)malloc(n * sizeof(double));
+    pack_ann(ann, params);
+    double t0 = ann_prof_begin();
+    MPI_Allreduce(MPI_IN_PLACE, params, n, MPI_DOUBLE, MPI_SUM, comm);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    for (int i = 0; i < n; i++) {
+        params[i] /= size;
+    }
+    unpack_ann(ann, params);
+    free(params);
+}
+
+void ps_init(param_server* ps, network* ann, int n_servers, int interval, int staleness, MPI_Comm comm) {
+    ps->comm = comm;
+    MPI_Comm_rank(comm, &ps->rank);
+    MPI_Comm_size(comm, &ps->size);
+    ps->n_servers = n_servers < ps->size ? n_servers : ps->size;
+    ps->interval = interval;
+    ps->staleness = staleness;
+    ps->since_sync = 0;
+    ps->clock = 0;
+
+    // Everyone starts from rank 0's weights
+    bcast_ann(ann, 0, comm);
+    ps->n_params = ann_param_count(ann);
+    ps->snapshot = (double*)malloc(ps->n_params * sizeof(double));
+    ps->delta = (double*)malloc(ps->n_params * sizeof(double));
+    pack_ann(ann, ps->snapshot);
+
+    ps->shard_start = (int*)malloc(ps->n_servers * sizeof(int));
+    ps->shard_count = (int*)malloc(ps->n_servers * sizeof(int));
+    for (int s = 0; s < ps->n_servers; s++) {
+        ps->shard_count[s] = ps->n_params / ps->n_servers + (s < ps->n_params % ps->n_servers);
+        ps->shard_start[s] = (s == 0) ? 0 : ps->shard_start[s - 1] + ps->shard_count[s - 1];
+    }
+    int is_server = (ps->rank < ps->n_servers);
+    MPI_Aint shard_size = is_server ? (MPI_Aint)ps->shard_count[ps->rank] * sizeof(double) : 0;
+    MPI_Win_allocate(shard_size, sizeof(double), MPI_INFO_NULL, comm, &ps->shard, &ps->win);
+    if (is_server) {
+        memcpy(ps->shard, ps->snapshot + ps->shard_start[ps->rank], shard_size);
+    }
+    MPI_Aint clock_size = (ps->rank == 0) ? (MPI_Aint)ps->size * sizeof(int) : 0;
+    MPI_Win_allocate(clock_size, sizeof(int), MPI_INFO_NULL, comm, &ps->clocks, &ps->clock_win);
+    if (ps->rank == 0) {
+        memset(ps->clocks, 0, clock_size);
+    }
+
+    // Shards and clocks must be initialized before anyone reads them; from
+    // here on all access is passive-target
+    MPI_Barrier(comm);
+    MPI_Win_lock_all(0, ps->win);
+    MPI_Win_lock_all(0, ps->clock_win);
+}
+
+void ps_sync(param_server* ps, network* ann) {
+    double t0 = ann_prof_begin();
+    // Workers start from the same weights and push concurrently, so each
+    // change is weighted 1/size: summing full changes overshoots by the
+    // worker count
+    pack_ann(ann, ps->delta);
+    double weight = 1.0 / ps->size;
+    for (int p = 0; p < ps->n_params; p++) {
+        ps->delta[p] = (ps->delta[p] - ps->snapshot[p]) * weight;
+    }
+    // Atomically add this worker's change and fetch the master weights as
+    // they were just before it; their sum is the new master state
+    for (int s = 0; s < ps->n_servers; s++) {
+        MPI_Get_accumulate(ps->delta + ps->shard_start[s], ps->shard_count[s], MPI_DOUBLE,
+                           ps->snapshot + ps->shard_start[s], ps->shard_count[s], MPI_DOUBLE,
+                           s, 0, ps->shard_count[s], MPI_DOUBLE, MPI_SUM, ps->win);
+    }
+    MPI_Win_flush_all(ps->win);
+    for (int p = 0; p < ps->n_params; p++) {
+        ps->snapshot[p] += ps->delta[p];
+    }
+    unpack_ann(ann, ps->snapshot);
+    ps->since_sync = 0;
+
+    ps->clock++;
+    MPI_Accumulate(&ps->clock, 1, MPI_INT, 0, ps->rank, 1, MPI_INT, MPI_REPLACE, ps->clock_win);
+    MPI_Win_flush(0, ps->clock_win);
+    if (ps->staleness >= 0) {
+        int clocks[ps->size];
+        for (;;) {
+            MPI_Get_accumulate(NULL, 0, MPI_INT, clocks, ps->size, MPI_INT, 0, 0, ps->size, MPI_INT, MPI_NO_OP, ps->clock_win);
+            MPI_Win_flush(0, ps->clock_win);
+            int slowest = ps->clock;
+            for (int r = 0; r < ps->size; r++) {
+                slowest = clocks[r] < slowest ? clocks[r] : slowest;
+            }
+            if (ps->clock - slowest <= ps->staleness) {
+                break;
+            }
+        }
+    }
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+}
+
+void train_async(network* ann, param_server* ps, double** data, int length, double learning_rate) {
+    for (int t = 0; t < length; t++) {
+        train_sample(ann, data[t], learning_rate);
+        if (++ps->since_sync == ps->interval) {
+            ps_sync(ps, ann);
+        }
+    }
+    ann_prof_samples(length);
+}
+
+void ps_finish(param_server* ps, network* ann) {
+    if (ps->since_sync > 0) {
+        ps_sync(ps, ann);
+    }
+    // A finished worker must never hold the others back
+    int done = INT_MAX;
+    double t0 = ann_prof_begin();
+    MPI_Accumulate(&done, 1, MPI_INT, 0, ps->rank, 1, MPI_INT, MPI_REPLACE, ps->clock_win);
+    MPI_Win_flush(0, ps->clock_win);
+    MPI_Win_unlock_all(ps->clock_win);
+
+    // Once every worker is done, all ranks leave with the final master weights
+    MPI_Win_unlock_all(ps->win);
+    MPI_Barrier(ps->comm);
+    MPI_Win_lock_all(0, ps->win);
+    for (int s = 0; s < ps->n_servers; s++) {
+        MPI_Get_accumulate(NULL, 0, MPI_DOUBLE, ps->snapshot + ps->shard_start[s], ps->shard_count[s], MPI_DOUBLE,
+                           s, 0, ps->shard_count[s], MPI_DOUBLE, MPI_NO_OP, ps->win);
+    }
+    MPI_Win_unlock_all(ps->win);
+    unpack_ann(ann, ps->snapshot);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+
+    MPI_Win_free(&ps->win);
+    MPI_Win_free(&ps->clock_win);
+    free(ps->snapshot);
+    free(ps->delta);
+    free(ps->shard_start);
+    free(ps->shard_count);
+}
+
+void sync_init(model_sync* sync, network* ann, ann_codec codec, double topk_ratio, int interval, MPI_Comm comm) {
+    sync->comm = comm;
+    MPI_Comm_rank(comm, &sync->rank);
+    MPI_Comm_size(comm, &sync->size);
+    sync->codec = codec;
+    sync->interval = interval;
+    sync->bytes = 0;
+    sync->raw_bytes = 0;
+
+    bcast_ann(ann, 0, comm);
+    sync->n_params = ann_param_count(ann);
+    int n = sync->n_params;
+    sync->topk = (int)ceil(topk_ratio * n);
+    sync->topk = sync->topk < 1 ? 1 : (sync->topk > n ? n : sync->topk);
+    sync->snapshot = (double*)malloc(n * sizeof(double));
+    sync->delta = (double*)malloc(n * sizeof(double));
+    sync->residual = (double*)calloc(n, sizeof(double));
+    sync->sum = (double*)malloc(n * sizeof(double));
+    pack_ann(ann, sync->snapshot);
+
+    sync->send = NULL;
+    sync->recv = NULL;
+    sync->shard_start = NULL;
+    sync->shard_count = NULL;
+    sync->from_start = NULL;
+    sync->from_count = NULL;
+    sync->shard = NULL;
+    if (codec == ANN_CODEC_FP16 || codec == ANN_CODEC_BF16) {
+        // A reduction operator on 16-bit values would round every partial
+        // sum; a reduce-scatter of the encoded changes, a double sum per
+        // shard and an allgather of the encoded sums round it once
+        int size = sync->size;
+        sync->send = malloc(n * sizeof(uint16_t));
+        sync->recv = malloc(n * sizeof(uint16_t));
+        sync->shard_start = (int*)malloc(size * sizeof(int));
+        sync->shard_count = (int*)malloc(size * sizeof(int));
+        sync->from_start = (int*)malloc(size * sizeof(int));
+        sync->from_count = (int*)malloc(size * sizeof(int));
+        for (int r = 0; r < size; r++) {
+            sync->shard_count[r] = n / size + (r < n % size);
+            sync->shard_start[r] = (r == 0) ? 0 : sync->shard_start[r - 1] + sync->shard_count[r - 1];
+        }
+        int mine = sync->shard_count[sync->rank];
+        for (int r = 0; r < size; r++) {
+            sync->from_count[r] = mine;
+            sync->from_start[r] = r * mine;
+        }
+        sync->shard = (uint16_t*)malloc(((size_t)mine * size > 0 ? (size_t)mine * size : 1) * sizeof(uint16_t));
+    } else if (codec == ANN_CODEC_TOPK) {
+        // (index, value) pairs, gathered from every rank
+        size_t pair = sizeof(int32_t) + sizeof(float);
+        sync->send = malloc(sync->topk * pair);
+        sync->recv = malloc((size_t)sync->topk * pair * sync->size);
+    }
+}
+
+void sync_ann(model_sync* sync, network* ann) {
+    double t0 = ann_prof_begin();
+    int n = sync->n_params;
+    pack_ann(ann, sync->delta);
+    for (int p = 0; p < n; p++) {
+        sync->delta[p] = sync->delta[p] - sync->snapshot[p] + sync->residual[p];
+    }
+    sync->raw_bytes += (double)n * sizeof(double);
+
+    if (sync->codec == ANN_CODEC_NONE) {
+        MPI_Allreduce(sync->delta, sync->sum, n, MPI_DOUBLE, MPI_SUM, sync->comm);
+        sync->bytes += (double)n * sizeof(double);
+    } else if (sync->codec == ANN_CODEC_TOPK) {
+        int k = sync->topk;
+        int32_t* idx = (int32_t*)sync->send;
+        float* val = (float*)(idx + k);
+        int count = ann_topk_select(sync->delta, n, k, idx, val);
+        for (int i = count; i < k; i++) {
+            idx[i] = 0;
+            val[i] = 0;
+        }
+        // Whatever was not sent stays in the residual
+        memcpy(sync->residual, sync->delta, n * sizeof(double));
+        for (int i = 0; i < k; i++) {
+            sync->residual[idx[i]] -= val[i];
+        }
+        int pair_bytes = k * (int)(sizeof(int32_t) + sizeof(float));
+        MPI_Allgather(sync->send, pair_bytes, MPI_BYTE, sync->recv, pair_bytes, MPI_BYTE, sync->comm);
+        sync->bytes += pair_bytes;
+        memset(sync->sum, 0, n * sizeof(double));
+        for (int r = 0; r < sync->size; r++) {
+            const int32_t* ri = (const int32_t*)((char*)sync->recv + (size_t)r * pair_bytes);
+            const float* rv = (const float*)(ri + k);
+            for (int i = 0; i < k; i++) {
+                sync->sum[ri[i]] += rv[i];
+            }
+        }
+    } else {
+        int bf16 = (sync->codec == ANN_CODEC_BF16);
+        ann_encode_16(sync->delta, (uint16_t*)sync->send, n, bf16);
+        ann_decode_16((uint16_t*)sync->send, sync->sum, n, bf16);
+        for (int p = 0; p < n; p++) {
+            sync->residual[p] = sync->delta[p] - sync->sum[p];
+        }
+        MPI_Alltoallv(sync->send, sync->shard_count, sync->shard_start, MPI_UINT16_T,
+                      sync->shard, sync->from_count, sync->from_start, MPI_UINT16_T, sync->comm);
+
+        // Sum this rank's shard in double, then encode it once; the delta
+        // is spent by now and serves as decode scratch
+        int start = sync->shard_start[sync->rank];
+        int mine = sync->shard_count[sync->rank];
+        double* own = sync->sum + start;
+        memset(own, 0, mine * sizeof(double));
+        for (int r = 0; r < sync->size; r++) {
+            ann_decode_16(sync->shard + sync->from_start[r], sync->delta, mine, bf16);
+            for (int i = 0; i < mine; i++) {
+                own[i] += sync->delta[i];
+            }
+        }
+        uint16_t* gathered = (uint16_t*)sync->recv;
+        ann_encode_16(own, gathered + start, mine, bf16);
+        ann_decode_16(gathered + start, sync->delta, mine, bf16);
+        // Every rank applies the rounded sum, so its rounding joins the
+        // owner's residual and is sent again with the next change
+        for (int i = 0; i < mine; i++) {
+            sync->residual[start + i] += own[i] - sync->delta[i];
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                       gathered, sync->shard_count, sync->shard_start, MPI_UINT16_T, sync->comm);
+        sync->bytes += (double)n * sizeof(uint16_t);
+        ann_decode_16(gathered, sync->sum, n, bf16);
+    }
+
+    double scale = 1.0 / sync->size;
+    for (int p = 0; p < n; p++) {
+        sync->snapshot[p] += sync->sum[p] * scale;
+    }
+    unpack_ann(ann, sync->snapshot);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+}
+
+//Trains this rank's slice of a chunk (as train() does) and syncs every
+//interval steps; ranks with a shorter slice still join every sync
+void train_sync(network* ann, model_sync* sync, double** data, int length, double learning_rate) {
+    int local_start = sync->rank * (length / sync->size);
+    int local_end = (sync->rank == sync->size - 1) ? length : (sync->rank + 1) * (length / sync->size);
+    int longest = length - (sync->size - 1) * (length / sync->size);
+    train_sync_rows(ann, sync, data + local_start, local_end - local_start, longest, learning_rate);
+}
+
+void train_sync_rows(network* ann, model_sync* sync, double** rows, int length, int steps, double learning_rate) {
+    for (int step = 0; step < steps; step++) {
+        if (step < length) {
+            train_sample(ann, rows[step], learning_rate);
+        }
+        if ((step + 1) % sync->interval == 0 || step == steps - 1) {
+            sync_ann(sync, ann);
+        }
+    }
+    ann_prof_samples(length);
+}
+
+void sync_finish(model_sync* sync) {
+    free(sync->snapshot);
+    free(sync->delta);
+    free(sync->residual);
+    free(sync->sum);
+    free(sync->send);
+    free(sync->recv);
+    free(sync->shard_start);
+    free(sync->shard_count);
+    free(sync->from_start);
+    free(sync->from_count);
+    free(sync->shard);
+}
+
 #endif // ANN_MPI_H
\ No newline at end of file
@@ -0,0 +1,312 @@
+#ifndef ANN_MPI_UTIL_H
+#define ANN_MPI_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <mpi.h>
+
+#include "ann_csv.h"
+#include "ann_eval.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+
+// Instrumentation helpers for the MPI drivers. They are header-only so the
+// ann_core library stays free of MPI.
+
+//Reports the slowest rank's wall time, which is what the job actually took
+static inline void print_region(const char* label, const ann_prof_region* r, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    double wall = 0;
+    MPI_Reduce(&r->wall_seconds, &wall, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (rank == 0) {
+        ann_prof_print_region(label, r, wall);
+    }
+}
+
+//Gathers every rank's regions on rank 0 and writes them as one JSON report
+static inline void write_report(const char* path, const char* program, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int enabled = (path != NULL);
+    MPI_Bcast(&enabled, 1, MPI_INT, 0, comm);
+    if (!enabled) {
+        return;
+    }
+    char* json = ann_prof_rank_json(rank);
+    int len = (int)strlen(json) + 1;
+    int *lens = NULL, *displs = NULL;
+    char* all = NULL;
+    if (rank == 0) {
+        lens = (int*)malloc(size * sizeof(int));
+        displs = (int*)malloc(size * sizeof(int));
+    }
+    MPI_Gather(&len, 1, MPI_INT, lens, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        int total = 0;
+        for (int i = 0; i < size; i++) {
+            displs[i] = total;
+            total += lens[i];
+        }
+        all = (char*)malloc(total);
+    }
+    MPI_Gatherv(json, len, MPI_CHAR, all, lens, displs, MPI_CHAR, 0, comm);
+    if (rank == 0) {
+        char** fragments = (char**)malloc(size * sizeof(char*));
+        for (int i = 0; i < size; i++) {
+            fragments[i] = all + displs[i];
+        }
+        FILE* out = fopen(path, "w");
+        if (out == NULL) {
+            printf("Unable to open file %s\n", path);
+        } else {
+            ann_prof_write_report(out, program, fragments, size);
+            fclose(out);
+        }
+        free(fragments);
+        free(all);
+        free(lens);
+        free(displs);
+    }
+    free(json);
+}
+
+//Sums every rank's evaluation tally into root's with MPI_Reduce and gathers
+//the misclassified IDs there; the other ranks' tallies are left unchanged
+static inline void reduce_eval(ann_eval* e, int root, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int n_counts = 2 + ANN_EVAL_MAX_CLASSES * ANN_EVAL_MAX_CLASSES;
+    long counts[2 + ANN_EVAL_MAX_CLASSES * ANN_EVAL_MAX_CLASSES];
+    long total[2 + ANN_EVAL_MAX_CLASSES * ANN_EVAL_MAX_CLASSES];
+    counts[0] = e->count;
+    counts[1] = e->correct;
+    memcpy(counts + 2, e->confusion, sizeof(e->confusion));
+    double loss = 0;
+    MPI_Reduce(counts, total, n_counts, MPI_LONG, MPI_SUM, root, comm);
+    MPI_Reduce(&e->loss, &loss, 1, MPI_DOUBLE, MPI_SUM, root, comm);
+
+    int track = e->track_misclassified;
+    MPI_Bcast(&track, 1, MPI_INT, root, comm);
+    long* all = NULL;
+    int n_all = 0;
+    if (track) {
+        int n = (int)e->n_misclassified;
+        int *lens = NULL, *displs = NULL;
+        if (rank == root) {
+            lens = (int*)malloc(size * sizeof(int));
+            displs = (int*)malloc(size * sizeof(int));
+        }
+        MPI_Gather(&n, 1, MPI_INT, lens, 1, MPI_INT, root, comm);
+        if (rank == root) {
+            for (int i = 0; i < size; i++) {
+                displs[i] = n_all;
+                n_all += lens[i];
+            }
+            all = (long*)malloc((n_all > 0 ? n_all : 1) * sizeof(long));
+        }
+        MPI_Gatherv(e->misclassified, n, MPI_LONG, all, lens, displs, MPI_LONG, root, comm);
+        free(lens);
+        free(displs);
+    }
+
+    if (rank == root) {
+        e->count = total[0];
+        e->correct = total[1];
+        memcpy(e->confusion, total + 2, sizeof(e->confusion));
+        e->loss = loss;
+        if (track) {
+            free(e->misclassified);
+            e->misclassified = all;
+            e->n_misclassified = n_all;
+            e->cap_misclassified = n_all > 0 ? n_all : 1;
+        }
+    }
+}
+
+//Submission file written collectively with MPI-IO. Every rank formats its
+//own rows and writes them at its byte offset with MPI_File_write_at_all, so
+//no rank funnels the output. Each call's rows must be in rank order: rank r
+//holds the rows after those of ranks 0..r-1.
+typedef struct mpi_writer {
+    MPI_File file;
+    MPI_Offset offset;    // bytes written so far by all ranks
+    MPI_Comm comm;
+    char* buf;
+    size_t cap;
+} mpi_writer;
+
+//Collective; creates or truncates path and writes the header. Returns 0 on
+//success, -1 on every rank otherwise.
+static inline int mpi_writer_open(mpi_writer* w, const char* path, MPI_Comm comm) {
+    w->comm = comm;
+    w->buf = NULL;
+    w->cap = 0;
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &w->file) != MPI_SUCCESS) {
+        return -1;
+    }
+    MPI_File_set_size(w->file, 0);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    w->offset = (MPI_Offset)strlen(ANN_OUTPUT_HEADER);
+    int n = rank == 0 ? (int)w->offset : 0;
+    MPI_File_write_at_all(w->file, 0, ANN_OUTPUT_HEADER, n, MPI_CHAR, MPI_STATUS_IGNORE);
+    return 0;
+}
+
+//Collective; writes this rank's n rows, IDs first_id .. first_id + n - 1
+static inline void mpi_writer_predictions(mpi_writer* w, long first_id, const int* labels, int n) {
+    size_t need = (size_t)(n > 0 ? n : 1) * ANN_OUTPUT_MAX_ROW;
+    if (need > w->cap) {
+        free(w->buf);
+        w->cap = need;
+        w->buf = (char*)malloc(w->cap);
+    }
+    long long len = (long long)ann_format_predictions(w->buf, first_id, labels, n);
+    // The ranks before this one fill the bytes in front of it
+    long long before = 0, total = 0;
+    MPI_Exscan(&len, &before, 1, MPI_LONG_LONG, MPI_SUM, w->comm);
+    int rank;
+    MPI_Comm_rank(w->comm, &rank);
+    if (rank == 0) {
+        before = 0;  // MPI_Exscan leaves rank 0's result undefined
+    }
+    MPI_Allreduce(&len, &total, 1, MPI_LONG_LONG, MPI_SUM, w->comm);
+    MPI_File_write_at_all(w->file, w->offset + before, w->buf, (int)len, MPI_CHAR, MPI_STATUS_IGNORE);
+    w->offset += total;
+}
+
+//Collective; closes the file
+static inline void mpi_writer_close(mpi_writer* w) {
+    MPI_File_close(&w->file);
+    free(w->buf);
+    w->buf = NULL;
+}
+
+//One rank's share of a CSV file read with MPI-IO. The file is cut into even
+//byte ranges and a row belongs to the rank whose range holds its first byte,
+//so every rank reads its own range in one collective call and no rank reads
+//the whole file. Rows are ordered by rank: rank r's rows follow those of
+//ranks 0..r-1, starting at global row first_row.
+#define MPI_CSV_MAX_LINE 16000
+
+typedef struct mpi_csv {
+    char* text;          // this rank's rows, NUL-terminated
+    char* next;          // next row for mpi_csv_read
+    long n_rows;         // rows on this rank
+    long first_row;      // global index of this rank's first row
+    long total_rows;     // rows on all ranks
+} mpi_csv;
+
+//Collective; reads this rank's rows of path, skipping the header row.
+//Returns 0 on success, -1 on every rank otherwise.
+static inline int mpi_csv_open(mpi_csv* csv, const char* path, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    memset(csv, 0, sizeof(*csv));
+    MPI_File file;
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+        return -1;
+    }
+    MPI_Offset file_size;
+    MPI_File_get_size(file, &file_size);
+
+    // Read one byte before the range to see whether a row starts exactly at
+    // lo, and up to a line past it to finish the range's last row. A range
+    // at offset 0 starts with the header, which the skip below drops; an
+    // empty range, as in files with fewer bytes than ranks, reads nothing.
+    MPI_Offset lo = file_size * rank / size;
+    MPI_Offset hi = file_size * (rank + 1) / size;
+    MPI_Offset start = lo == 0 ? 0 : lo - 1;
+    MPI_Offset stop = hi + MPI_CSV_MAX_LINE < file_size ? hi + MPI_CSV_MAX_LINE : file_size;
+    if (lo == hi) {
+        stop = start;
+    }
+    int failed = stop - start > INT_MAX;
+    int n = failed ? 0 : (int)(stop - start);
+    char* buf = (char*)malloc((size_t)n + 1);
+    double t0 = ann_prof_begin();
+    MPI_Status status;
+    int got = 0;
+    if (MPI_File_read_at_all(file, start, buf, n, MPI_CHAR, &status) != MPI_SUCCESS
+        || MPI_Get_count(&status, MPI_CHAR, &got) != MPI_SUCCESS || got != n) {
+        failed = 1;
+        n = 0;
+    }
+    ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+    MPI_File_close(&file);
+    buf[n] = '\0';
+
+    // Rank 0 skips the header; the others skip the tail of the row that
+    // started in the previous range
+    char* end = buf + n;
+    char* p = memchr(buf, '\n', n);
+    p = p != NULL ? p + 1 : end;
+    if (start + (p - buf) >= hi) {
+        p = end;    // no row starts in this range
+    }
+    char* first = p;
+    long rows = 0;
+    while (p < end && start + (p - buf) < hi) {
+        char* eol = memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            if (stop < file_size) {
+                failed = 1;  // the row runs past the overlap
+            }
+            eol = end;
+        }
+        if (eol > p && !(eol == p + 1 && *p == '\r')) {
+            rows++;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    *p = '\0';
+    memmove(buf, first, p - first + 1);
+    csv->text = buf;
+    csv->next = buf;
+    csv->n_rows = rows;
+
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, comm);
+    if (failed) {
+        free(buf);
+        csv->text = csv->next = NULL;
+        return -1;
+    }
+    MPI_Exscan(&csv->n_rows, &csv->first_row, 1, MPI_LONG, MPI_SUM, comm);
+    if (rank == 0) {
+        csv->first_row = 0;  // MPI_Exscan leaves rank 0's result undefined
+    }
+    MPI_Allreduce(&csv->n_rows, &csv->total_rows, 1, MPI_LONG, MPI_SUM, comm);
+    return 0;
+}
+
+//Parses up to max_rows of this rank's remaining rows into rows and returns
+//how many it parsed
+static inline int mpi_csv_read(mpi_csv* csv, double** rows, int max_rows, int n_pixels, int has_label) {
+    int count = 0;
+    while (count < max_rows && *csv->next != '\0') {
+        char* line = csv->next;
+        char* eol = strchr(line, '\n');
+        csv->next = eol != NULL ? eol + 1 : line + strlen(line);
+        if (*line == '\n' || *line == '\0' || (line[0] == '\r' && (line[1] == '\n' || line[1] == '\0'))) {
+            continue;
+        }
+        double t0 = ann_prof_begin();
+        parse_csv_row(line, rows[count], n_pixels, has_label);
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+        count++;
+    }
+    return count;
+}
+
+static inline void mpi_csv_close(mpi_csv* csv) {
+    free(csv->text);
+    csv->text = csv->next = NULL;
+}
+
+#endif // ANN_MPI_UTIL_H
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ann_numa.h"
+
+void ann_configure_affinity(const ann_options* opts, char* argv[]) {
+    const char* places = opts->places ? opts->places : "cores";
+    const char* proc_bind = opts->proc_bind ? opts->proc_bind : "close";
+    if (strcmp(places, "none") == 0) {
+        return;
+    }
+    if (getenv("OMP_PLACES") != NULL || getenv("OMP_PROC_BIND") != NULL) {
+        return;
+    }
+    setenv("OMP_PLACES", places, 1);
+    setenv("OMP_PROC_BIND", proc_bind, 1);
+    fflush(stdout);
+    execv("/proc/self/exe", argv);
+    // Exec failed; carry on with whatever placement the runtime picks
+    printf("Unable to re-execute with OMP_PLACES=%s, threads are not pinned\n", places);
+}
+
+int ann_cpu_package(int cpu) {
+    char path[96];
+    int package = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%d", &package) != 1) {
+        package = 0;
+    }
+    fclose(f);
+    return package;
+}
@@ -0,0 +1,16 @@
+#ifndef ANN_NUMA_H
+#define ANN_NUMA_H
+
+#include "ann_common.h"
+
+//Pins OpenMP threads by exporting OMP_PLACES/OMP_PROC_BIND from opts and
+//re-executing the program, since the OpenMP runtime only reads them at
+//startup. Call before the first OpenMP construct. Does nothing when either
+//variable is already set (by the user, a launcher or a previous exec) or
+//when places is "none".
+void ann_configure_affinity(const ann_options* opts, char* argv[]);
+
+//Physical package (socket) of a logical CPU, 0 if unknown
+int ann_cpu_package(int cpu);
+
+#endif // ANN_NUMA_H
@@ -1,252 +1,358 @@
-
-#include <time.h>
-#define MAX_SIZE  1000
-#define LAYER_SIZE 10
-#include <omp.h>
-#include <stdlib.h>
-#include <math.h> 
-#include <stdio.h>
-
-
-
-//Declarations ANN structure
-typedef struct networks{
-    int n_layers;
-    int dim[LAYER_SIZE];
-    double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE];
-    double biases[LAYER_SIZE][MAX_SIZE];
-}network;
-
-
-//Function prototypes
-
-double sigmoid(double x);
-void init_ann(network*,int[] ,int);
-void init_ann_with_weights(network*,int[],double [LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE],int);
-void feed_forward(network*,double output[LAYER_SIZE][MAX_SIZE]);
-void train(network*, double**,int,double);
-int predict(network*,double[MAX_SIZE]);
-void test(network*,double**,int);
-
-void arrayCopy(double dest[],double source[],int length);
-
-
-void init_ann(network* ann,int dim[],int n_layers){
-    
-    time_t t;
-    //Intializes ANN with random weights and biases
-    srand((unsigned)time(&t));
-    ann->n_layers = n_layers;
-    
-    for(int i=0;i<n_layers;i++){
-        ann->dim[i] = dim[i];
-    }
-    for(int i=1;i<n_layers;i++){
-        for(int j=0;j<dim[i];j++){
-            for(int k=0;k<dim[i-1];k++){
-                ann->weights[i-1][j][k] = ((double)rand()/(double)RAND_MAX)*(1/sqrt(dim[i-1]+dim[i]));
-            }
-        }
-    }
-    for(int i=0;i<n_layers;i++){
-        int val = 1;
-        for(int j=0;j<ann->dim[i];j++){
-            if(i == 0){
-                ann->biases[i][j] = 0;
-            }
-            else{
-                ann->biases[i][j] = val;
-            }
-        }
-        
-    }
-    
-}
-
-void init_ann_with_weights(network* ann,int dim[],double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE],double biases[LAYER_SIZE][MAX_SIZE],int n_layers){
-    
-    ann->n_layers = n_layers;
-    for(int i=0;i<n_layers;i++){
-        ann->dim[i] = dim[i];
-    }
-    for(int i=1;i<n_layers;i++){
-        for(int j=0;j<dim[i];j++){
-            for(int k=0;k<dim[i-1];k++){
-                ann->weights[i-1][j][k] = weights[i-1][j][k];
-            }
-        }
-    }
-    for(int i=0;i<n_layers;i++){
-        for(int j=0;j<ann->dim[i];j++){
-            if(i == 0){
-                ann->biases[i][j] = 0;
-            }
-            else{
-                ann->biases[i][j] = biases[i][j];
-            }
-        }
-    }
-}
-
-
-
-void train(network* ann,double **data,int length,double learning_rate){
-    
-    for(int t=0;t<length;t++){
-        double output[ann->n_layers][MAX_SIZE];
-        //Set first layer output as input data
-        arrayCopy(output[0],data[t],ann->dim[0]);
-        // feed forward pass to determine values in all nodes.
-        feed_forward(ann,output);
-        
-
-        //delta values
-        double d[ann->n_layers][MAX_SIZE];
-        
-        //last layer delta computation
-        if(ann->dim[ann->n_layers-1] == 1){
-            double expected_value = data[t][ann->dim[0]];
-            double observed_value = output[ann->n_layers - 1][0];
-            d[ann->n_layers-1][0] = observed_value*(1-observed_value)*(observed_value - expected_value);
-                
-        }
-        else{
-            // printf("%f\n",data[t][784]);
-            for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-                
-                double expected_value = (i == data[t][ann->dim[0]])?1:0;
-                double observed_value = output[ann->n_layers - 1][i];
-                d[ann->n_layers-1][i] = observed_value*(1-observed_value)*(observed_value - expected_value);
-                
-            }
-        }
-       // Hidden layers delta computation
-for (int i = ann->n_layers - 2; i >= 0; i--) {
-    #pragma omp parallel for
-    for (int j = 0; j < ann->dim[i]; j++) {
-        double fsum = 0;
-        for (int k = 0; k < ann->dim[i + 1]; k++) {
-            fsum += d[i + 1][k] * ann->weights[i][k][j];
-        }
-        d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
-    }
-}
-
-
-        //Updating weigths and biases
-
-        for (int i = ann->n_layers - 2; i >= 0; i--) {
-            #pragma omp parallel for collapse(2)
-            for (int j = 0; j < ann->dim[i + 1]; j++) {
-                for (int k = 0; k < ann->dim[i]; k++) {
-                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
-                }
-            }
-        
-            #pragma omp parallel for
-            for (int j = 0; j < ann->dim[i + 1]; j++) {
-                ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
-            }
-        }
-        
-
-        
-
-    }
-}
-
-
-
-int predict(network* ann, double data[MAX_SIZE]){
-    double output[ann->n_layers][MAX_SIZE];
-    arrayCopy(output[0],data,ann->dim[0]);
-    feed_forward(ann,output);
-    int maxval = 0;
-    if(ann->dim[ann->n_layers-1] == 1){
-        if(output[ann->n_layers-1][0] >= 0.5){
-            return 1;
-        }
-        else{
-            return 0;
-        }
-    }
-    else{
-        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-           
-            if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
-                maxval = i;
-            }
-        }
-        return maxval;
-    }
-}
-
-void test(network* ann,double **data,int length){
-    int correct = 0;
-    int incorrect = 0;
-    for(int t=0;t<length;t++){
-        double output[ann->n_layers][MAX_SIZE];
-        arrayCopy(output[0],data[t],ann->dim[0]);
-        feed_forward(ann,output);
-        int maxval = 0;
-        if(ann->dim[ann->n_layers-1] == 1){
-            printf("Object %lf is classified as %lf\n",data[t][ann->dim[0]],output[ann->n_layers-1][0]);
-            if((output[ann->n_layers-1][0] >= 0.5 && data[t][ann->dim[0]] == 1) || (output[ann->n_layers-1][0] < 0.5 && data[t][ann->dim[0]] == 0)){
-                correct += 1;
-                
-            }
-            else{
-                incorrect += 1;
-            }
-        }
-        else{
-            for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-                if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
-                    maxval = i;
-                }
-            }
-           
-            printf("Object %lf is classified as %d\n",data[t][ann->dim[0]],maxval);
-            if(maxval == data[t][ann->dim[0]]){
-                correct += 1;
-            }
-            else{
-                incorrect += 1;
-            }
-        }
-    }
-    double accuracy = ((double)correct/(double)length)*100;
-    printf("correct: %d, incorrect: %d, accuracy: %lf\n",correct,incorrect,accuracy);
-}
-
-
-
-void feed_forward(network* ann, double output[MAX_SIZE][MAX_SIZE]) {
-    double* input;
-    for (int i = 1; i < ann->n_layers; i++) {
-        input = output[i - 1];
-
-        #pragma omp parallel for
-        for (int j = 0; j < ann->dim[i]; j++) {
-            double f_sum = 0;
-            for (int k = 0; k < ann->dim[i - 1]; k++) {
-                f_sum += ann->weights[i - 1][j][k] * input[k];
-            }
-            f_sum += ann->biases[i][j];
-            output[i][j] = sigmoid(f_sum);
-        }
-    }
-}
-
-
-double sigmoid(double x){
-    return 1/ (1 + exp(-x)); 
-}
-
-
-
-void arrayCopy(double dest[],double source[],int length){
-    for(int i=0;i<length;i++){
-        dest[i] = source[i];
-    }
-}
+#ifndef ANN_OPENMP_H
+#define ANN_OPENMP_H
+
+#include <time.h>
+#define MAX_SIZE  1000
+#define LAYER_SIZE 10
+#include <omp.h>
+#include <stdlib.h>
+#include <math.h> 
+#include <stdio.h>
+#include <string.h>
+#include "ann_eval.h"
+#include "ann_prof.h"
+#include "ann_rng.h"
+#include "ann_sparse.h"
+
+
+
+//Declarations ANN structure
+typedef struct networks{
+    int n_layers;
+    int dim[LAYER_SIZE];
+    double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE];
+    double biases[LAYER_SIZE][MAX_SIZE];
+}network;
+
+
+//Function prototypes
+
+double sigmoid(double x);
+//Random weights drawn from ann_rng.h, so one seed gives the same network
+//for any thread count
+void init_ann(network*,int[] ,int,uint64_t seed);
+void init_ann_with_weights(network*,int[],double [LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE],int);
+void feed_forward(network*,double output[LAYER_SIZE][MAX_SIZE]);
+void compute_deltas(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label);
+void update_weights(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double learning_rate);
+//compute_deltas and update_weights fused: each weight is read once, its old
+//value feeds the lower layer's delta and the new one is stored in place
+void backward_update(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label,double learning_rate);
+void train(network*, double**,int,double);
+int predict(network*,double[MAX_SIZE]);
+//Tallies labelled rows into e across the threads; row t is sample first_id + t
+void evaluate(network*,double**,int,long first_id,ann_eval*);
+//Evaluates the rows and prints a one-block summary
+void test(network*,double**,int);
+
+void arrayCopy(double dest[],double source[],int length);
+
+
+void init_ann(network* ann,int dim[],int n_layers,uint64_t seed){
+    
+    //Intializes ANN with random weights and biases
+    ann->n_layers = n_layers;
+    
+    for(int i=0;i<n_layers;i++){
+        ann->dim[i] = dim[i];
+    }
+    //First touch: each thread zeroes and fills the rows feed_forward will
+    //hand to it, so their pages are allocated on that thread's NUMA node
+    for(int i=1;i<n_layers;i++){
+        double scale = 1/sqrt(dim[i-1]+dim[i]);
+        #pragma omp parallel for schedule(static)
+        for(int j=0;j<dim[i];j++){
+            memset(ann->weights[i-1][j],0,sizeof(ann->weights[i-1][j]));
+            for(int k=0;k<dim[i-1];k++){
+                ann->weights[i-1][j][k] = ann_rng_weight(seed,i,j,k)*scale;
+            }
+        }
+    }
+    for(int i=0;i<n_layers;i++){
+        int val = 1;
+        for(int j=0;j<ann->dim[i];j++){
+            if(i == 0){
+                ann->biases[i][j] = 0;
+            }
+            else{
+                ann->biases[i][j] = val;
+            }
+        }
+        
+    }
+    
+}
+
+void init_ann_with_weights(network* ann,int dim[],double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE],double biases[LAYER_SIZE][MAX_SIZE],int n_layers){
+    
+    ann->n_layers = n_layers;
+    for(int i=0;i<n_layers;i++){
+        ann->dim[i] = dim[i];
+    }
+    for(int i=1;i<n_layers;i++){
+        for(int j=0;j<dim[i];j++){
+            for(int k=0;k<dim[i-1];k++){
+                ann->weights[i-1][j][k] = weights[i-1][j][k];
+            }
+        }
+    }
+    for(int i=0;i<n_layers;i++){
+        for(int j=0;j<ann->dim[i];j++){
+            if(i == 0){
+                ann->biases[i][j] = 0;
+            }
+            else{
+                ann->biases[i][j] = biases[i][j];
+            }
+        }
+    }
+}
+
+
+
+static void output_deltas(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label){
+    //last layer delta computation
+    if(ann->dim[ann->n_layers-1] == 1){
+        double expected_value = label;
+        double observed_value = output[ann->n_layers - 1][0];
+        d[ann->n_layers-1][0] = observed_value*(1-observed_value)*(observed_value - expected_value);
+            
+    }
+    else{
+        // printf("%f\n",data[t][784]);
+        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
+            
+            double expected_value = (i == label)?1:0;
+            double observed_value = output[ann->n_layers - 1][i];
+            d[ann->n_layers-1][i] = observed_value*(1-observed_value)*(observed_value - expected_value);
+            
+        }
+    }
+}
+
+void compute_deltas(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label){
+    output_deltas(ann,output,d,label);
+    // Hidden layers delta computation; the input layer's would never be read
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        #pragma omp parallel for
+        for (int j = 0; j < ann->dim[i]; j++) {
+            double fsum = 0;
+            for (int k = 0; k < ann->dim[i + 1]; k++) {
+                fsum += d[i + 1][k] * ann->weights[i][k][j];
+            }
+            d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
+        }
+    }
+}
+
+void update_weights(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double learning_rate){
+    // The gradient of a weight from a zero pixel is zero
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = ann->n_layers - 2; i >= 0; i--) {
+        if (i == 0 && 2 * n_nz <= ann->dim[0]) {
+            #pragma omp parallel for
+            for (int j = 0; j < ann->dim[1]; j++) {
+                for (int e = 0; e < n_nz; e++) {
+                    ann->weights[0][j][nz[e]] -= learning_rate * output[0][nz[e]] * d[1][j];
+                }
+            }
+        } else {
+            #pragma omp parallel for collapse(2)
+            for (int j = 0; j < ann->dim[i + 1]; j++) {
+                for (int k = 0; k < ann->dim[i]; k++) {
+                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
+                }
+            }
+        }
+    
+        #pragma omp parallel for
+        for (int j = 0; j < ann->dim[i + 1]; j++) {
+            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+        }
+    }
+}
+
+void backward_update(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label,double learning_rate){
+    output_deltas(ann,output,d,label);
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        int rows = ann->dim[i + 1];
+        int cols = ann->dim[i];
+        // Row j of the weights holds the connections into unit j of layer
+        // i + 1; column k's old values sum into the delta of unit k below.
+        // Threads own column ranges, so each delta has a single writer.
+        #pragma omp parallel
+        {
+            int t = omp_get_thread_num();
+            int n_threads = omp_get_num_threads();
+            int k0 = (int)((long)cols * t / n_threads);
+            int k1 = (int)((long)cols * (t + 1) / n_threads);
+            double fsum[MAX_SIZE];
+            memset(fsum + k0, 0, (k1 - k0) * sizeof(double));
+            for (int j = 0; j < rows; j++) {
+                double dj = d[i + 1][j];
+                double* w = ann->weights[i][j];
+                for (int k = k0; k < k1; k++) {
+                    fsum[k] += dj * w[k];
+                    w[k] -= learning_rate * output[i][k] * dj;
+                }
+            }
+            for (int k = k0; k < k1; k++) {
+                d[i][k] = output[i][k] * (1 - output[i][k]) * fsum[k];
+            }
+        }
+        for (int j = 0; j < rows; j++) {
+            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+        }
+    }
+    // The input layer needs no delta, only the update, on its nonzero pixels
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    int sparse_input = (2 * n_nz <= ann->dim[0]);
+    #pragma omp parallel for
+    for (int j = 0; j < ann->dim[1]; j++) {
+        double dj = d[1][j];
+        double* w = ann->weights[0][j];
+        if (sparse_input) {
+            for (int e = 0; e < n_nz; e++) {
+                w[nz[e]] -= learning_rate * output[0][nz[e]] * dj;
+            }
+        } else {
+            for (int k = 0; k < ann->dim[0]; k++) {
+                w[k] -= learning_rate * output[0][k] * dj;
+            }
+        }
+        ann->biases[1][j] -= learning_rate * dj;
+    }
+}
+
+void train(network* ann,double **data,int length,double learning_rate){
+    double forward_flops = ann_flops_forward(ann->dim,ann->n_layers);
+    double backward_flops = ann_flops_backward(ann->dim,ann->n_layers);
+    double update_flops = ann_flops_update(ann->dim,ann->n_layers);
+    
+    for(int t=0;t<length;t++){
+        double output[ann->n_layers][MAX_SIZE];
+        //Set first layer output as input data
+        arrayCopy(output[0],data[t],ann->dim[0]);
+        // feed forward pass to determine values in all nodes.
+        double t0 = ann_prof_begin();
+        feed_forward(ann,output);
+        ann_prof_end(ANN_PHASE_FORWARD,t0,forward_flops);
+
+
+        //Deltas and weight updates in one pass over the weights
+        double d[ann->n_layers][MAX_SIZE];
+        t0 = ann_prof_begin();
+        backward_update(ann,output,d,data[t][ann->dim[0]],learning_rate);
+        ann_prof_end(ANN_PHASE_BACKWARD,t0,backward_flops + update_flops);
+
+    }
+    ann_prof_samples(length);
+}
+
+
+
+int predict(network* ann, double data[MAX_SIZE]){
+    double output[ann->n_layers][MAX_SIZE];
+    arrayCopy(output[0],data,ann->dim[0]);
+    double t0 = ann_prof_begin();
+    feed_forward(ann,output);
+    ann_prof_end(ANN_PHASE_FORWARD,t0,ann_flops_forward(ann->dim,ann->n_layers));
+    ann_prof_samples(1);
+    int maxval = 0;
+    if(ann->dim[ann->n_layers-1] == 1){
+        if(output[ann->n_layers-1][0] >= 0.5){
+            return 1;
+        }
+        else{
+            return 0;
+        }
+    }
+    else{
+        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
+           
+            if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
+                maxval = i;
+            }
+        }
+        return maxval;
+    }
+}
+
+void evaluate(network* ann,double **data,int length,long first_id,ann_eval* e){
+    int n_out = ann->dim[ann->n_layers-1];
+    double t0 = ann_prof_begin();
+    //Each thread tallies its samples privately; feed_forward's own parallel
+    //loops run single-threaded inside this region
+    #pragma omp parallel
+    {
+        ann_eval local;
+        ann_eval_init(&local,n_out,e->track_misclassified);
+        #pragma omp for schedule(static)
+        for(int t=0;t<length;t++){
+            double output[ann->n_layers][MAX_SIZE];
+            arrayCopy(output[0],data[t],ann->dim[0]);
+            feed_forward(ann,output);
+            ann_eval_add(&local,output[ann->n_layers-1],n_out,(int)data[t][ann->dim[0]],first_id + t);
+        }
+        #pragma omp critical
+        ann_eval_merge(e,&local);
+        ann_eval_free(&local);
+    }
+    ann_prof_end(ANN_PHASE_FORWARD,t0,length * ann_flops_forward(ann->dim,ann->n_layers));
+    ann_prof_samples(length);
+}
+
+void test(network* ann,double **data,int length){
+    ann_eval e;
+    ann_eval_init(&e,ann->dim[ann->n_layers-1],0);
+    evaluate(ann,data,length,1,&e);
+    ann_eval_print(&e,"test",stdout);
+    ann_eval_free(&e);
+}
+
+
+
+void feed_forward(network* ann, double output[MAX_SIZE][MAX_SIZE]) {
+    double* input;
+    // Zero pixels add nothing to layer 1, so it only reads the nonzero ones
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = 1; i < ann->n_layers; i++) {
+        input = output[i - 1];
+        int sparse_input = (i == 1 && 2 * n_nz <= ann->dim[0]);
+
+        // static schedule matches the first-touch partitioning in init_ann
+        #pragma omp parallel for schedule(static)
+        for (int j = 0; j < ann->dim[i]; j++) {
+            double f_sum = 0;
+            if (sparse_input) {
+                for (int e = 0; e < n_nz; e++) {
+                    f_sum += ann->weights[0][j][nz[e]] * input[nz[e]];
+                }
+            } else {
+                for (int k = 0; k < ann->dim[i - 1]; k++) {
+                    f_sum += ann->weights[i - 1][j][k] * input[k];
+                }
+            }
+            f_sum += ann->biases[i][j];
+            output[i][j] = sigmoid(f_sum);
+        }
+    }
+}
+
+
+double sigmoid(double x){
+    return 1/ (1 + exp(-x)); 
+}
+
+
+
+void arrayCopy(double dest[],double source[],int length){
+    for(int i=0;i<length;i++){
+        dest[i] = source[i];
+    }
+}
+
+#endif // ANN_OPENMP_H
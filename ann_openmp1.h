@@ -1,296 +1,921 @@
-
-#include <time.h>
-#define MAX_SIZE  1000
-#define LAYER_SIZE 10
-#include <omp.h>
-#include <stdlib.h>
-#include <math.h> 
-#include <stdio.h>
-
-
-
-//Declarations ANN structure
-typedef struct networks {
-    int n_layers;
-    int* dim;          // Dynamic array for layer dimensions
-    double*** weights;  // 3D dynamic array for weights
-    double** biases;    // 2D dynamic array for biases
-} network;
-
-
-//Function prototypes
-
-double sigmoid(double x);
-void init_ann(network*,int[] ,int);
-void init_ann_with_weights(network*,int[],double [LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE],int);
-void feed_forward(network*,double output[LAYER_SIZE][MAX_SIZE]);
-void train(network*, double**,int,double);
-int predict(network*,double[MAX_SIZE]);
-void test(network*,double**,int);
-
-void arrayCopy(double dest[],double source[],int length);
-
-
-void init_ann(network* ann, int dim[], int n_layers) {
-    time_t t;
-    srand((unsigned)time(&t));
-    
-    ann->n_layers = n_layers;
-    ann->dim = (int*)malloc(n_layers * sizeof(int));
-    ann->weights = (double***)malloc((n_layers-1) * sizeof(double**));
-    ann->biases = (double**)malloc(n_layers * sizeof(double*));
-    
-    for(int i=0; i<n_layers; i++) {
-        ann->dim[i] = dim[i];
-        ann->biases[i] = (double*)malloc(dim[i] * sizeof(double));
-        
-        if(i > 0) {
-            ann->weights[i-1] = (double**)malloc(dim[i] * sizeof(double*));
-            for(int j=0; j<dim[i]; j++) {
-                ann->weights[i-1][j] = (double*)malloc(dim[i-1] * sizeof(double));
-                for(int k=0; k<dim[i-1]; k++) {
-                    ann->weights[i-1][j][k] = ((double)rand()/(double)RAND_MAX)*(1/sqrt(dim[i-1]+dim[i]));
-                }
-            }
-        }
-        
-        for(int j=0; j<dim[i]; j++) {
-            ann->biases[i][j] = (i == 0) ? 0 : 1;
-        }
-    }
-}
-
-
-void init_ann_with_weights(network* ann,int dim[],double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE],double biases[LAYER_SIZE][MAX_SIZE],int n_layers){
-    
-    ann->n_layers = n_layers;
-    for(int i=0;i<n_layers;i++){
-        ann->dim[i] = dim[i];
-    }
-    for(int i=1;i<n_layers;i++){
-        for(int j=0;j<dim[i];j++){
-            for(int k=0;k<dim[i-1];k++){
-                ann->weights[i-1][j][k] = weights[i-1][j][k];
-            }
-        }
-    }
-    for(int i=0;i<n_layers;i++){
-        for(int j=0;j<ann->dim[i];j++){
-            if(i == 0){
-                ann->biases[i][j] = 0;
-            }
-            else{
-                ann->biases[i][j] = biases[i][j];
-            }
-        }
-    }
-}
-
-
-
-void train(network* ann,double **data,int length,double learning_rate){
-    
-    for(int t=0;t<length;t++){
-        double output[ann->n_layers][MAX_SIZE];
-        //Set first layer output as input data
-        arrayCopy(output[0],data[t],ann->dim[0]);
-        // feed forward pass to determine values in all nodes.
-        feed_forward(ann,output);
-        
-
-        //delta values
-        double d[ann->n_layers][MAX_SIZE];
-        
-        //last layer delta computation
-        if(ann->dim[ann->n_layers-1] == 1){
-            double expected_value = data[t][ann->dim[0]];
-            double observed_value = output[ann->n_layers - 1][0];
-            d[ann->n_layers-1][0] = observed_value*(1-observed_value)*(observed_value - expected_value);
-                
-        }
-        else{
-            // printf("%f\n",data[t][784]);
-            for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-                
-                double expected_value = (i == data[t][ann->dim[0]])?1:0;
-                double observed_value = output[ann->n_layers - 1][i];
-                d[ann->n_layers-1][i] = observed_value*(1-observed_value)*(observed_value - expected_value);
-                
-            }
-        }
-// Hidden layers delta computation - OPTIMIZED VERSION
-for (int i = ann->n_layers - 2; i >= 0; i--) {
-    int dim_i = ann->dim[i];
-    int dim_i_plus_1 = ann->dim[i+1];
-    
-    if (dim_i * dim_i_plus_1 > 1000) {  // Only parallelize if substantial work
-        #pragma omp parallel for
-        for (int j = 0; j < dim_i; j++) {
-            double fsum = 0;
-            for (int k = 0; k < dim_i_plus_1; k++) {
-                fsum += d[i + 1][k] * ann->weights[i][k][j];
-            }
-            d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
-        }
-    } else {  // Sequential version for small workloads
-        for (int j = 0; j < dim_i; j++) {
-            double fsum = 0;
-            for (int k = 0; k < dim_i_plus_1; k++) {
-                fsum += d[i + 1][k] * ann->weights[i][k][j];
-            }
-            d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
-        }
-    }
-}
-
-
-        //Updating weigths and biases
-
-        // Modify the weight update in train function
-for (int i = ann->n_layers - 2; i >= 0; i--) {
-    int dim_i = ann->dim[i];
-    int dim_i_plus_1 = ann->dim[i+1];
-    
-    if (dim_i * dim_i_plus_1 > 1000) {
-        #pragma omp parallel for collapse(2)
-        for (int j = 0; j < dim_i_plus_1; j++) {
-            for (int k = 0; k < dim_i; k++) {
-                ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
-            }
-        }
-    } else {
-        for (int j = 0; j < dim_i_plus_1; j++) {
-            for (int k = 0; k < dim_i; k++) {
-                ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
-            }
-        }
-    }
-    
-    if (dim_i_plus_1 > 1000) {
-        #pragma omp parallel for
-        for (int j = 0; j < dim_i_plus_1; j++) {
-            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
-        }
-    } else {
-        for (int j = 0; j < dim_i_plus_1; j++) {
-            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
-        }
-    }
-}
-
-        
-
-        
-
-    }
-}
-
-
-
-int predict(network* ann, double data[MAX_SIZE]){
-    double output[ann->n_layers][MAX_SIZE];
-    arrayCopy(output[0],data,ann->dim[0]);
-    feed_forward(ann,output);
-    int maxval = 0;
-    if(ann->dim[ann->n_layers-1] == 1){
-        if(output[ann->n_layers-1][0] >= 0.5){
-            return 1;
-        }
-        else{
-            return 0;
-        }
-    }
-    else{
-        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-           
-            if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
-                maxval = i;
-            }
-        }
-        return maxval;
-    }
-}
-
-void test(network* ann,double **data,int length){
-    int correct = 0;
-    int incorrect = 0;
-    for(int t=0;t<length;t++){
-        double output[ann->n_layers][MAX_SIZE];
-        arrayCopy(output[0],data[t],ann->dim[0]);
-        feed_forward(ann,output);
-        int maxval = 0;
-        if(ann->dim[ann->n_layers-1] == 1){
-            printf("Object %lf is classified as %lf\n",data[t][ann->dim[0]],output[ann->n_layers-1][0]);
-            if((output[ann->n_layers-1][0] >= 0.5 && data[t][ann->dim[0]] == 1) || (output[ann->n_layers-1][0] < 0.5 && data[t][ann->dim[0]] == 0)){
-                correct += 1;
-                
-            }
-            else{
-                incorrect += 1;
-            }
-        }
-        else{
-            for(int i=0;i<ann->dim[ann->n_layers-1];i++){
-                if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
-                    maxval = i;
-                }
-            }
-           
-            printf("Object %lf is classified as %d\n",data[t][ann->dim[0]],maxval);
-            if(maxval == data[t][ann->dim[0]]){
-                correct += 1;
-            }
-            else{
-                incorrect += 1;
-            }
-        }
-    }
-    double accuracy = ((double)correct/(double)length)*100;
-    printf("correct: %d, incorrect: %d, accuracy: %lf\n",correct,incorrect,accuracy);
-}
-
-
-
-// Modify the feed_forward function
-void feed_forward(network* ann, double output[MAX_SIZE][MAX_SIZE]) {
-    double* input;
-    for (int i = 1; i < ann->n_layers; i++) {
-        input = output[i - 1];
-        int dim_i = ann->dim[i];
-        int dim_i_minus_1 = ann->dim[i-1];
-        
-        // Only parallelize if the work is substantial
-        if (dim_i * dim_i_minus_1 > 1000) {
-            #pragma omp parallel for
-            for (int j = 0; j < dim_i; j++) {
-                double f_sum = ann->biases[i][j];
-                for (int k = 0; k < dim_i_minus_1; k++) {
-                    f_sum += ann->weights[i - 1][j][k] * input[k];
-                }
-                output[i][j] = sigmoid(f_sum);
-            }
-        } else {
-            for (int j = 0; j < dim_i; j++) {
-                double f_sum = ann->biases[i][j];
-                for (int k = 0; k < dim_i_minus_1; k++) {
-                    f_sum += ann->weights[i - 1][j][k] * input[k];
-                }
-                output[i][j] = sigmoid(f_sum);
-            }
-        }
-    }
-}
-
-
-
-double sigmoid(double x){
-    return 1/ (1 + exp(-x)); 
-}
-
-
-
-void arrayCopy(double dest[],double source[],int length){
-    for(int i=0;i<length;i++){
-        dest[i] = source[i];
-    }
-}
+#ifndef ANN_OPENMP1_H
+#define ANN_OPENMP1_H
+
+#include <errno.h>
+#include <time.h>
+#define MAX_SIZE  1000
+#define LAYER_SIZE 10
+#include <omp.h>
+#include <stdlib.h>
+#include <math.h> 
+#include <stdio.h>
+#include <string.h>
+#include "ann_prof.h"
+#include "alloc.h"
+#include "ann_numa.h"
+#include "ann_eval.h"
+#include "ann_infer.h"
+#include "ann_model.h"
+#include "ann_rng.h"
+#include "ann_sparse.h"
+#include "ann_tune.h"
+
+
+
+//Declarations ANN structure
+typedef struct networks {
+    int n_layers;
+    int* dim;          // Dynamic array for layer dimensions
+    double*** weights;  // 3D dynamic array for weights
+    double** biases;    // 2D dynamic array for biases
+    ann_sparse** sparse; // per weight layer for inference, NULL while dense
+} network;
+
+
+//Function prototypes
+
+double sigmoid(double x);
+//Random weights drawn from ann_rng.h, so one seed gives the same network
+//for any thread count
+void init_ann(network*,int[] ,int,uint64_t seed);
+void init_ann_with_weights(network*,int[],double [LAYER_SIZE][MAX_SIZE][MAX_SIZE], double[LAYER_SIZE][MAX_SIZE],int);
+void feed_forward(network*,double output[LAYER_SIZE][MAX_SIZE]);
+void compute_deltas(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label);
+void update_weights(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double learning_rate);
+//compute_deltas and update_weights fused: each weight is read once, its old
+//value feeds the lower layer's delta and the new one is stored in place
+void backward_update(network*,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label,double learning_rate);
+void train(network*, double**,int,double);
+int predict(network*,double[MAX_SIZE]);
+//Classifies n samples at once, one layer at a time across the whole batch
+void predict_batch(network*,double**,int,int*);
+//Tallies labelled rows into e, batched like predict_batch and reduced across
+//threads; row t is sample first_id + t
+void evaluate(network*,double**,int,long first_id,ann_eval*);
+//Evaluates the rows and prints a one-block summary
+void test(network*,double**,int);
+//Packs the weights for single-sample ann_infer_predict, which classifies
+//like predict without OpenMP or per-call allocation; the packed copy does
+//not follow later weight updates. Returns 0 on success.
+int init_infer(ann_infer*,network*);
+//Times the ann_tune.h candidates for a network of the given widths on
+//labelled rows and stores the fastest settings in t and in ann_tune. With
+//OMP_NUM_THREADS set, no more threads are tried and the count is left as set.
+void autotune(ann_tuning* t,int dim[],int n_layers,double** rows,int n_rows,uint64_t seed);
+
+void arrayCopy(double dest[],double source[],int length);
+network* copy_ann(network*);
+void free_ann(network*);
+//Writes or reads the variant-neutral model file of ann_model.h; save_ann
+//returns 0 on success, load_ann returns NULL on failure or for a model wider
+//than MAX_SIZE or deeper than LAYER_SIZE
+int save_ann(network*,const char*);
+network* load_ann(const char*);
+
+//Magnitude pruning of every weight layer but the output layer. block > 1
+//removes whole block x block tiles. Returns one keep mask per weight layer
+//(NULL where nothing was pruned) for apply_prune_mask during fine-tuning.
+unsigned char** prune_ann(network*,double sparsity,int block);
+void apply_prune_mask(network*,unsigned char**);
+void free_prune_mask(network*,unsigned char**);
+//Builds CSR (block 1) or BSR copies of the layers that are at most half
+//dense; feed_forward and predict_batch then skip the pruned weights. Call
+//after the last weight update, since training only updates the dense copy.
+void sparsify_ann(network*,int block);
+
+//Per-socket copies of a trained network for read-only inference
+typedef struct replica_set {
+    int n;                // number of copies, one per socket with a place
+    int n_places;
+    int* place_replica;   // OpenMP place -> index into nets
+    network** nets;
+    int shared;           // nets[0] is the caller's network, not a copy
+} replica_set;
+
+void init_replicas(replica_set*, network*);
+network* local_replica(replica_set*);
+void free_replicas(replica_set*);
+
+
+void init_ann(network* ann, int dim[], int n_layers, uint64_t seed) {
+    ann->n_layers = n_layers;
+    ann->dim = (int*)malloc(n_layers * sizeof(int));
+    ann->weights = (double***)malloc((n_layers-1) * sizeof(double**));
+    ann->biases = (double**)malloc(n_layers * sizeof(double*));
+    ann->sparse = NULL;
+    
+    for(int i=0; i<n_layers; i++) {
+        ann->dim[i] = dim[i];
+        ann->biases[i] = (double*)malloc(dim[i] * sizeof(double));
+        
+        if(i > 0) {
+            ann->weights[i-1] = init_2Darray(dim[i], dim[i-1]);
+            double scale = 1/sqrt(dim[i-1]+dim[i]);
+            //First touch: each thread fills the rows feed_forward will hand
+            //to it, so their pages are allocated on that thread's NUMA node
+            #pragma omp parallel for schedule(static)
+            for(int j=0; j<dim[i]; j++) {
+                for(int k=0; k<dim[i-1]; k++) {
+                    ann->weights[i-1][j][k] = ann_rng_weight(seed, i, j, k) * scale;
+                }
+            }
+        }
+        
+        for(int j=0; j<dim[i]; j++) {
+            ann->biases[i][j] = (i == 0) ? 0 : 1;
+        }
+    }
+}
+
+
+void init_ann_with_weights(network* ann,int dim[],double weights[LAYER_SIZE][MAX_SIZE][MAX_SIZE],double biases[LAYER_SIZE][MAX_SIZE],int n_layers){
+    
+    ann->n_layers = n_layers;
+    for(int i=0;i<n_layers;i++){
+        ann->dim[i] = dim[i];
+    }
+    for(int i=1;i<n_layers;i++){
+        for(int j=0;j<dim[i];j++){
+            for(int k=0;k<dim[i-1];k++){
+                ann->weights[i-1][j][k] = weights[i-1][j][k];
+            }
+        }
+    }
+    for(int i=0;i<n_layers;i++){
+        for(int j=0;j<ann->dim[i];j++){
+            if(i == 0){
+                ann->biases[i][j] = 0;
+            }
+            else{
+                ann->biases[i][j] = biases[i][j];
+            }
+        }
+    }
+}
+
+
+
+static void output_deltas(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label){
+    //last layer delta computation
+    if(ann->dim[ann->n_layers-1] == 1){
+        double expected_value = label;
+        double observed_value = output[ann->n_layers - 1][0];
+        d[ann->n_layers-1][0] = observed_value*(1-observed_value)*(observed_value - expected_value);
+            
+    }
+    else{
+        // printf("%f\n",data[t][784]);
+        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
+            
+            double expected_value = (i == label)?1:0;
+            double observed_value = output[ann->n_layers - 1][i];
+            d[ann->n_layers-1][i] = observed_value*(1-observed_value)*(observed_value - expected_value);
+            
+        }
+    }
+}
+
+void compute_deltas(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label){
+    output_deltas(ann,output,d,label);
+    // Hidden layers delta computation - OPTIMIZED VERSION; the input layer's
+    // would never be read
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        int dim_i = ann->dim[i];
+        int dim_i_plus_1 = ann->dim[i+1];
+
+        if (dim_i * dim_i_plus_1 > ann_tune.par_threshold) {  // Only parallelize if substantial work
+            #pragma omp parallel for
+            for (int j = 0; j < dim_i; j++) {
+                double fsum = 0;
+                for (int k = 0; k < dim_i_plus_1; k++) {
+                    fsum += d[i + 1][k] * ann->weights[i][k][j];
+                }
+                d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
+            }
+        } else {  // Sequential version for small workloads
+            for (int j = 0; j < dim_i; j++) {
+                double fsum = 0;
+                for (int k = 0; k < dim_i_plus_1; k++) {
+                    fsum += d[i + 1][k] * ann->weights[i][k][j];
+                }
+                d[i][j] = output[i][j] * (1 - output[i][j]) * fsum;
+            }
+        }
+    }
+}
+
+void update_weights(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double learning_rate){
+    // The gradient of a weight from a zero pixel is zero
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = ann->n_layers - 2; i >= 0; i--) {
+        int dim_i = ann->dim[i];
+        int dim_i_plus_1 = ann->dim[i+1];
+
+        if (i == 0 && 2 * n_nz <= dim_i) {
+            #pragma omp parallel for if(dim_i_plus_1 * n_nz > ann_tune.par_threshold)
+            for (int j = 0; j < dim_i_plus_1; j++) {
+                for (int e = 0; e < n_nz; e++) {
+                    ann->weights[0][j][nz[e]] -= learning_rate * output[0][nz[e]] * d[1][j];
+                }
+            }
+        } else if (dim_i * dim_i_plus_1 > ann_tune.par_threshold) {
+            #pragma omp parallel for collapse(2)
+            for (int j = 0; j < dim_i_plus_1; j++) {
+                for (int k = 0; k < dim_i; k++) {
+                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
+                }
+            }
+        } else {
+            for (int j = 0; j < dim_i_plus_1; j++) {
+                for (int k = 0; k < dim_i; k++) {
+                    ann->weights[i][j][k] -= learning_rate * output[i][k] * d[i + 1][j];
+                }
+            }
+        }
+
+        if (dim_i_plus_1 > ann_tune.par_threshold) {
+            #pragma omp parallel for
+            for (int j = 0; j < dim_i_plus_1; j++) {
+                ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+            }
+        } else {
+            for (int j = 0; j < dim_i_plus_1; j++) {
+                ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+            }
+        }
+    }
+}
+
+void backward_update(network* ann,double output[LAYER_SIZE][MAX_SIZE],double d[LAYER_SIZE][MAX_SIZE],double label,double learning_rate){
+    output_deltas(ann,output,d,label);
+    for (int i = ann->n_layers - 2; i >= 1; i--) {
+        int rows = ann->dim[i + 1];
+        int cols = ann->dim[i];
+        // Row j of the weights holds the connections into unit j of layer
+        // i + 1; column k's old values sum into the delta of unit k below.
+        // Threads own column ranges, so each delta has a single writer.
+        #pragma omp parallel if(rows * cols > ann_tune.par_threshold)
+        {
+            int t = omp_get_thread_num();
+            int n_threads = omp_get_num_threads();
+            int k0 = (int)((long)cols * t / n_threads);
+            int k1 = (int)((long)cols * (t + 1) / n_threads);
+            double fsum[MAX_SIZE];
+            memset(fsum + k0, 0, (k1 - k0) * sizeof(double));
+            for (int j = 0; j < rows; j++) {
+                double dj = d[i + 1][j];
+                double* w = ann->weights[i][j];
+                for (int k = k0; k < k1; k++) {
+                    fsum[k] += dj * w[k];
+                    w[k] -= learning_rate * output[i][k] * dj;
+                }
+            }
+            for (int k = k0; k < k1; k++) {
+                d[i][k] = output[i][k] * (1 - output[i][k]) * fsum[k];
+            }
+        }
+        for (int j = 0; j < rows; j++) {
+            ann->biases[i + 1][j] -= learning_rate * d[i + 1][j];
+        }
+    }
+    // The input layer needs no delta, only the update, on its nonzero pixels
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    int sparse_input = (2 * n_nz <= ann->dim[0]);
+    #pragma omp parallel for if(ann->dim[1] * (sparse_input ? n_nz : ann->dim[0]) > ann_tune.par_threshold)
+    for (int j = 0; j < ann->dim[1]; j++) {
+        double dj = d[1][j];
+        double* w = ann->weights[0][j];
+        if (sparse_input) {
+            for (int e = 0; e < n_nz; e++) {
+                w[nz[e]] -= learning_rate * output[0][nz[e]] * dj;
+            }
+        } else {
+            for (int k = 0; k < ann->dim[0]; k++) {
+                w[k] -= learning_rate * output[0][k] * dj;
+            }
+        }
+        ann->biases[1][j] -= learning_rate * dj;
+    }
+}
+
+void train(network* ann,double **data,int length,double learning_rate){
+    double forward_flops = ann_flops_forward(ann->dim,ann->n_layers);
+    double backward_flops = ann_flops_backward(ann->dim,ann->n_layers);
+    double update_flops = ann_flops_update(ann->dim,ann->n_layers);
+    
+    for(int t=0;t<length;t++){
+        double output[ann->n_layers][MAX_SIZE];
+        //Set first layer output as input data
+        arrayCopy(output[0],data[t],ann->dim[0]);
+        // feed forward pass to determine values in all nodes.
+        double t0 = ann_prof_begin();
+        feed_forward(ann,output);
+        ann_prof_end(ANN_PHASE_FORWARD,t0,forward_flops);
+
+
+        //Deltas and weight updates in one pass over the weights
+        double d[ann->n_layers][MAX_SIZE];
+        t0 = ann_prof_begin();
+        backward_update(ann,output,d,data[t][ann->dim[0]],learning_rate);
+        ann_prof_end(ANN_PHASE_BACKWARD,t0,backward_flops + update_flops);
+
+    }
+    ann_prof_samples(length);
+}
+
+
+
+//Forward-pass flops per sample, counting only the stored weights of sparse layers
+static double network_forward_flops(network* ann){
+    double flops = 0;
+    for(int i=1; i<ann->n_layers; i++) {
+        double macs = (ann->sparse && ann->sparse[i-1]) ? ann->sparse[i-1]->nnz : (double)ann->dim[i] * ann->dim[i-1];
+        flops += 2.0 * macs + ann->dim[i];
+    }
+    return flops;
+}
+
+int predict(network* ann, double data[MAX_SIZE]){
+    double output[ann->n_layers][MAX_SIZE];
+    arrayCopy(output[0],data,ann->dim[0]);
+    double t0 = ann_prof_begin();
+    feed_forward(ann,output);
+    ann_prof_end(ANN_PHASE_FORWARD,t0,network_forward_flops(ann));
+    ann_prof_samples(1);
+    int maxval = 0;
+    if(ann->dim[ann->n_layers-1] == 1){
+        if(output[ann->n_layers-1][0] >= 0.5){
+            return 1;
+        }
+        else{
+            return 0;
+        }
+    }
+    else{
+        for(int i=0;i<ann->dim[ann->n_layers-1];i++){
+           
+            if(output[ann->n_layers-1][i] > output[ann->n_layers - 1][maxval]){
+                maxval = i;
+            }
+        }
+        return maxval;
+    }
+}
+
+//Output layer of n samples, n x dim[n_layers-1] and sample-major, in one of
+//the two activation buffers it allocates in act; the caller frees both
+static const double* forward_batch(network* ann, double** data, int n, double* act[2]){
+    int max_dim = 0;
+    for(int i=1; i<ann->n_layers; i++) {
+        max_dim = ann->dim[i] > max_dim ? ann->dim[i] : max_dim;
+    }
+    // Activations of the whole batch, sample-major; layers alternate buffers
+    act[0] = (double*)malloc((size_t)n * max_dim * sizeof(double));
+    act[1] = (double*)malloc((size_t)n * max_dim * sizeof(double));
+
+    double t0 = ann_prof_begin();
+    for(int i=1; i<ann->n_layers; i++) {
+        int rows = ann->dim[i];
+        int cols = ann->dim[i-1];
+        double* in = act[(i-1) & 1];
+        double* out = act[i & 1];
+        if(ann->sparse != NULL && ann->sparse[i-1] != NULL) {
+            const ann_sparse* sp = ann->sparse[i-1];
+            const double** x = (const double**)malloc(n * sizeof(double*));
+            for(int s=0; s<n; s++) {
+                x[s] = (i == 1) ? data[s] : in + (size_t)s * cols;
+            }
+            int tile = ann_tune.sparse_tile;
+            #pragma omp parallel for schedule(static) if(n > tile && sp->nnz > ann_tune.par_threshold)
+            for(int s0=0; s0<n; s0+=tile) {
+                int m = n - s0 < tile ? n - s0 : tile;
+                ann_sparse_gemm(sp, x + s0, m, out + (size_t)s0 * rows, rows);
+                for(int s=s0; s<s0+m; s++) {
+                    for(int j=0; j<rows; j++) {
+                        out[(size_t)s * rows + j] = sigmoid(out[(size_t)s * rows + j] + ann->biases[i][j]);
+                    }
+                }
+            }
+            free(x);
+            continue;
+        }
+        // Layer 1 only reads each sample's nonzero pixels
+        int* nz = NULL;
+        int* n_nz = NULL;
+        if(i == 1) {
+            nz = (int*)malloc((size_t)n * cols * sizeof(int));
+            n_nz = (int*)malloc(n * sizeof(int));
+            for(int s=0; s<n; s++) {
+                n_nz[s] = ann_nonzero_index(data[s], cols, nz + (size_t)s * cols);
+            }
+        }
+        // Each weight row stays in cache while it is applied to every sample
+        #pragma omp parallel for schedule(static) if(rows * cols > ann_tune.par_threshold)
+        for(int j=0; j<rows; j++) {
+            const double* w = ann->weights[i-1][j];
+            for(int s=0; s<n; s++) {
+                const double* x = (i == 1) ? data[s] : in + (size_t)s * cols;
+                double f_sum = ann->biases[i][j];
+                if(i == 1 && 2 * n_nz[s] <= cols) {
+                    const int* idx = nz + (size_t)s * cols;
+                    for(int e=0; e<n_nz[s]; e++) {
+                        f_sum += w[idx[e]] * x[idx[e]];
+                    }
+                }
+                else {
+                    for(int k=0; k<cols; k++) {
+                        f_sum += w[k] * x[k];
+                    }
+                }
+                out[(size_t)s * rows + j] = sigmoid(f_sum);
+            }
+        }
+        free(nz);
+        free(n_nz);
+    }
+    ann_prof_end(ANN_PHASE_FORWARD,t0,n * network_forward_flops(ann));
+    ann_prof_samples(n);
+    return act[(ann->n_layers-1) & 1];
+}
+
+void predict_batch(network* ann, double** data, int n, int* labels){
+    double* act[2];
+    const double* result = forward_batch(ann, data, n, act);
+    int n_out = ann->dim[ann->n_layers-1];
+    for(int s=0; s<n; s++) {
+        const double* o = result + (size_t)s * n_out;
+        int maxval = 0;
+        if(n_out == 1) {
+            maxval = o[0] >= 0.5;
+        }
+        else {
+            for(int i=1; i<n_out; i++) {
+                if(o[i] > o[maxval]) {
+                    maxval = i;
+                }
+            }
+        }
+        labels[s] = maxval;
+    }
+    free(act[0]);
+    free(act[1]);
+}
+
+void evaluate(network* ann,double **data,int length,long first_id,ann_eval* e){
+    // Batches bound the activation buffers; within one, forward_batch spreads
+    // the weight rows over the threads and the tally spreads the samples
+    const int batch = ann_tune.eval_batch;
+    int n_out = ann->dim[ann->n_layers-1];
+    for(int b=0; b<length; b+=batch) {
+        int n = length - b < batch ? length - b : batch;
+        double* act[2];
+        const double* result = forward_batch(ann, data + b, n, act);
+        #pragma omp parallel if(n * n_out > ann_tune.par_threshold)
+        {
+            ann_eval local;
+            ann_eval_init(&local, n_out, e->track_misclassified);
+            #pragma omp for schedule(static)
+            for(int s=0; s<n; s++) {
+                ann_eval_add(&local, result + (size_t)s * n_out, n_out, (int)data[b + s][ann->dim[0]], first_id + b + s);
+            }
+            #pragma omp critical
+            ann_eval_merge(e, &local);
+            ann_eval_free(&local);
+        }
+        free(act[0]);
+        free(act[1]);
+    }
+}
+
+void test(network* ann,double **data,int length){
+    ann_eval e;
+    ann_eval_init(&e,ann->dim[ann->n_layers-1],0);
+    evaluate(ann,data,length,1,&e);
+    ann_eval_print(&e,"test",stdout);
+    ann_eval_free(&e);
+}
+
+int init_infer(ann_infer* inf, network* ann){
+    const double* weights[ann->n_layers];
+    const double* biases[ann->n_layers];
+    for(int i=1; i<ann->n_layers; i++) {
+        weights[i-1] = ann->weights[i-1][0];
+        biases[i-1] = ann->biases[i];
+    }
+    return ann_infer_init(inf, ann->n_layers, ann->dim, weights, biases);
+}
+
+
+
+//Seconds to train a fresh network on the rows, best of a few runs
+static double tune_time_train(int dim[], int n_layers, double** rows, int n_rows, uint64_t seed){
+    double best = 1e30;
+    for(int rep=0; rep<3; rep++) {
+        network* net = (network*)malloc(sizeof(network));
+        init_ann(net, dim, n_layers, seed);
+        double t0 = ann_wall_time();
+        train(net, rows, n_rows, 0.1);
+        double elapsed = ann_wall_time() - t0;
+        best = elapsed < best ? elapsed : best;
+        free_ann(net);
+    }
+    return best;
+}
+
+//Seconds to evaluate the rows, best of a few runs
+static double tune_time_eval(network* net, double** rows, int n_rows){
+    double best = 1e30;
+    for(int rep=0; rep<3; rep++) {
+        ann_eval e;
+        ann_eval_init(&e, net->dim[net->n_layers-1], 0);
+        double t0 = ann_wall_time();
+        evaluate(net, rows, n_rows, 1, &e);
+        double elapsed = ann_wall_time() - t0;
+        best = elapsed < best ? elapsed : best;
+        ann_eval_free(&e);
+    }
+    return best;
+}
+
+void autotune(ann_tuning* t, int dim[], int n_layers, double** rows, int n_rows, uint64_t seed){
+    // One setting at a time, each against the best of those before it. The
+    // thread count and threshold are scored on training plus evaluation,
+    // the two kernels every driver on this header runs.
+    int n_train = n_rows < 500 ? n_rows : 500;
+    int n_eval = n_rows < 4096 ? n_rows : 4096;
+    // OMP_NUM_THREADS caps the candidates and keeps its count for the run;
+    // the profile still records the fastest count tried
+    int fixed = getenv("OMP_NUM_THREADS") != NULL;
+    int run_threads = omp_get_max_threads();
+    int procs = fixed ? run_threads : omp_get_num_procs();
+    ann_tune_defaults(&ann_tune);
+
+    network* net = (network*)malloc(sizeof(network));
+    init_ann(net, dim, n_layers, seed);
+    int best_threads = 1;
+    double best = 1e30;
+    for(int n=1; ; n = (2 * n < procs) ? 2 * n : procs) {
+        omp_set_num_threads(n);
+        double s = tune_time_train(dim, n_layers, rows, n_train, seed) + tune_time_eval(net, rows, n_eval);
+        printf("  threads %-8d %8.1f ms\n", n, 1e3 * s);
+        if(s < best) {
+            best = s;
+            best_threads = n;
+        }
+        if(n == procs) {
+            break;
+        }
+    }
+    omp_set_num_threads(fixed ? run_threads : best_threads);
+    ann_tune.threads = best_threads;
+
+    const int thresholds[] = { 0, 250, 1000, 4000, 16000, 64000, 1 << 30 };
+    best = 1e30;
+    int best_threshold = ann_tune.par_threshold;
+    for(int c=0; c<(int)(sizeof(thresholds)/sizeof(thresholds[0])); c++) {
+        ann_tune.par_threshold = thresholds[c];
+        double s = tune_time_train(dim, n_layers, rows, n_train, seed) + tune_time_eval(net, rows, n_eval);
+        printf("  threshold %-6d %8.1f ms\n", thresholds[c], 1e3 * s);
+        if(s < best) {
+            best = s;
+            best_threshold = thresholds[c];
+        }
+    }
+    ann_tune.par_threshold = best_threshold;
+
+    const int batches[] = { 32, 64, 128, 256, 512, 1024 };
+    best = 1e30;
+    int best_batch = ann_tune.eval_batch;
+    for(int c=0; c<(int)(sizeof(batches)/sizeof(batches[0])); c++) {
+        ann_tune.eval_batch = batches[c];
+        double s = tune_time_eval(net, rows, n_eval);
+        printf("  eval batch %-5d %8.1f ms\n", batches[c], 1e3 * s);
+        if(s < best) {
+            best = s;
+            best_batch = batches[c];
+        }
+    }
+    ann_tune.eval_batch = best_batch;
+
+    // The sparse tile only matters for pruned networks, so time a pruned copy
+    free_prune_mask(net, prune_ann(net, 0.9, 1));
+    sparsify_ann(net, 1);
+    const int tiles[] = { 4, 8, 16, 32, 64 };
+    best = 1e30;
+    int best_tile = ann_tune.sparse_tile;
+    for(int c=0; c<(int)(sizeof(tiles)/sizeof(tiles[0])); c++) {
+        ann_tune.sparse_tile = tiles[c];
+        double s = tune_time_eval(net, rows, n_eval);
+        printf("  sparse tile %-4d %8.1f ms\n", tiles[c], 1e3 * s);
+        if(s < best) {
+            best = s;
+            best_tile = tiles[c];
+        }
+    }
+    ann_tune.sparse_tile = best_tile;
+    free_ann(net);
+    *t = ann_tune;
+}
+
+// Modify the feed_forward function
+void feed_forward(network* ann, double output[MAX_SIZE][MAX_SIZE]) {
+    double* input;
+    // Zero pixels add nothing to layer 1, so it only reads the nonzero ones
+    int nz[MAX_SIZE];
+    int n_nz = ann_nonzero_index(output[0], ann->dim[0], nz);
+    for (int i = 1; i < ann->n_layers; i++) {
+        input = output[i - 1];
+        int dim_i = ann->dim[i];
+        int dim_i_minus_1 = ann->dim[i-1];
+        
+        if (ann->sparse != NULL && ann->sparse[i - 1] != NULL) {
+            ann_sparse_gemv(ann->sparse[i - 1], input, output[i]);
+            for (int j = 0; j < dim_i; j++) {
+                output[i][j] = sigmoid(output[i][j] + ann->biases[i][j]);
+            }
+        } else if (i == 1 && 2 * n_nz <= dim_i_minus_1) {
+            #pragma omp parallel for schedule(static) if(dim_i * n_nz > ann_tune.par_threshold)
+            for (int j = 0; j < dim_i; j++) {
+                double f_sum = ann->biases[1][j];
+                for (int e = 0; e < n_nz; e++) {
+                    f_sum += ann->weights[0][j][nz[e]] * input[nz[e]];
+                }
+                output[1][j] = sigmoid(f_sum);
+            }
+        } else if (dim_i * dim_i_minus_1 > ann_tune.par_threshold) {
+            // Only parallelize if the work is substantial
+            // static schedule matches the first-touch partitioning in init_ann
+            #pragma omp parallel for schedule(static)
+            for (int j = 0; j < dim_i; j++) {
+                double f_sum = ann->biases[i][j];
+                for (int k = 0; k < dim_i_minus_1; k++) {
+                    f_sum += ann->weights[i - 1][j][k] * input[k];
+                }
+                output[i][j] = sigmoid(f_sum);
+            }
+        } else {
+            for (int j = 0; j < dim_i; j++) {
+                double f_sum = ann->biases[i][j];
+                for (int k = 0; k < dim_i_minus_1; k++) {
+                    f_sum += ann->weights[i - 1][j][k] * input[k];
+                }
+                output[i][j] = sigmoid(f_sum);
+            }
+        }
+    }
+}
+
+
+
+double sigmoid(double x){
+    return 1/ (1 + exp(-x)); 
+}
+
+
+
+void arrayCopy(double dest[],double source[],int length){
+    for(int i=0;i<length;i++){
+        dest[i] = source[i];
+    }
+}
+
+
+
+//Deep copy; the calling thread touches every page, so the copy lives on its NUMA node
+network* copy_ann(network* src){
+    network* ann = (network*)malloc(sizeof(network));
+    int n_layers = src->n_layers;
+    ann->n_layers = n_layers;
+    ann->dim = (int*)malloc(n_layers * sizeof(int));
+    ann->weights = (double***)malloc((n_layers-1) * sizeof(double**));
+    ann->biases = (double**)malloc(n_layers * sizeof(double*));
+    for(int i=0; i<n_layers; i++) {
+        ann->dim[i] = src->dim[i];
+        ann->biases[i] = (double*)malloc(src->dim[i] * sizeof(double));
+        memcpy(ann->biases[i], src->biases[i], src->dim[i] * sizeof(double));
+        if(i > 0) {
+            ann->weights[i-1] = init_2Darray(src->dim[i], src->dim[i-1]);
+            memcpy(ann->weights[i-1][0], src->weights[i-1][0], (size_t)src->dim[i] * src->dim[i-1] * sizeof(double));
+        }
+    }
+    ann->sparse = NULL;
+    if(src->sparse != NULL) {
+        ann->sparse = (ann_sparse**)calloc(n_layers-1, sizeof(ann_sparse*));
+        for(int i=0; i<n_layers-1; i++) {
+            ann->sparse[i] = src->sparse[i] ? ann_sparse_copy(src->sparse[i]) : NULL;
+        }
+    }
+    return ann;
+}
+
+void free_ann(network* ann){
+    if(ann->sparse != NULL) {
+        for(int i=0; i<ann->n_layers-1; i++) {
+            if(ann->sparse[i] != NULL) {
+                ann_sparse_free(ann->sparse[i]);
+            }
+        }
+        free(ann->sparse);
+    }
+    for(int i=0; i<ann->n_layers; i++) {
+        free(ann->biases[i]);
+        if(i > 0) {
+            free_2Darray(ann->weights[i-1]);
+        }
+    }
+    free(ann->biases);
+    free(ann->weights);
+    free(ann->dim);
+    free(ann);
+}
+
+int save_ann(network* ann, const char* path){
+    double* params = (double*)malloc(ann_model_param_count(ann->n_layers, ann->dim) * sizeof(double));
+    double* p = params;
+    for(int i=1; i<ann->n_layers; i++) {
+        size_t n_weights = (size_t)ann->dim[i] * ann->dim[i-1];
+        memcpy(p, ann->weights[i-1][0], n_weights * sizeof(double));
+        p += n_weights;
+        memcpy(p, ann->biases[i], ann->dim[i] * sizeof(double));
+        p += ann->dim[i];
+    }
+    int status = ann_model_save(path, ann->n_layers, ann->dim, params);
+    free(params);
+    return status;
+}
+
+network* load_ann(const char* path){
+    ann_model model;
+    if(ann_model_load(path, &model) != 0) {
+        return NULL;
+    }
+    // The kernels keep per-layer activations in MAX_SIZE-wide stack buffers,
+    // and a training row stores its label after the inputs
+    int fits = model.n_layers <= LAYER_SIZE && model.dim[0] <= MAX_SIZE - 1;
+    for(int i=1; i<model.n_layers; i++) {
+        fits = fits && model.dim[i] <= MAX_SIZE;
+    }
+    if(!fits) {
+        ann_model_free(&model);
+        errno = EINVAL;
+        return NULL;
+    }
+    network* ann = (network*)malloc(sizeof(network));
+    int n_layers = model.n_layers;
+    ann->n_layers = n_layers;
+    ann->dim = (int*)malloc(n_layers * sizeof(int));
+    ann->weights = (double***)malloc((n_layers-1) * sizeof(double**));
+    ann->biases = (double**)malloc(n_layers * sizeof(double*));
+    ann->sparse = NULL;
+    const double* p = model.params;
+    for(int i=0; i<n_layers; i++) {
+        ann->dim[i] = model.dim[i];
+        ann->biases[i] = (double*)calloc(model.dim[i], sizeof(double));
+        if(i > 0) {
+            int rows = model.dim[i];
+            int cols = model.dim[i-1];
+            ann->weights[i-1] = init_2Darray(rows, cols);
+            // Same first-touch partitioning as init_ann
+            #pragma omp parallel for schedule(static)
+            for(int j=0; j<rows; j++) {
+                memcpy(ann->weights[i-1][j], p + (size_t)j * cols, cols * sizeof(double));
+            }
+            p += (size_t)rows * cols;
+            memcpy(ann->biases[i], p, rows * sizeof(double));
+            p += rows;
+        }
+    }
+    ann_model_free(&model);
+    return ann;
+}
+
+unsigned char** prune_ann(network* ann, double sparsity, int block){
+    unsigned char** keep = (unsigned char**)calloc(ann->n_layers-1, sizeof(unsigned char*));
+    for(int i=1; i<ann->n_layers-1; i++) {
+        int rows = ann->dim[i];
+        int cols = ann->dim[i-1];
+        keep[i-1] = (unsigned char*)malloc((size_t)rows * cols);
+        if(block > 1) {
+            ann_prune_blocks(ann->weights[i-1][0], rows, cols, cols, block, sparsity, keep[i-1]);
+        }
+        else {
+            ann_prune_magnitude(ann->weights[i-1][0], rows, cols, cols, sparsity, keep[i-1]);
+        }
+    }
+    return keep;
+}
+
+void apply_prune_mask(network* ann, unsigned char** keep){
+    for(int i=1; i<ann->n_layers; i++) {
+        if(keep[i-1] != NULL) {
+            ann_prune_apply(ann->weights[i-1][0], ann->dim[i], ann->dim[i-1], ann->dim[i-1], keep[i-1]);
+        }
+    }
+}
+
+void free_prune_mask(network* ann, unsigned char** keep){
+    for(int i=0; i<ann->n_layers-1; i++) {
+        free(keep[i]);
+    }
+    free(keep);
+}
+
+void sparsify_ann(network* ann, int block){
+    if(ann->sparse == NULL) {
+        ann->sparse = (ann_sparse**)calloc(ann->n_layers-1, sizeof(ann_sparse*));
+    }
+    for(int i=1; i<ann->n_layers; i++) {
+        int rows = ann->dim[i];
+        int cols = ann->dim[i-1];
+        if(ann->sparse[i-1] != NULL) {
+            ann_sparse_free(ann->sparse[i-1]);
+            ann->sparse[i-1] = NULL;
+        }
+        // Above half density the index overhead outweighs the skipped work
+        if(ann_density(ann->weights[i-1][0], rows, cols, cols) <= 0.5) {
+            ann->sparse[i-1] = (ann_sparse*)malloc(sizeof(ann_sparse));
+            ann_sparse_from_dense(ann->sparse[i-1], ann->weights[i-1][0], rows, cols, cols, block);
+        }
+    }
+}
+
+void init_replicas(replica_set* set, network* ann){
+    int n_places = omp_get_num_places();
+    int packages[n_places > 0 ? n_places : 1];
+    set->n = 0;
+    set->n_places = n_places;
+    set->place_replica = (int*)malloc((n_places > 0 ? n_places : 1) * sizeof(int));
+    for(int p=0; p<n_places; p++) {
+        int ids[omp_get_place_num_procs(p) + 1];
+        omp_get_place_proc_ids(p, ids);
+        int package = omp_get_place_num_procs(p) > 0 ? ann_cpu_package(ids[0]) : 0;
+        int r = 0;
+        while(r < set->n && packages[r] != package) {
+            r++;
+        }
+        if(r == set->n) {
+            packages[set->n++] = package;
+        }
+        set->place_replica[p] = r;
+    }
+
+    set->nets = (network**)calloc(set->n > 0 ? set->n : 1, sizeof(network*));
+    set->shared = (set->n <= 1);
+    if(set->shared) {
+        // Unpinned or single socket: every thread already shares one copy
+        set->n = 1;
+        set->nets[0] = ann;
+        return;
+    }
+
+    // One thread per place builds the copy for its socket. Claims are made
+    // under the critical section and each copy lands in its own slot of
+    // built, which is only published to set->nets after the region.
+    unsigned char claimed[set->n];
+    network* built[set->n];
+    memset(claimed, 0, sizeof(claimed));
+    #pragma omp parallel proc_bind(spread)
+    {
+        int place = omp_get_place_num();
+        if(place >= 0) {
+            int r = set->place_replica[place];
+            int mine = 0;
+            #pragma omp critical
+            {
+                if(!claimed[r]) {
+                    claimed[r] = 1;
+                    mine = 1;
+                }
+            }
+            if(mine) {
+                built[r] = copy_ann(ann);
+            }
+        }
+    }
+    // Sockets no thread landed on get a copy from the master thread
+    for(int r=0; r<set->n; r++) {
+        set->nets[r] = claimed[r] ? built[r] : copy_ann(ann);
+    }
+}
+
+network* local_replica(replica_set* set){
+    int place = omp_get_place_num();
+    if(set->shared || place < 0) {
+        return set->nets[0];
+    }
+    return set->nets[set->place_replica[place]];
+}
+
+void free_replicas(replica_set* set){
+    if(!set->shared) {
+        for(int r=0; r<set->n; r++) {
+            free_ann(set->nets[r]);
+        }
+    }
+    free(set->nets);
+    free(set->place_replica);
+}
+
+#endif // ANN_OPENMP1_H
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_output.h"
+
+#define WRITER_BUFFER (1 << 20)
+
+// "00" .. "99", so the formatter emits two digits per division
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int ann_format_long(char* buf, long v) {
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    unsigned long u = v < 0 ? 0UL - (unsigned long)v : (unsigned long)v;
+    while (u >= 100) {
+        unsigned long r = u % 100;
+        u /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * r, 2);
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * u, 2);
+    } else {
+        *--p = (char)('0' + u);
+    }
+    if (v < 0) {
+        *--p = '-';
+    }
+    int len = (int)(tmp + sizeof(tmp) - p);
+    memcpy(buf, p, len);
+    return len;
+}
+
+size_t ann_format_predictions(char* buf, long first_id, const int* labels, int n) {
+    char* p = buf;
+    for (int i = 0; i < n; i++) {
+        p += ann_format_long(p, first_id + i);
+        *p++ = ',';
+        p += ann_format_long(p, labels[i]);
+        *p++ = '\n';
+    }
+    return (size_t)(p - buf);
+}
+
+static void writer_flush(ann_writer* w) {
+    if (w->len > 0) {
+        fwrite(w->buf, 1, w->len, w->file);
+        w->len = 0;
+    }
+}
+
+int ann_writer_open(ann_writer* w, const char* path) {
+    w->file = fopen(path, "w");
+    if (w->file == NULL) {
+        return -1;
+    }
+    w->cap = WRITER_BUFFER;
+    w->buf = (char*)malloc(w->cap);
+    w->len = strlen(ANN_OUTPUT_HEADER);
+    memcpy(w->buf, ANN_OUTPUT_HEADER, w->len);
+    w->next_id = 1;
+    return 0;
+}
+
+void ann_writer_predictions(ann_writer* w, const int* labels, int n) {
+    while (n > 0) {
+        int room = (int)((w->cap - w->len) / ANN_OUTPUT_MAX_ROW);
+        if (room == 0) {
+            writer_flush(w);
+            continue;
+        }
+        int m = n < room ? n : room;
+        w->len += ann_format_predictions(w->buf + w->len, w->next_id, labels, m);
+        w->next_id += m;
+        labels += m;
+        n -= m;
+    }
+}
+
+int ann_writer_close(ann_writer* w) {
+    writer_flush(w);
+    int failed = ferror(w->file);
+    failed |= fclose(w->file) != 0;
+    free(w->buf);
+    w->file = NULL;
+    w->buf = NULL;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,38 @@
+#ifndef ANN_OUTPUT_H
+#define ANN_OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Submission file output. Rows of "ImageId,Label" are formatted into large
+// buffers by hand and written in blocks instead of one fprintf per row.
+// MPI-free; ann_mpi_util.h builds the collective MPI-IO writer on the same
+// formatter.
+
+#define ANN_OUTPUT_HEADER "ImageId,Label\n"
+//Longest formatted row: two 64-bit integers, a comma and a newline
+#define ANN_OUTPUT_MAX_ROW 42
+
+//Writes v in decimal to buf without a terminator and returns its length
+int ann_format_long(char* buf, long v);
+
+//Formats the rows first_id, labels[0] .. first_id + n - 1, labels[n - 1]
+//into buf, which needs n * ANN_OUTPUT_MAX_ROW bytes; returns the bytes used
+size_t ann_format_predictions(char* buf, long first_id, const int* labels, int n);
+
+//Buffered submission file writer; IDs count up from 1 across calls
+typedef struct ann_writer {
+    FILE* file;
+    char* buf;
+    size_t len, cap;
+    long next_id;
+} ann_writer;
+
+//Creates path and writes the header; returns 0 on success, -1 otherwise
+int ann_writer_open(ann_writer* w, const char* path);
+//Appends the next n predictions
+void ann_writer_predictions(ann_writer* w, const int* labels, int n);
+//Flushes and closes the file; returns 0 if every write succeeded
+int ann_writer_close(ann_writer* w);
+
+#endif // ANN_OUTPUT_H
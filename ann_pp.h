@@ -0,0 +1,420 @@
+#ifndef ANN_PP_H
+#define ANN_PP_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "ann_prof.h"
+#include "ann_rng.h"
+
+// Pipeline-parallel (layer-partitioned) network. Consecutive layers are
+// assigned to the ranks of a communicator, one stage per rank, balanced by
+// weight count. A mini-batch is cut into micro-batches that flow through the
+// stages: activations go forward and deltas backward with nonblocking
+// point-to-point messages, gradients are accumulated per stage and applied
+// once per mini-batch (a pipeline flush), so training is plain mini-batch
+// SGD whatever the number of stages.
+//
+// Schedules:
+//   PP_GPIPE  all forward passes of a mini-batch, then all backward passes
+//   PP_1F1B   after a warm-up of (stages - stage - 1) forwards, each stage
+//             alternates one forward and one backward, which keeps at most
+//             `stages` micro-batches of activations alive per stage
+
+enum pp_schedule {
+    PP_GPIPE,
+    PP_1F1B,
+};
+
+typedef struct pp_network {
+    int n_layers;
+    int* dim;            // full layer widths
+    int first, last;     // this stage maps layer first's activations to layer last's
+    double** weights;    // weights[l-1] for first < l <= last: dim[l] x dim[l-1], NULL elsewhere
+    double** biases;     // biases[l] for first < l <= last
+    double** grad_w;     // accumulated gradients, same layout as weights
+    double** grad_b;
+    int n_micro;         // micro-batches per mini-batch
+    int micro_rows;      // rows per micro-batch
+    double*** act;       // act[m][l]: micro_rows x dim[l] activations for first <= l <= last
+    double*** delta;     // delta[m][l]: deltas for first <= l <= last
+    double** labels;     // labels[m]: labels of micro-batch m (first and last stage)
+    int* predictions;    // labels predicted for one micro-batch (last stage)
+    enum pp_schedule schedule;
+    MPI_Comm comm;
+    int rank, size;
+} pp_network;
+
+//Function prototypes
+void pp_init_ann(pp_network*, int dim[], int n_layers, int n_micro, int micro_rows, enum pp_schedule schedule, uint64_t seed, MPI_Comm comm);
+void pp_train(pp_network*, double** data, int length, double learning_rate);
+void pp_predict(pp_network*, double** data, int length, int* labels);
+void pp_free_ann(pp_network*);
+
+
+//Splits the weight layers into contiguous stages of roughly equal weight
+//count; stage s owns the layers in (bounds[s], bounds[s+1]]
+static void pp_partition(const int dim[], int n_layers, int stages, int bounds[]) {
+    double total = 0;
+    for (int l = 1; l < n_layers; l++) {
+        total += (double)dim[l] * dim[l - 1];
+    }
+    bounds[0] = 0;
+    double done = 0;
+    int l = 1;
+    for (int s = 0; s < stages - 1; s++) {
+        // Take at least one layer and leave at least one for every later stage
+        done += (double)dim[l] * dim[l - 1];
+        l++;
+        while (l < n_layers - (stages - 1 - s) &&
+               done + (double)dim[l] * dim[l - 1] / 2 <= total * (s + 1) / stages) {
+            done += (double)dim[l] * dim[l - 1];
+            l++;
+        }
+        bounds[s + 1] = l - 1;
+    }
+    bounds[stages] = n_layers - 1;
+}
+
+void pp_init_ann(pp_network* ann, int dim[], int n_layers, int n_micro, int micro_rows, enum pp_schedule schedule, uint64_t seed, MPI_Comm comm) {
+    ann->comm = comm;
+    MPI_Comm_rank(comm, &ann->rank);
+    MPI_Comm_size(comm, &ann->size);
+    if (ann->size > n_layers - 1) {
+        if (ann->rank == 0) {
+            printf("%d ranks but only %d weight layers; use at most one rank per layer\n", ann->size, n_layers - 1);
+        }
+        MPI_Abort(comm, 1);
+    }
+    int bounds[ann->size + 1];
+    pp_partition(dim, n_layers, ann->size, bounds);
+    ann->first = bounds[ann->rank];
+    ann->last = bounds[ann->rank + 1];
+    ann->n_layers = n_layers;
+    ann->n_micro = n_micro;
+    ann->micro_rows = micro_rows;
+    ann->schedule = schedule;
+    ann->dim = (int*)malloc(n_layers * sizeof(int));
+    memcpy(ann->dim, dim, n_layers * sizeof(int));
+
+    ann->weights = (double**)calloc(n_layers, sizeof(double*));
+    ann->biases = (double**)calloc(n_layers, sizeof(double*));
+    ann->grad_w = (double**)calloc(n_layers, sizeof(double*));
+    ann->grad_b = (double**)calloc(n_layers, sizeof(double*));
+    for (int l = ann->first + 1; l <= ann->last; l++) {
+        size_t n = (size_t)dim[l] * dim[l - 1];
+        ann->weights[l - 1] = (double*)malloc(n * sizeof(double));
+        ann->grad_w[l - 1] = (double*)calloc(n, sizeof(double));
+        ann->biases[l] = (double*)malloc(dim[l] * sizeof(double));
+        ann->grad_b[l] = (double*)calloc(dim[l], sizeof(double));
+        // Drawn per connection so any stage split builds the same network
+        double scale = sqrt(6.0 / (dim[l - 1] + dim[l]));
+        for (int j = 0; j < dim[l]; j++) {
+            for (int k = 0; k < dim[l - 1]; k++) {
+                ann->weights[l - 1][(size_t)j * dim[l - 1] + k] = (2 * ann_rng_weight(seed, l, j, k) - 1) * scale;
+            }
+        }
+        for (int j = 0; j < dim[l]; j++) {
+            ann->biases[l][j] = 0;
+        }
+    }
+
+    ann->act = (double***)malloc(n_micro * sizeof(double**));
+    ann->delta = (double***)malloc(n_micro * sizeof(double**));
+    ann->labels = (double**)malloc(n_micro * sizeof(double*));
+    for (int m = 0; m < n_micro; m++) {
+        ann->act[m] = (double**)calloc(n_layers, sizeof(double*));
+        ann->delta[m] = (double**)calloc(n_layers, sizeof(double*));
+        for (int l = ann->first; l <= ann->last; l++) {
+            ann->act[m][l] = (double*)malloc((size_t)micro_rows * dim[l] * sizeof(double));
+            ann->delta[m][l] = (double*)malloc((size_t)micro_rows * dim[l] * sizeof(double));
+        }
+        ann->labels[m] = (double*)malloc(micro_rows * sizeof(double));
+    }
+    ann->predictions = (int*)malloc(micro_rows * sizeof(int));
+}
+
+//Rows of micro-batch m when a mini-batch of rows is cut into n_micro parts
+static inline int pp_micro_size(const pp_network* ann, int rows, int m) {
+    int start = m * ann->micro_rows;
+    int end = start + ann->micro_rows < rows ? start + ann->micro_rows : rows;
+    return end > start ? end - start : 0;
+}
+
+static void pp_forward(pp_network* ann, int m, int rows, MPI_Request* recv) {
+    if (ann->rank > 0) {
+        double t0 = ann_prof_begin();
+        MPI_Wait(recv, MPI_STATUS_IGNORE);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    }
+    double t0 = ann_prof_begin();
+    double flops = 0;
+    for (int l = ann->first + 1; l <= ann->last; l++) {
+        int n_out = ann->dim[l], n_in = ann->dim[l - 1];
+        const double* w = ann->weights[l - 1];
+        for (int r = 0; r < rows; r++) {
+            const double* in = ann->act[m][l - 1] + (size_t)r * n_in;
+            double* out = ann->act[m][l] + (size_t)r * n_out;
+            for (int j = 0; j < n_out; j++) {
+                const double* wj = w + (size_t)j * n_in;
+                double f_sum = ann->biases[l][j];
+                for (int k = 0; k < n_in; k++) {
+                    f_sum += wj[k] * in[k];
+                }
+                out[j] = 1 / (1 + exp(-f_sum));
+            }
+        }
+        flops += 2.0 * rows * n_out * n_in;
+    }
+    ann_prof_end(ANN_PHASE_FORWARD, t0, flops);
+}
+
+static void pp_backward(pp_network* ann, int m, int rows, MPI_Request* recv_delta, MPI_Request* recv_labels) {
+    int top = ann->last;
+    double t0;
+    if (ann->rank == ann->size - 1) {
+        if (ann->rank > 0) {
+            t0 = ann_prof_begin();
+            MPI_Wait(recv_labels, MPI_STATUS_IGNORE);
+            ann_prof_end(ANN_PHASE_COMM, t0, 0);
+        }
+        t0 = ann_prof_begin();
+        int n_out = ann->dim[top];
+        for (int r = 0; r < rows; r++) {
+            const double* o = ann->act[m][top] + (size_t)r * n_out;
+            double* d = ann->delta[m][top] + (size_t)r * n_out;
+            double label = ann->labels[m][r];
+            for (int j = 0; j < n_out; j++) {
+                double expected_value = (n_out == 1) ? label : (j == label ? 1 : 0);
+                d[j] = o[j] * (1 - o[j]) * (o[j] - expected_value);
+            }
+        }
+        ann_prof_end(ANN_PHASE_BACKWARD, t0, 4.0 * rows * n_out);
+    } else {
+        t0 = ann_prof_begin();
+        MPI_Wait(recv_delta, MPI_STATUS_IGNORE);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    }
+
+    t0 = ann_prof_begin();
+    double flops = 0;
+    for (int l = top; l > ann->first; l--) {
+        int n_out = ann->dim[l], n_in = ann->dim[l - 1];
+        const double* w = ann->weights[l - 1];
+        double* gw = ann->grad_w[l - 1];
+        double* gb = ann->grad_b[l];
+        // The input layer has no weights below it, so its deltas are skipped
+        int propagate = (l - 1 > 0);
+        for (int r = 0; r < rows; r++) {
+            const double* in = ann->act[m][l - 1] + (size_t)r * n_in;
+            const double* d = ann->delta[m][l] + (size_t)r * n_out;
+            double* d_in = ann->delta[m][l - 1] + (size_t)r * n_in;
+            if (propagate) {
+                memset(d_in, 0, n_in * sizeof(double));
+            }
+            for (int j = 0; j < n_out; j++) {
+                const double* wj = w + (size_t)j * n_in;
+                double* gj = gw + (size_t)j * n_in;
+                double dj = d[j];
+                gb[j] += dj;
+                for (int k = 0; k < n_in; k++) {
+                    gj[k] += dj * in[k];
+                }
+                if (propagate) {
+                    for (int k = 0; k < n_in; k++) {
+                        d_in[k] += dj * wj[k];
+                    }
+                }
+            }
+            if (propagate) {
+                for (int k = 0; k < n_in; k++) {
+                    d_in[k] *= in[k] * (1 - in[k]);
+                }
+            }
+        }
+        flops += (propagate ? 4.0 : 2.0) * rows * n_out * n_in;
+    }
+    ann_prof_end(ANN_PHASE_BACKWARD, t0, flops);
+}
+
+static void pp_apply_gradients(pp_network* ann, double scale) {
+    double t0 = ann_prof_begin();
+    double flops = 0;
+    for (int l = ann->first + 1; l <= ann->last; l++) {
+        size_t n = (size_t)ann->dim[l] * ann->dim[l - 1];
+        for (size_t p = 0; p < n; p++) {
+            ann->weights[l - 1][p] -= scale * ann->grad_w[l - 1][p];
+        }
+        for (int j = 0; j < ann->dim[l]; j++) {
+            ann->biases[l][j] -= scale * ann->grad_b[l][j];
+        }
+        memset(ann->grad_w[l - 1], 0, n * sizeof(double));
+        memset(ann->grad_b[l], 0, ann->dim[l] * sizeof(double));
+        flops += 2.0 * n;
+    }
+    ann_prof_end(ANN_PHASE_UPDATE, t0, flops);
+}
+
+//Trains on length rows in mini-batches of n_micro * micro_rows rows. data is
+//only read on the first stage; length must be the same on every rank.
+void pp_train(pp_network* ann, double** data, int length, double learning_rate) {
+    int M = ann->n_micro;
+    int S = ann->size, s = ann->rank;
+    int batch_rows = M * ann->micro_rows;
+    int n_first = ann->dim[ann->first], n_last = ann->dim[ann->last];
+    MPI_Request recv_act[M], recv_delta[M], recv_labels[M];
+    MPI_Request sends[3 * M];
+
+    for (int start = 0; start < length; start += batch_rows) {
+        int rows = length - start < batch_rows ? length - start : batch_rows;
+        int n_sends = 0;
+        // Post every receive of the mini-batch up front so messages land as
+        // soon as the neighbouring stage sends them
+        for (int m = 0; m < M; m++) {
+            int mr = pp_micro_size(ann, rows, m);
+            if (s > 0) {
+                MPI_Irecv(ann->act[m][ann->first], mr * n_first, MPI_DOUBLE, s - 1, m, ann->comm, &recv_act[m]);
+            }
+            if (s < S - 1) {
+                MPI_Irecv(ann->delta[m][ann->last], mr * n_last, MPI_DOUBLE, s + 1, M + m, ann->comm, &recv_delta[m]);
+            }
+            if (s == S - 1 && S > 1) {
+                MPI_Irecv(ann->labels[m], mr, MPI_DOUBLE, 0, 2 * M + m, ann->comm, &recv_labels[m]);
+            }
+        }
+        if (s == 0) {
+            for (int m = 0; m < M; m++) {
+                int mr = pp_micro_size(ann, rows, m);
+                for (int r = 0; r < mr; r++) {
+                    const double* row = data[start + m * ann->micro_rows + r];
+                    memcpy(ann->act[m][0] + (size_t)r * n_first, row, n_first * sizeof(double));
+                    ann->labels[m][r] = row[ann->dim[0]];
+                }
+                if (S > 1) {
+                    MPI_Isend(ann->labels[m], mr, MPI_DOUBLE, S - 1, 2 * M + m, ann->comm, &sends[n_sends++]);
+                }
+            }
+        }
+
+        int warmup = (ann->schedule == PP_GPIPE) ? M : (S - s - 1 < M ? S - s - 1 : M);
+        int f = 0, b = 0;
+        while (b < M) {
+            if (f < M && (f < warmup || f == b + warmup)) {
+                int mr = pp_micro_size(ann, rows, f);
+                pp_forward(ann, f, mr, &recv_act[f]);
+                if (s < S - 1) {
+                    MPI_Isend(ann->act[f][ann->last], mr * n_last, MPI_DOUBLE, s + 1, f, ann->comm, &sends[n_sends++]);
+                }
+                f++;
+            } else {
+                int mr = pp_micro_size(ann, rows, b);
+                pp_backward(ann, b, mr, &recv_delta[b], &recv_labels[b]);
+                if (s > 0) {
+                    MPI_Isend(ann->delta[b][ann->first], mr * n_first, MPI_DOUBLE, s - 1, M + b, ann->comm, &sends[n_sends++]);
+                }
+                b++;
+            }
+        }
+
+        double t0 = ann_prof_begin();
+        MPI_Waitall(n_sends, sends, MPI_STATUSES_IGNORE);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+        pp_apply_gradients(ann, learning_rate / rows);
+        ann_prof_samples(rows);
+    }
+}
+
+//Forward-only pipeline; labels receives the predictions on the first stage
+void pp_predict(pp_network* ann, double** data, int length, int* labels) {
+    int S = ann->size, s = ann->rank;
+    int n_first = ann->dim[ann->first], n_last = ann->dim[ann->last];
+    int M = ann->n_micro;
+    MPI_Request recv_act[M], sends[2 * M];
+
+    for (int start = 0; start < length; start += M * ann->micro_rows) {
+        int rows = length - start < M * ann->micro_rows ? length - start : M * ann->micro_rows;
+        int n_sends = 0;
+        for (int m = 0; m < M; m++) {
+            int mr = pp_micro_size(ann, rows, m);
+            if (s > 0) {
+                MPI_Irecv(ann->act[m][ann->first], mr * n_first, MPI_DOUBLE, s - 1, m, ann->comm, &recv_act[m]);
+            }
+            if (s == 0) {
+                for (int r = 0; r < mr; r++) {
+                    memcpy(ann->act[m][0] + (size_t)r * n_first, data[start + m * ann->micro_rows + r], n_first * sizeof(double));
+                }
+            }
+        }
+        for (int m = 0; m < M; m++) {
+            int mr = pp_micro_size(ann, rows, m);
+            pp_forward(ann, m, mr, &recv_act[m]);
+            if (s < S - 1) {
+                MPI_Isend(ann->act[m][ann->last], mr * n_last, MPI_DOUBLE, s + 1, m, ann->comm, &sends[n_sends++]);
+                continue;
+            }
+            for (int r = 0; r < mr; r++) {
+                const double* o = ann->act[m][ann->last] + (size_t)r * n_last;
+                int maxval = 0;
+                if (n_last == 1) {
+                    maxval = o[0] >= 0.5;
+                } else {
+                    for (int j = 1; j < n_last; j++) {
+                        if (o[j] > o[maxval]) {
+                            maxval = j;
+                        }
+                    }
+                }
+                ann->predictions[r] = maxval;
+            }
+            if (S == 1) {
+                memcpy(labels + start + m * ann->micro_rows, ann->predictions, mr * sizeof(int));
+            } else {
+                double t0 = ann_prof_begin();
+                MPI_Send(ann->predictions, mr, MPI_INT, 0, M + m, ann->comm);
+                ann_prof_end(ANN_PHASE_COMM, t0, 0);
+            }
+        }
+        double t0 = ann_prof_begin();
+        if (s == 0 && S > 1) {
+            for (int m = 0; m < M; m++) {
+                int mr = pp_micro_size(ann, rows, m);
+                MPI_Recv(labels + start + m * ann->micro_rows, mr, MPI_INT, S - 1, M + m, ann->comm, MPI_STATUS_IGNORE);
+            }
+        }
+        MPI_Waitall(n_sends, sends, MPI_STATUSES_IGNORE);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+        ann_prof_samples(rows);
+    }
+}
+
+void pp_free_ann(pp_network* ann) {
+    for (int l = ann->first + 1; l <= ann->last; l++) {
+        free(ann->weights[l - 1]);
+        free(ann->grad_w[l - 1]);
+        free(ann->biases[l]);
+        free(ann->grad_b[l]);
+    }
+    for (int m = 0; m < ann->n_micro; m++) {
+        for (int l = ann->first; l <= ann->last; l++) {
+            free(ann->act[m][l]);
+            free(ann->delta[m][l]);
+        }
+        free(ann->act[m]);
+        free(ann->delta[m]);
+        free(ann->labels[m]);
+    }
+    free(ann->act);
+    free(ann->delta);
+    free(ann->labels);
+    free(ann->predictions);
+    free(ann->weights);
+    free(ann->biases);
+    free(ann->grad_w);
+    free(ann->grad_b);
+    free(ann->dim);
+}
+
+#endif // ANN_PP_H
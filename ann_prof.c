@@ -0,0 +1,315 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "ann_common.h"
+#include "ann_prof.h"
+
+const char* const ann_phase_names[ANN_PHASE_COUNT] = {
+    "parse", "forward", "backward", "update", "comm", "output"
+};
+
+const char* const ann_counter_names[ANN_COUNTER_COUNT] = {
+    "cycles", "instructions", "llc_misses", "l1d_misses", "branch_misses"
+};
+
+_Thread_local ann_prof_thread* ann_prof_self = NULL;
+int ann_prof_counters_on = 0;
+
+#define COUNTER_DEPTH 4   // nested phases whose start values are kept
+
+// The calling thread's counter group; values[] of a group read are in the
+// order the members were opened, slot[c] is counter c's position or -1
+typedef struct counter_group {
+    int state;            // 0 not opened yet, 1 open, -1 unavailable
+    int leader;
+    int n_open;
+    int slot[ANN_COUNTER_COUNT];
+    int depth;
+    uint64_t start[COUNTER_DEPTH][ANN_COUNTER_COUNT + 2];
+} counter_group;
+
+static _Thread_local counter_group group;
+static atomic_int counters_warned = 0;
+
+static ann_prof_thread slots[ANN_PROF_MAX_THREADS];
+static ann_prof_thread overflow_slot;
+static atomic_int n_slots = 0;
+
+static ann_prof_region regions[ANN_PROF_MAX_REGIONS];
+static int n_regions = 0;
+static ann_prof_thread region_start[ANN_PROF_MAX_THREADS];
+static double region_t0;
+static int region_open = 0;
+
+ann_prof_thread* ann_prof_attach(void) {
+    int id = atomic_fetch_add(&n_slots, 1);
+    // Threads beyond the table share one slot; their totals are approximate
+    ann_prof_self = (id < ANN_PROF_MAX_THREADS) ? &slots[id] : &overflow_slot;
+    return ann_prof_self;
+}
+
+void ann_prof_enable_counters(void) {
+    ann_prof_counters_on = 1;
+}
+
+static void counters_open(counter_group* g) {
+    static const struct { uint32_t type; uint64_t config; } events[ANN_COUNTER_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+    g->leader = -1;
+    g->n_open = 0;
+    int first_error = 0;
+    for (int c = 0; c < ANN_COUNTER_COUNT; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[c].type;
+        attr.config = events[c].config;
+        attr.disabled = (g->leader < 0);
+        attr.exclude_kernel = 1;   // allowed at the default perf_event_paranoid
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // Calling thread only, on whichever CPU it runs
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, g->leader, 0);
+        if (fd < 0) {
+            // A PMU without this event leaves the rest of the group usable
+            g->slot[c] = -1;
+            first_error = first_error ? first_error : errno;
+            continue;
+        }
+        if (g->leader < 0) {
+            g->leader = fd;
+        }
+        g->slot[c] = g->n_open++;
+    }
+    if (first_error != 0 && atomic_fetch_add(&counters_warned, 1) == 0) {
+        fprintf(stderr, "perf_event_open: %s; %s\n", strerror(first_error),
+                g->leader < 0 ? "no hardware counters on this thread" : "some hardware counters read as zero");
+    }
+    if (g->leader < 0) {
+        g->state = -1;
+        return;
+    }
+    ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    g->state = 1;
+}
+
+// time_enabled, time_running, then the open counters in slot order
+static int counters_read(counter_group* g, uint64_t* values) {
+    uint64_t buf[3 + ANN_COUNTER_COUNT];
+    ssize_t want = (ssize_t)((3 + g->n_open) * sizeof(uint64_t));
+    if (read(g->leader, buf, want) != want) {
+        return -1;
+    }
+    memcpy(values, buf + 1, (2 + g->n_open) * sizeof(uint64_t));
+    return 0;
+}
+
+void ann_prof_counters_begin(void) {
+    counter_group* g = &group;
+    if (g->state == 0) {
+        counters_open(g);
+    }
+    if (g->state == 1 && g->depth < COUNTER_DEPTH && counters_read(g, g->start[g->depth]) != 0) {
+        memset(g->start[g->depth], 0, sizeof(g->start[0]));
+    }
+    g->depth++;
+}
+
+void ann_prof_counters_end(ann_prof_thread* self, int phase) {
+    counter_group* g = &group;
+    if (g->depth == 0) {
+        return;  // counters were enabled inside this phase
+    }
+    g->depth--;
+    uint64_t now[ANN_COUNTER_COUNT + 2];
+    if (g->state != 1 || g->depth >= COUNTER_DEPTH || counters_read(g, now) != 0) {
+        return;
+    }
+    const uint64_t* start = g->start[g->depth];
+    // Scale up if the group was multiplexed off the PMU for part of the phase
+    double enabled = (double)(now[0] - start[0]);
+    double running = (double)(now[1] - start[1]);
+    double scale = (running > 0 && running < enabled) ? enabled / running : 1;
+    for (int c = 0; c < ANN_COUNTER_COUNT; c++) {
+        int k = g->slot[c];
+        if (k >= 0) {
+            self->counters[phase][c] += (long long)((now[2 + k] - start[2 + k]) * scale);
+        }
+    }
+}
+
+long get_current_memory_usage(void) {
+    long pages = 0;
+    long resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static int used_slots(void) {
+    int n = atomic_load(&n_slots);
+    return n < ANN_PROF_MAX_THREADS ? n : ANN_PROF_MAX_THREADS;
+}
+
+void ann_prof_region_begin(const char* name) {
+    if (n_regions == ANN_PROF_MAX_REGIONS) {
+        return;
+    }
+    ann_prof_region* r = &regions[n_regions];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    memcpy(region_start, slots, sizeof(slots));
+    r->rss_begin = get_current_memory_usage();
+    region_open = 1;
+    region_t0 = ann_wall_time();
+}
+
+const ann_prof_region* ann_prof_region_end(void) {
+    if (!region_open) {
+        return NULL;
+    }
+    ann_prof_region* r = &regions[n_regions++];
+    r->wall_seconds = ann_wall_time() - region_t0;
+    r->rss_end = get_current_memory_usage();
+    r->peak_rss = get_memory_usage();
+    r->n_threads = used_slots();
+    for (int t = 0; t < r->n_threads; t++) {
+        ann_prof_thread* d = &r->threads[t];
+        for (int p = 0; p < ANN_PHASE_COUNT; p++) {
+            d->seconds[p] = slots[t].seconds[p] - region_start[t].seconds[p];
+            d->flops[p] = slots[t].flops[p] - region_start[t].flops[p];
+            d->calls[p] = slots[t].calls[p] - region_start[t].calls[p];
+            r->total.seconds[p] += d->seconds[p];
+            r->total.flops[p] += d->flops[p];
+            r->total.calls[p] += d->calls[p];
+            for (int c = 0; c < ANN_COUNTER_COUNT; c++) {
+                d->counters[p][c] = slots[t].counters[p][c] - region_start[t].counters[p][c];
+                r->total.counters[p][c] += d->counters[p][c];
+            }
+        }
+        d->samples = slots[t].samples - region_start[t].samples;
+        r->total.samples += d->samples;
+    }
+    region_open = 0;
+    return r;
+}
+
+void ann_prof_print_region(const char* label, const ann_prof_region* r, double wall_seconds) {
+    long growth = r->rss_end - r->rss_begin;
+    printf("Time taken for %s: %.2f seconds\n", label, wall_seconds);
+    printf("Peak memory after %s: %ld bytes (%.2f MB)\n", label, r->peak_rss, (double)r->peak_rss / (1024 * 1024));
+    printf("Resident memory change during %s: %ld bytes (%.2f MB)\n", label, growth, (double)growth / (1024 * 1024));
+    if (!ann_prof_counters_on) {
+        return;
+    }
+    for (int p = 0; p < ANN_PHASE_COUNT; p++) {
+        const long long* c = r->total.counters[p];
+        if (r->total.calls[p] == 0 || c[ANN_COUNTER_CYCLES] == 0) {
+            continue;
+        }
+        // Misses per thousand instructions, the usual way to compare phases
+        double kinstr = c[ANN_COUNTER_INSTRUCTIONS] > 0 ? c[ANN_COUNTER_INSTRUCTIONS] / 1000.0 : 1;
+        printf("  %-8s %.3g cycles, IPC %.2f, per 1k instructions: L1D %.2f, LLC %.3f, branch %.2f misses\n",
+               ann_phase_names[p], (double)c[ANN_COUNTER_CYCLES],
+               (double)c[ANN_COUNTER_INSTRUCTIONS] / c[ANN_COUNTER_CYCLES],
+               c[ANN_COUNTER_L1D_MISSES] / kinstr, c[ANN_COUNTER_LLC_MISSES] / kinstr,
+               c[ANN_COUNTER_BRANCH_MISSES] / kinstr);
+    }
+}
+
+static void write_phases(FILE* out, const ann_prof_thread* p) {
+    fprintf(out, "{");
+    for (int i = 0; i < ANN_PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\": {\"seconds\": %.9f, \"calls\": %lld, \"flops\": %.0f",
+                i ? ", " : "", ann_phase_names[i], p->seconds[i], p->calls[i], p->flops[i]);
+        if (ann_prof_counters_on) {
+            fprintf(out, ", \"counters\": {");
+            for (int c = 0; c < ANN_COUNTER_COUNT; c++) {
+                fprintf(out, "%s\"%s\": %lld", c ? ", " : "", ann_counter_names[c], p->counters[i][c]);
+            }
+            fprintf(out, "}");
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}");
+}
+
+char* ann_prof_rank_json(int rank) {
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&buf, &len);
+    if (out == NULL) {
+        return NULL;
+    }
+    fprintf(out, "{\"rank\": %d, \"regions\": [", rank);
+    for (int i = 0; i < n_regions; i++) {
+        const ann_prof_region* r = &regions[i];
+        double flops = 0;
+        for (int p = 0; p < ANN_PHASE_COUNT; p++) {
+            flops += r->total.flops[p];
+        }
+        double wall = r->wall_seconds > 0 ? r->wall_seconds : 1e-12;
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"wall_seconds\": %.9f, \"samples\": %lld, "
+                "\"samples_per_second\": %.3f, \"flops\": %.0f, \"flops_per_second\": %.3f, "
+                "\"peak_rss_bytes\": %ld, \"rss_begin_bytes\": %ld, \"rss_end_bytes\": %ld,\n     \"phases\": ",
+                i ? "," : "", r->name, r->wall_seconds, r->total.samples,
+                r->total.samples / wall, flops, flops / wall,
+                r->peak_rss, r->rss_begin, r->rss_end);
+        write_phases(out, &r->total);
+        fprintf(out, ",\n     \"threads\": [");
+        for (int t = 0; t < r->n_threads; t++) {
+            fprintf(out, "%s\n       {\"thread\": %d, \"samples\": %lld, \"phases\": ",
+                    t ? "," : "", t, r->threads[t].samples);
+            write_phases(out, &r->threads[t]);
+            fprintf(out, "}");
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "]}");
+    fclose(out);
+    return buf;
+}
+
+void ann_prof_write_report(FILE* out, const char* program, char** rank_json, int n_ranks) {
+    fprintf(out, "{\"program\": \"%s\", \"ranks\": %d, \"data\": [\n  ", program, n_ranks);
+    for (int i = 0; i < n_ranks; i++) {
+        fprintf(out, "%s%s", i ? ",\n  " : "", rank_json[i] ? rank_json[i] : "null");
+    }
+    fprintf(out, "\n]}\n");
+}
+
+void ann_prof_write_report_file(const char* path, const char* program) {
+    if (path == NULL) {
+        return;
+    }
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Unable to open file %s\n", path);
+        return;
+    }
+    char* json = ann_prof_rank_json(0);
+    ann_prof_write_report(out, program, &json, 1);
+    free(json);
+    fclose(out);
+}
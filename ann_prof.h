@@ -0,0 +1,150 @@
+#ifndef ANN_PROF_H
+#define ANN_PROF_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Wall-clock instrumentation for the training and inference hot paths.
+//
+// Phases are accumulated per thread (each thread gets its own cache-line
+// aligned slot on first use) and are cheap enough to leave on in the per-sample
+// loops. Regions are coarse, driver-level intervals such as "train" or "test";
+// closing a region snapshots every thread's phase totals so the report can show
+// where the time inside that region went.
+//
+// With ann_prof_enable_counters (--counters or ANN_COUNTERS=1) every phase
+// also accumulates Linux PMU counters from perf_event_open, opened per thread
+// as one group and read with one read() at each phase boundary. The counters
+// see only the thread that records the phase; workers of an OpenMP region
+// inside a phase are not included.
+
+enum ann_phase {
+    ANN_PHASE_PARSE,
+    ANN_PHASE_FORWARD,
+    ANN_PHASE_BACKWARD,
+    ANN_PHASE_UPDATE,
+    ANN_PHASE_COMM,
+    ANN_PHASE_OUTPUT,
+    ANN_PHASE_COUNT
+};
+
+enum ann_counter {
+    ANN_COUNTER_CYCLES,
+    ANN_COUNTER_INSTRUCTIONS,
+    ANN_COUNTER_LLC_MISSES,
+    ANN_COUNTER_L1D_MISSES,
+    ANN_COUNTER_BRANCH_MISSES,
+    ANN_COUNTER_COUNT
+};
+
+#define ANN_PROF_MAX_THREADS 256
+#define ANN_PROF_MAX_REGIONS 16
+
+typedef struct ann_prof_thread {
+    double seconds[ANN_PHASE_COUNT];
+    double flops[ANN_PHASE_COUNT];
+    long long calls[ANN_PHASE_COUNT];
+    long long samples;
+    long long counters[ANN_PHASE_COUNT][ANN_COUNTER_COUNT];
+} __attribute__((aligned(64))) ann_prof_thread;
+
+typedef struct ann_prof_region {
+    char name[32];
+    double wall_seconds;
+    long peak_rss;       // ru_maxrss at the end of the region, bytes
+    long rss_begin;      // current resident set size when the region opened
+    long rss_end;        // current resident set size when the region closed
+    int n_threads;
+    ann_prof_thread total;
+    ann_prof_thread threads[ANN_PROF_MAX_THREADS];
+} ann_prof_region;
+
+extern const char* const ann_phase_names[ANN_PHASE_COUNT];
+extern const char* const ann_counter_names[ANN_COUNTER_COUNT];
+extern _Thread_local ann_prof_thread* ann_prof_self;
+extern int ann_prof_counters_on;
+
+ann_prof_thread* ann_prof_attach(void);
+
+//Starts collecting hardware counters on every thread's next phase. Call
+//before the phases of interest; threads that cannot open the counters
+//record zeros, and the first failure is reported once.
+void ann_prof_enable_counters(void);
+void ann_prof_counters_begin(void);
+void ann_prof_counters_end(ann_prof_thread* self, int phase);
+
+//Monotonic wall clock in seconds
+static inline double ann_wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline double ann_prof_begin(void) {
+    if (ann_prof_counters_on) {
+        ann_prof_counters_begin();
+    }
+    return ann_wall_time();
+}
+
+//Closes a phase interval opened with ann_prof_begin on the calling thread
+static inline void ann_prof_end(int phase, double t0, double flops) {
+    ann_prof_thread* self = ann_prof_self ? ann_prof_self : ann_prof_attach();
+    self->seconds[phase] += ann_wall_time() - t0;
+    self->flops[phase] += flops;
+    self->calls[phase]++;
+    if (ann_prof_counters_on) {
+        ann_prof_counters_end(self, phase);
+    }
+}
+
+static inline void ann_prof_samples(long long n) {
+    ann_prof_thread* self = ann_prof_self ? ann_prof_self : ann_prof_attach();
+    self->samples += n;
+}
+
+//FLOPs per sample of a dense sigmoid network with the given layer widths
+static inline double ann_flops_forward(const int* dim, int n_layers) {
+    double flops = 0;
+    for (int i = 1; i < n_layers; i++) {
+        flops += 2.0 * dim[i] * dim[i - 1] + dim[i];
+    }
+    return flops;
+}
+
+//Deltas of the hidden layers only; no kernel computes the input layer's
+static inline double ann_flops_backward(const int* dim, int n_layers) {
+    double flops = 0;
+    for (int i = 1; i < n_layers - 1; i++) {
+        flops += 2.0 * dim[i] * dim[i + 1] + 3.0 * dim[i];
+    }
+    return flops;
+}
+
+static inline double ann_flops_update(const int* dim, int n_layers) {
+    double flops = 0;
+    for (int i = 0; i < n_layers - 1; i++) {
+        flops += 3.0 * dim[i] * dim[i + 1] + 2.0 * dim[i + 1];
+    }
+    return flops;
+}
+
+//Current resident set size in bytes (unlike get_memory_usage, not a peak)
+long get_current_memory_usage(void);
+
+void ann_prof_region_begin(const char* name);
+const ann_prof_region* ann_prof_region_end(void);
+
+//Prints the wall time and memory summary of a region, e.g. label "training"
+void ann_prof_print_region(const char* label, const ann_prof_region* r, double wall_seconds);
+
+//JSON object describing every closed region of this process; caller frees
+char* ann_prof_rank_json(int rank);
+
+//Writes the full report given one ann_prof_rank_json fragment per rank
+void ann_prof_write_report(FILE* out, const char* program, char** rank_json, int n_ranks);
+
+//Convenience for single-process drivers; does nothing when path is NULL
+void ann_prof_write_report_file(const char* path, const char* program);
+
+#endif // ANN_PROF_H
@@ -0,0 +1,55 @@
+#ifndef ANN_RNG_H
+#define ANN_RNG_H
+
+#include <stdint.h>
+
+// Counter-based random numbers. Every value is a pure function of
+// (seed, stream, counter): there is no generator state to share or advance,
+// so values can be produced in any order, by any thread or rank, and loops
+// that fill arrays with them parallelize and vectorize like any other loop.
+// The result does not depend on the thread or rank count.
+//
+// Value n of a stream is the SplitMix64 output mix(state + n * golden), with
+// the starting state derived from the seed and the stream.
+//
+// Streams separate independent uses of one seed. The high 32 bits name the
+// use (ANN_RNG_WEIGHTS, ...) and the low bits an index within it, such as a
+// layer or an epoch.
+
+enum ann_rng_use {
+    ANN_RNG_WEIGHTS = 1,   // initial weights, indexed by layer
+    ANN_RNG_SHUFFLE = 2,   // sample order, indexed by epoch
+    ANN_RNG_DROPOUT = 3,   // dropout masks, indexed by step
+};
+
+#define ANN_RNG_GOLDEN 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t ann_rng_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t ann_rng_stream(enum ann_rng_use use, uint32_t index) {
+    return ((uint64_t)use << 32) | index;
+}
+
+//64 random bits for one (seed, stream, counter)
+static inline uint64_t ann_rng_u64(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint64_t state = ann_rng_mix(seed + stream * ANN_RNG_GOLDEN);
+    return ann_rng_mix(state + (counter + 1) * ANN_RNG_GOLDEN);
+}
+
+//Uniform double in [0, 1) with 53 random bits
+static inline double ann_rng_uniform(uint64_t seed, uint64_t stream, uint64_t counter) {
+    return (double)(ann_rng_u64(seed, stream, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//Uniform [0, 1) draw for the weight from input col to unit row of layer,
+//independent of how the layer is stored or split
+static inline double ann_rng_weight(uint64_t seed, int layer, int row, int col) {
+    return ann_rng_uniform(seed, ann_rng_stream(ANN_RNG_WEIGHTS, (uint32_t)layer),
+                           ((uint64_t)(uint32_t)row << 32) | (uint32_t)col);
+}
+
+#endif // ANN_RNG_H
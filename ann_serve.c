@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ann_serve.h"
+
+// Fills addr for path or port and returns its length, or 0 if path is too long
+static socklen_t serve_address(const char* path, int port, struct sockaddr_storage* addr) {
+    memset(addr, 0, sizeof(*addr));
+    if (port > 0) {
+        struct sockaddr_in* in = (struct sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sizeof(*in);
+    }
+    struct sockaddr_un* un = (struct sockaddr_un*)addr;
+    if (strlen(path) >= sizeof(un->sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, path);
+    return sizeof(*un);
+}
+
+static int open_socket(int port) {
+    int fd = socket(port > 0 ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && port > 0) {
+        // Requests and responses are small; do not let Nagle hold them back
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+int ann_serve_listen(const char* path, int port) {
+    struct sockaddr_storage addr;
+    socklen_t len = serve_address(path, port, &addr);
+    if (len == 0) {
+        return -1;
+    }
+    int fd = open_socket(port);
+    if (fd < 0) {
+        return -1;
+    }
+    if (port > 0) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    } else {
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr*)&addr, len) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int ann_serve_connect(const char* path, int port) {
+    struct sockaddr_storage addr;
+    socklen_t len = serve_address(path, port, &addr);
+    if (len == 0) {
+        return -1;
+    }
+    int fd = open_socket(port);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, len) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+int ann_serve_send_all(int fd, const void* buf, size_t len) {
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int ann_serve_recv_all(int fd, void* buf, size_t len) {
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
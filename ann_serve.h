@@ -0,0 +1,39 @@
+#ifndef ANN_SERVE_H
+#define ANN_SERVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire protocol of the inference server (ann_serve). The server only listens
+// locally, so every field is in host byte order.
+//
+//   request:  uint32 n_samples, uint32 n_features, then n_samples rows of
+//             n_features float32 pixels scaled to [0, 1]
+//   response: int32 n_samples, then one int32 label per sample; a lone -1
+//             means the request was rejected and the connection is closed
+//
+// A client may pipeline several requests on one connection; responses come
+// back in request order.
+
+#define ANN_SERVE_MAX_SAMPLES 1024
+#define ANN_SERVE_REJECTED (-1)
+
+typedef struct ann_serve_header {
+    uint32_t n_samples;
+    uint32_t n_features;
+} ann_serve_header;
+
+//Opens a listening socket: TCP on 127.0.0.1:port when port > 0, otherwise
+//the Unix domain socket at path (replacing a stale one). Returns the file
+//descriptor, or -1 with errno set.
+int ann_serve_listen(const char* path, int port);
+
+//Connects to a server addressed the same way; returns the file descriptor
+//or -1 with errno set
+int ann_serve_connect(const char* path, int port);
+
+//Blocking transfers that retry until len bytes are done; return 0 or -1
+int ann_serve_send_all(int fd, const void* buf, size_t len);
+int ann_serve_recv_all(int fd, void* buf, size_t len);
+
+#endif // ANN_SERVE_H
@@ -0,0 +1,254 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_sparse.h"
+
+#define GEMM_INPUTS 16   // inputs accumulated together in ann_sparse_gemm
+
+typedef struct ranked {
+    double magnitude;
+    int index;
+} ranked;
+
+static int compare_ranked(const void* a, const void* b) {
+    const ranked* x = (const ranked*)a;
+    const ranked* y = (const ranked*)b;
+    if (x->magnitude != y->magnitude) {
+        return x->magnitude < y->magnitude ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+int ann_prune_magnitude(double* w, int rows, int cols, int ld, double sparsity, unsigned char* keep) {
+    int n = rows * cols;
+    int n_pruned = (int)(sparsity * n);
+    ranked* order = (ranked*)malloc((n > 0 ? n : 1) * sizeof(ranked));
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            order[r * cols + c].magnitude = fabs(w[(size_t)r * ld + c]);
+            order[r * cols + c].index = r * cols + c;
+        }
+    }
+    qsort(order, n, sizeof(ranked), compare_ranked);
+    if (keep != NULL) {
+        memset(keep, 1, n);
+    }
+    for (int i = 0; i < n_pruned; i++) {
+        int r = order[i].index / cols, c = order[i].index % cols;
+        w[(size_t)r * ld + c] = 0;
+        if (keep != NULL) {
+            keep[order[i].index] = 0;
+        }
+    }
+    free(order);
+    return n_pruned;
+}
+
+int ann_prune_blocks(double* w, int rows, int cols, int ld, int block, double sparsity, unsigned char* keep) {
+    int block_rows = (rows + block - 1) / block;
+    int block_cols = (cols + block - 1) / block;
+    int n_tiles = block_rows * block_cols;
+    int n_pruned = (int)(sparsity * n_tiles);
+    ranked* order = (ranked*)malloc((n_tiles > 0 ? n_tiles : 1) * sizeof(ranked));
+    for (int t = 0; t < n_tiles; t++) {
+        int r0 = (t / block_cols) * block, c0 = (t % block_cols) * block;
+        int r1 = r0 + block < rows ? r0 + block : rows;
+        int c1 = c0 + block < cols ? c0 + block : cols;
+        double sum = 0;
+        for (int r = r0; r < r1; r++) {
+            for (int c = c0; c < c1; c++) {
+                sum += fabs(w[(size_t)r * ld + c]);
+            }
+        }
+        // Mean rather than sum, so partial tiles at the edges compete fairly
+        order[t].magnitude = sum / ((r1 - r0) * (c1 - c0));
+        order[t].index = t;
+    }
+    qsort(order, n_tiles, sizeof(ranked), compare_ranked);
+    if (keep != NULL) {
+        memset(keep, 1, (size_t)rows * cols);
+    }
+    int zeroed = 0;
+    for (int i = 0; i < n_pruned; i++) {
+        int t = order[i].index;
+        int r0 = (t / block_cols) * block, c0 = (t % block_cols) * block;
+        for (int r = r0; r < r0 + block && r < rows; r++) {
+            for (int c = c0; c < c0 + block && c < cols; c++) {
+                w[(size_t)r * ld + c] = 0;
+                if (keep != NULL) {
+                    keep[r * cols + c] = 0;
+                }
+                zeroed++;
+            }
+        }
+    }
+    free(order);
+    return zeroed;
+}
+
+void ann_prune_apply(double* w, int rows, int cols, int ld, const unsigned char* keep) {
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            if (!keep[r * cols + c]) {
+                w[(size_t)r * ld + c] = 0;
+            }
+        }
+    }
+}
+
+double ann_density(const double* w, int rows, int cols, int ld) {
+    long nonzero = 0;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            nonzero += w[(size_t)r * ld + c] != 0;
+        }
+    }
+    return rows * cols > 0 ? (double)nonzero / ((double)rows * cols) : 0;
+}
+
+static int tile_nonzero(const double* w, int rows, int cols, int ld, int r0, int c0, int block) {
+    for (int r = r0; r < r0 + block && r < rows; r++) {
+        for (int c = c0; c < c0 + block && c < cols; c++) {
+            if (w[(size_t)r * ld + c] != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int ann_nonzero_index(const double* x, int n, int* idx) {
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        idx[count] = k;
+        count += x[k] != 0;
+    }
+    return count;
+}
+
+void ann_sparse_from_dense(ann_sparse* s, const double* w, int rows, int cols, int ld, int block) {
+    s->format = block > 1 ? ANN_SPARSE_BSR : ANN_SPARSE_CSR;
+    s->rows = rows;
+    s->cols = cols;
+    s->block = block > 1 ? block : 1;
+    int b = s->block;
+    s->n_row_groups = (rows + b - 1) / b;
+    int block_cols = (cols + b - 1) / b;
+
+    // Count, then fill
+    int n_entries = 0;
+    for (int g = 0; g < s->n_row_groups; g++) {
+        for (int t = 0; t < block_cols; t++) {
+            n_entries += tile_nonzero(w, rows, cols, ld, g * b, t * b, b);
+        }
+    }
+    s->nnz = n_entries * b * b;
+    s->row_ptr = (int*)malloc((s->n_row_groups + 1) * sizeof(int));
+    s->col_idx = (int*)malloc((n_entries > 0 ? n_entries : 1) * sizeof(int));
+    s->val = (double*)calloc(s->nnz > 0 ? s->nnz : 1, sizeof(double));
+
+    int e = 0;
+    for (int g = 0; g < s->n_row_groups; g++) {
+        s->row_ptr[g] = e;
+        for (int t = 0; t < block_cols; t++) {
+            int r0 = g * b, c0 = t * b;
+            if (!tile_nonzero(w, rows, cols, ld, r0, c0, b)) {
+                continue;
+            }
+            double* tile = s->val + (size_t)e * b * b;
+            for (int r = r0; r < r0 + b && r < rows; r++) {
+                for (int c = c0; c < c0 + b && c < cols; c++) {
+                    tile[(r - r0) * b + (c - c0)] = w[(size_t)r * ld + c];
+                }
+            }
+            s->col_idx[e++] = c0;
+        }
+    }
+    s->row_ptr[s->n_row_groups] = e;
+}
+
+ann_sparse* ann_sparse_copy(const ann_sparse* s) {
+    ann_sparse* copy = (ann_sparse*)malloc(sizeof(ann_sparse));
+    *copy = *s;
+    int n_entries = s->row_ptr[s->n_row_groups];
+    copy->row_ptr = (int*)malloc((s->n_row_groups + 1) * sizeof(int));
+    copy->col_idx = (int*)malloc((n_entries > 0 ? n_entries : 1) * sizeof(int));
+    copy->val = (double*)malloc((s->nnz > 0 ? s->nnz : 1) * sizeof(double));
+    memcpy(copy->row_ptr, s->row_ptr, (s->n_row_groups + 1) * sizeof(int));
+    memcpy(copy->col_idx, s->col_idx, n_entries * sizeof(int));
+    memcpy(copy->val, s->val, s->nnz * sizeof(double));
+    return copy;
+}
+
+void ann_sparse_free(ann_sparse* s) {
+    free(s->row_ptr);
+    free(s->col_idx);
+    free(s->val);
+    free(s);
+}
+
+void ann_sparse_gemv(const ann_sparse* s, const double* x, double* y) {
+    if (s->format == ANN_SPARSE_CSR) {
+        for (int r = 0; r < s->rows; r++) {
+            double sum = 0;
+            for (int e = s->row_ptr[r]; e < s->row_ptr[r + 1]; e++) {
+                sum += s->val[e] * x[s->col_idx[e]];
+            }
+            y[r] = sum;
+        }
+        return;
+    }
+    int b = s->block;
+    for (int g = 0; g < s->n_row_groups; g++) {
+        int r0 = g * b;
+        int height = r0 + b <= s->rows ? b : s->rows - r0;
+        double sum[b];
+        memset(sum, 0, sizeof(sum));
+        for (int e = s->row_ptr[g]; e < s->row_ptr[g + 1]; e++) {
+            int c0 = s->col_idx[e];
+            int width = c0 + b <= s->cols ? b : s->cols - c0;
+            const double* tile = s->val + (size_t)e * b * b;
+            for (int rr = 0; rr < height; rr++) {
+                for (int cc = 0; cc < width; cc++) {
+                    sum[rr] += tile[rr * b + cc] * x[c0 + cc];
+                }
+            }
+        }
+        for (int rr = 0; rr < height; rr++) {
+            y[r0 + rr] = sum[rr];
+        }
+    }
+}
+
+void ann_sparse_gemm(const ann_sparse* s, const double* const* x, int n, double* y, int ldy) {
+    int b = s->block;
+    for (int i0 = 0; i0 < n; i0 += GEMM_INPUTS) {
+        int m = n - i0 < GEMM_INPUTS ? n - i0 : GEMM_INPUTS;
+        const double* const* xs = x + i0;
+        for (int g = 0; g < s->n_row_groups; g++) {
+            int r0 = g * b;
+            int height = r0 + b <= s->rows ? b : s->rows - r0;
+            double sum[b][GEMM_INPUTS];
+            memset(sum, 0, sizeof(sum));
+            for (int e = s->row_ptr[g]; e < s->row_ptr[g + 1]; e++) {
+                int c0 = s->col_idx[e];
+                int width = c0 + b <= s->cols ? b : s->cols - c0;
+                const double* tile = s->val + (size_t)e * b * b;
+                for (int rr = 0; rr < height; rr++) {
+                    for (int cc = 0; cc < width; cc++) {
+                        double v = tile[rr * b + cc];
+                        for (int i = 0; i < m; i++) {
+                            sum[rr][i] += v * xs[i][c0 + cc];
+                        }
+                    }
+                }
+            }
+            for (int rr = 0; rr < height; rr++) {
+                for (int i = 0; i < m; i++) {
+                    y[(size_t)(i0 + i) * ldy + r0 + rr] = sum[rr][i];
+                }
+            }
+        }
+    }
+}
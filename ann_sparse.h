@@ -0,0 +1,60 @@
+#ifndef ANN_SPARSE_H
+#define ANN_SPARSE_H
+
+// Magnitude pruning and sparse inference kernels for one weight layer.
+//
+// A layer is a rows x cols matrix of doubles with leading dimension ld (the
+// distance between rows), as in every network header. Pruning zeroes the
+// smallest weights in place and records which ones survive. A pruned layer
+// can then be stored as CSR, one entry per kept weight, or as BSR, whole
+// block x block tiles, so the kernels skip the pruned weights.
+
+typedef enum ann_sparse_format {
+    ANN_SPARSE_CSR,
+    ANN_SPARSE_BSR,
+} ann_sparse_format;
+
+typedef struct ann_sparse {
+    ann_sparse_format format;
+    int rows, cols;
+    int block;            // tile edge for BSR, 1 for CSR
+    int n_row_groups;     // rows (CSR) or block rows (BSR)
+    int nnz;              // stored values; padding inside tiles included
+    int* row_ptr;         // n_row_groups + 1 offsets into col_idx
+    int* col_idx;         // column (CSR) or first column of the tile (BSR)
+    double* val;          // values; BSR tiles are block x block, row-major
+} ann_sparse;
+
+//Zeroes the smallest fraction sparsity of the weights by magnitude. Marks the
+//survivors in keep (rows x cols, row-major), which may be NULL. Returns the
+//number of weights zeroed.
+int ann_prune_magnitude(double* w, int rows, int cols, int ld, double sparsity, unsigned char* keep);
+
+//Structured variant: zeroes whole block x block tiles with the smallest mean
+//magnitude, so the result suits ANN_SPARSE_BSR
+int ann_prune_blocks(double* w, int rows, int cols, int ld, int block, double sparsity, unsigned char* keep);
+
+//Zeroes the weights keep marks as pruned, e.g. after a fine-tuning step
+void ann_prune_apply(double* w, int rows, int cols, int ld, const unsigned char* keep);
+
+//Fraction of nonzero weights
+double ann_density(const double* w, int rows, int cols, int ld);
+
+//Writes the positions of the nonzero entries of x to idx and returns how
+//many there are. Pixel inputs are mostly zero, so the first layer can work
+//on this list instead of the whole input.
+int ann_nonzero_index(const double* x, int n, int* idx);
+
+//Builds a CSR (block == 1) or BSR copy of the nonzero weights
+void ann_sparse_from_dense(ann_sparse* s, const double* w, int rows, int cols, int ld, int block);
+ann_sparse* ann_sparse_copy(const ann_sparse* s);
+void ann_sparse_free(ann_sparse* s);
+
+//y = W x, with y of length rows
+void ann_sparse_gemv(const ann_sparse* s, const double* x, double* y);
+
+//y[i * ldy + r] = (W x[i])[r] for n inputs; each stored value is loaded once
+//and applied to all n inputs
+void ann_sparse_gemm(const ann_sparse* s, const double* const* x, int n, double* y, int ldy);
+
+#endif // ANN_SPARSE_H
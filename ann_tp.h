@@ -0,0 +1,230 @@
+#ifndef ANN_TP_H
+#define ANN_TP_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "ann_prof.h"
+#include "ann_rng.h"
+
+// Model-parallel (tensor-sliced) network. The neurons of every layer, i.e.
+// the rows of each weight matrix and the matching biases, are split across
+// the ranks of a communicator, so layer widths are limited only by the
+// combined memory of the ranks. Every rank processes every sample:
+//
+//   forward   each rank computes its slice of a layer, and MPI_Allgatherv
+//             rebuilds the full activation vector for the next layer
+//   backward  each rank forms the partial back-propagated sums of its rows,
+//             and MPI_Reduce_scatter hands every rank the sums for the
+//             neurons it owns in the layer below
+//   update    purely local: a rank updates only the rows it owns
+
+typedef struct tp_network {
+    int n_layers;
+    int* dim;           // full layer widths
+    int** counts;       // counts[i][r]: rows of layer i owned by rank r
+    int** displs;       // displs[i][r]: first row of layer i owned by rank r
+    double** weights;   // weights[i-1]: this rank's rows of layer i, counts[i][rank] x dim[i-1]
+    double** biases;    // biases[i]: this rank's slice of layer i
+    double** output;    // output[i]: full activations of layer i
+    double** d;         // d[i]: deltas of this rank's slice of layer i
+    double* partial;    // back-propagated sums before the reduce-scatter
+    MPI_Comm comm;
+    int rank, size;
+} tp_network;
+
+//Function prototypes
+void tp_init_ann(tp_network*, int dim[], int n_layers, uint64_t seed, MPI_Comm comm);
+void tp_feed_forward(tp_network*, const double* input);
+void tp_backward(tp_network*, double label);
+void tp_update_weights(tp_network*, double learning_rate);
+void tp_train(tp_network*, double** data, int length, double learning_rate);
+int tp_predict(tp_network*, const double* input);
+void tp_free_ann(tp_network*);
+
+
+void tp_init_ann(tp_network* ann, int dim[], int n_layers, uint64_t seed, MPI_Comm comm) {
+    ann->comm = comm;
+    MPI_Comm_rank(comm, &ann->rank);
+    MPI_Comm_size(comm, &ann->size);
+    ann->n_layers = n_layers;
+    ann->dim = (int*)malloc(n_layers * sizeof(int));
+    ann->counts = (int**)malloc(n_layers * sizeof(int*));
+    ann->displs = (int**)malloc(n_layers * sizeof(int*));
+    ann->weights = (double**)malloc((n_layers - 1) * sizeof(double*));
+    ann->biases = (double**)malloc(n_layers * sizeof(double*));
+    ann->output = (double**)malloc(n_layers * sizeof(double*));
+    ann->d = (double**)malloc(n_layers * sizeof(double*));
+
+    int widest = 0;
+    for (int i = 0; i < n_layers; i++) {
+        ann->dim[i] = dim[i];
+        widest = dim[i] > widest ? dim[i] : widest;
+        ann->counts[i] = (int*)malloc(ann->size * sizeof(int));
+        ann->displs[i] = (int*)malloc(ann->size * sizeof(int));
+        for (int r = 0; r < ann->size; r++) {
+            ann->counts[i][r] = dim[i] / ann->size + (r < dim[i] % ann->size);
+            ann->displs[i][r] = (r == 0) ? 0 : ann->displs[i][r - 1] + ann->counts[i][r - 1];
+        }
+        int rows = ann->counts[i][ann->rank];
+        int first = ann->displs[i][ann->rank];
+        ann->output[i] = (double*)calloc(dim[i], sizeof(double));
+        ann->d[i] = (double*)calloc(rows > 0 ? rows : 1, sizeof(double));
+        ann->biases[i] = (double*)malloc((rows > 0 ? rows : 1) * sizeof(double));
+        for (int j = 0; j < rows; j++) {
+            ann->biases[i][j] = (i == 0) ? 0 : 1;
+        }
+        if (i > 0) {
+            double scale = 1 / sqrt(dim[i - 1] + dim[i]);
+            ann->weights[i - 1] = (double*)malloc(((size_t)rows * dim[i - 1] > 0 ? (size_t)rows * dim[i - 1] : 1) * sizeof(double));
+            if (ann->weights[i - 1] == NULL) {
+                printf("Unable to allocate %d x %d weight slice\n", rows, dim[i - 1]);
+                MPI_Abort(comm, 1);
+            }
+            for (int j = 0; j < rows; j++) {
+                for (int k = 0; k < dim[i - 1]; k++) {
+                    ann->weights[i - 1][(size_t)j * dim[i - 1] + k] = ann_rng_weight(seed, i, first + j, k) * scale;
+                }
+            }
+        }
+    }
+    ann->partial = (double*)malloc(widest * sizeof(double));
+}
+
+void tp_feed_forward(tp_network* ann, const double* input) {
+    memcpy(ann->output[0], input, ann->dim[0] * sizeof(double));
+    for (int i = 1; i < ann->n_layers; i++) {
+        double t0 = ann_prof_begin();
+        int rows = ann->counts[i][ann->rank];
+        int cols = ann->dim[i - 1];
+        const double* in = ann->output[i - 1];
+        double* out = ann->output[i] + ann->displs[i][ann->rank];
+        for (int j = 0; j < rows; j++) {
+            const double* w = ann->weights[i - 1] + (size_t)j * cols;
+            double f_sum = ann->biases[i][j];
+            for (int k = 0; k < cols; k++) {
+                f_sum += w[k] * in[k];
+            }
+            out[j] = 1 / (1 + exp(-f_sum));
+        }
+        ann_prof_end(ANN_PHASE_FORWARD, t0, 2.0 * rows * cols);
+
+        t0 = ann_prof_begin();
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, ann->output[i], ann->counts[i], ann->displs[i], MPI_DOUBLE, ann->comm);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    }
+}
+
+//Deltas of every layer above the input for this rank's neurons; the input
+//layer has no weights below it, so its deltas are never needed
+void tp_backward(tp_network* ann, double label) {
+    double t0 = ann_prof_begin();
+    int last = ann->n_layers - 1;
+    int rows = ann->counts[last][ann->rank];
+    int first = ann->displs[last][ann->rank];
+    for (int j = 0; j < rows; j++) {
+        double expected_value = (ann->dim[last] == 1) ? label : ((first + j) == label ? 1 : 0);
+        double observed_value = ann->output[last][first + j];
+        ann->d[last][j] = observed_value * (1 - observed_value) * (observed_value - expected_value);
+    }
+    ann_prof_end(ANN_PHASE_BACKWARD, t0, 4.0 * rows);
+
+    for (int i = last - 1; i >= 1; i--) {
+        t0 = ann_prof_begin();
+        int upper_rows = ann->counts[i + 1][ann->rank];
+        int cols = ann->dim[i];
+        memset(ann->partial, 0, cols * sizeof(double));
+        for (int k = 0; k < upper_rows; k++) {
+            const double* w = ann->weights[i] + (size_t)k * cols;
+            double dk = ann->d[i + 1][k];
+            for (int j = 0; j < cols; j++) {
+                ann->partial[j] += dk * w[j];
+            }
+        }
+        ann_prof_end(ANN_PHASE_BACKWARD, t0, 2.0 * upper_rows * cols);
+
+        t0 = ann_prof_begin();
+        MPI_Reduce_scatter(MPI_IN_PLACE, ann->partial, ann->counts[i], MPI_DOUBLE, MPI_SUM, ann->comm);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+
+        t0 = ann_prof_begin();
+        int rows_i = ann->counts[i][ann->rank];
+        const double* out = ann->output[i] + ann->displs[i][ann->rank];
+        for (int j = 0; j < rows_i; j++) {
+            ann->d[i][j] = out[j] * (1 - out[j]) * ann->partial[j];
+        }
+        ann_prof_end(ANN_PHASE_BACKWARD, t0, 3.0 * rows_i);
+    }
+}
+
+void tp_update_weights(tp_network* ann, double learning_rate) {
+    double t0 = ann_prof_begin();
+    double flops = 0;
+    for (int i = 1; i < ann->n_layers; i++) {
+        int rows = ann->counts[i][ann->rank];
+        int cols = ann->dim[i - 1];
+        const double* in = ann->output[i - 1];
+        for (int j = 0; j < rows; j++) {
+            double* w = ann->weights[i - 1] + (size_t)j * cols;
+            double step = learning_rate * ann->d[i][j];
+            for (int k = 0; k < cols; k++) {
+                w[k] -= step * in[k];
+            }
+            ann->biases[i][j] -= step;
+        }
+        flops += 2.0 * rows * cols;
+    }
+    ann_prof_end(ANN_PHASE_UPDATE, t0, flops);
+}
+
+void tp_train(tp_network* ann, double** data, int length, double learning_rate) {
+    for (int t = 0; t < length; t++) {
+        tp_feed_forward(ann, data[t]);
+        tp_backward(ann, data[t][ann->dim[0]]);
+        tp_update_weights(ann, learning_rate);
+    }
+    ann_prof_samples(length);
+}
+
+int tp_predict(tp_network* ann, const double* input) {
+    tp_feed_forward(ann, input);
+    ann_prof_samples(1);
+    const double* out = ann->output[ann->n_layers - 1];
+    if (ann->dim[ann->n_layers - 1] == 1) {
+        return out[0] >= 0.5;
+    }
+    int maxval = 0;
+    for (int i = 1; i < ann->dim[ann->n_layers - 1]; i++) {
+        if (out[i] > out[maxval]) {
+            maxval = i;
+        }
+    }
+    return maxval;
+}
+
+void tp_free_ann(tp_network* ann) {
+    for (int i = 0; i < ann->n_layers; i++) {
+        if (i > 0) {
+            free(ann->weights[i - 1]);
+        }
+        free(ann->biases[i]);
+        free(ann->output[i]);
+        free(ann->d[i]);
+        free(ann->counts[i]);
+        free(ann->displs[i]);
+    }
+    free(ann->weights);
+    free(ann->biases);
+    free(ann->output);
+    free(ann->d);
+    free(ann->counts);
+    free(ann->displs);
+    free(ann->partial);
+    free(ann->dim);
+}
+
+#endif // ANN_TP_H
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ann_tune.h"
+
+ann_tuning ann_tune = { 0, 1000, 256, 16 };
+
+void ann_tune_defaults(ann_tuning* t) {
+    t->threads = 0;
+    t->par_threshold = 1000;
+    t->eval_batch = 256;
+    t->sparse_tile = 16;
+}
+
+int ann_tune_host_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// First "model name" of /proc/cpuinfo, or "unknown"
+static void cpu_model(char* buf, size_t size) {
+    snprintf(buf, size, "unknown");
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char* colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+            colon += strspn(colon + 1, " \t") + 1;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(buf, size, "%s", colon);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+int ann_tune_load(const char* path, ann_tuning* t) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    ann_tuning loaded = *t;
+    int cpus = 0, bad = 0;
+    char line[512], key[64];
+    while (fgets(line, sizeof(line), f)) {
+        long value;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (sscanf(line, "%63s %ld", key, &value) != 2 || value < 0) {
+            if (strncmp(line, "cpu_model", 9) != 0) {
+                bad = 1;
+            }
+            continue;
+        }
+        if (strcmp(key, "cpus") == 0) {
+            cpus = (int)value;
+        } else if (strcmp(key, "threads") == 0) {
+            loaded.threads = (int)value;
+        } else if (strcmp(key, "par_threshold") == 0) {
+            loaded.par_threshold = (int)value;
+        } else if (strcmp(key, "eval_batch") == 0 && value > 0) {
+            loaded.eval_batch = (int)value;
+        } else if (strcmp(key, "sparse_tile") == 0 && value > 0) {
+            loaded.sparse_tile = (int)value;
+        } else if (strcmp(key, "cpu_model") != 0) {
+            bad = 1;
+        }
+    }
+    fclose(f);
+    if (bad) {
+        return -1;
+    }
+    if (cpus != ann_tune_host_cpus()) {
+        return -2;
+    }
+    *t = loaded;
+    return 0;
+}
+
+int ann_tune_save(const char* path, const ann_tuning* t) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    char model[256];
+    cpu_model(model, sizeof(model));
+    fprintf(f, "# ann_openmp1 tuning profile, written by --autotune\n");
+    fprintf(f, "cpus %d\n", ann_tune_host_cpus());
+    fprintf(f, "cpu_model %s\n", model);
+    fprintf(f, "threads %d\n", t->threads);
+    fprintf(f, "par_threshold %d\n", t->par_threshold);
+    fprintf(f, "eval_batch %d\n", t->eval_batch);
+    fprintf(f, "sparse_tile %d\n", t->sparse_tile);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+void ann_tune_configure(const char* path) {
+    if (path == NULL || strcmp(path, "none") == 0 || access(path, F_OK) != 0) {
+        return;
+    }
+    int status = ann_tune_load(path, &ann_tune);
+    if (status == 0) {
+        printf("Tuning profile %s: %d thread(s), threshold %d, eval batch %d, sparse tile %d\n", path,
+               ann_tune.threads, ann_tune.par_threshold, ann_tune.eval_batch, ann_tune.sparse_tile);
+    } else if (status == -2) {
+        printf("Tuning profile %s was made on a host with a different CPU count; using defaults\n", path);
+    } else {
+        printf("Unable to read tuning profile %s; using defaults\n", path);
+    }
+}
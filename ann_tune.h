@@ -0,0 +1,46 @@
+#ifndef ANN_TUNE_H
+#define ANN_TUNE_H
+
+// Host-specific settings of the ann_openmp1.h kernels. The defaults are the
+// constants the kernels used to hard-code; `ann_openmp1 --autotune` times
+// candidates on the running host and saves the fastest to a profile file,
+// which the drivers built on ann_openmp1.h load at startup. The threshold,
+// batch and tile only change how the arithmetic is split over threads, never
+// its result. The thread count changes results only where it already did:
+// ann_openmp1 trains each chunk with one slice of rows per thread.
+//
+// The profile is plain text, one "key value" pair per line; '#' starts a
+// comment. It records the host's logical CPU count, and a profile tuned for
+// a different count is not applied.
+
+#define ANN_TUNE_PROFILE "ann_tune.profile"
+
+typedef struct ann_tuning {
+    int threads;          // OpenMP threads, 0 for one per logical CPU
+    int par_threshold;    // multiply-adds below which a kernel stays serial
+    int eval_batch;       // rows per forward_batch call in evaluate
+    int sparse_tile;      // samples per task in the sparse batched forward pass
+} ann_tuning;
+
+//Settings in effect; starts at the built-in defaults
+extern ann_tuning ann_tune;
+
+//The built-in defaults
+void ann_tune_defaults(ann_tuning* t);
+
+//Reads a profile into t. Returns 0 on success, -1 if the file cannot be read
+//or is malformed and -2 if it was tuned for a different CPU count; t is only
+//changed on success.
+int ann_tune_load(const char* path, ann_tuning* t);
+
+//Writes t with this host's CPU count and model; returns 0 on success
+int ann_tune_save(const char* path, const ann_tuning* t);
+
+//Loads path into ann_tune if the file exists and reports what happened.
+//"none" or NULL skips the profile.
+void ann_tune_configure(const char* path);
+
+//Logical CPUs of this host
+int ann_tune_host_cpus(void);
+
+#endif // ANN_TUNE_H
@@ -0,0 +1,136 @@
+// Synthetic MNIST-shaped CSV generator.
+//
+// Each class gets a few fixed pen strokes on a 28x28 canvas; every row draws
+// its class's strokes with a random shift and intensity jitter, so rows look
+// like MNIST (blank border, ~80% zero pixels, values 0..255) and a network
+// can actually learn the labels.
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIDE 28
+#define PIXELS (SIDE * SIDE)
+#define CLASSES 10
+#define STROKES 4
+
+typedef struct stroke {
+    double x0, y0, x1, y1;
+} stroke;
+
+static uint64_t rng_state;
+
+static uint64_t next_u64(void) {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double uniform(double lo, double hi) {
+    return lo + (hi - lo) * (double)(next_u64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double segment_distance(double px, double py, const stroke* s) {
+    double dx = s->x1 - s->x0;
+    double dy = s->y1 - s->y0;
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? ((px - s->x0) * dx + (py - s->y0) * dy) / len2 : 0;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    double cx = s->x0 + t * dx - px;
+    double cy = s->y0 + t * dy - py;
+    return sqrt(cx * cx + cy * cy);
+}
+
+static void draw_row(const stroke strokes[STROKES], int pixels[PIXELS]) {
+    double shift_x = uniform(-2, 2);
+    double shift_y = uniform(-2, 2);
+    double width = uniform(1.6, 2.4);
+    memset(pixels, 0, PIXELS * sizeof(int));
+    for (int s = 0; s < STROKES; s++) {
+        stroke st = strokes[s];
+        st.x0 += shift_x; st.x1 += shift_x;
+        st.y0 += shift_y; st.y1 += shift_y;
+        for (int y = 0; y < SIDE; y++) {
+            for (int x = 0; x < SIDE; x++) {
+                double dist = segment_distance(x, y, &st);
+                if (dist < width) {
+                    int v = (int)(255 * (1 - dist / width) * uniform(0.7, 1.0) + 0.5);
+                    if (v > pixels[y * SIDE + x]) {
+                        pixels[y * SIDE + x] = v;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s --rows N [--seed S] [--no-label] FILE\n", program);
+    printf("Writes N MNIST-shaped rows (label,pixel0..pixel783) to FILE.\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    long rows = -1;
+    uint64_t seed = 42;
+    int with_label = 1;
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+            rows = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-label") == 0) {
+            with_label = 0;
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (rows < 0 || path == NULL) {
+        usage(argv[0]);
+    }
+
+    // Class shapes depend only on a fixed stream so train and test files
+    // generated with different seeds still share the same classes
+    stroke strokes[CLASSES][STROKES];
+    rng_state = 0x5EED;
+    for (int c = 0; c < CLASSES; c++) {
+        for (int s = 0; s < STROKES; s++) {
+            strokes[c][s] = (stroke){ uniform(6, 21), uniform(6, 21), uniform(6, 21), uniform(6, 21) };
+        }
+    }
+    rng_state = seed;
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Unable to open file %s\n", path);
+        return 1;
+    }
+    static char line[8 * PIXELS];
+    int pixels[PIXELS];
+    if (with_label) {
+        fprintf(out, "label,");
+    }
+    for (int i = 0; i < PIXELS; i++) {
+        fprintf(out, "pixel%d%c", i, i == PIXELS - 1 ? '\n' : ',');
+    }
+    for (long r = 0; r < rows; r++) {
+        int label = (int)(next_u64() % CLASSES);
+        draw_row(strokes[label], pixels);
+        int len = 0;
+        if (with_label) {
+            len += sprintf(line + len, "%d,", label);
+        }
+        for (int i = 0; i < PIXELS; i++) {
+            len += sprintf(line + len, "%d%c", pixels[i], i == PIXELS - 1 ? '\n' : ',');
+        }
+        fwrite(line, 1, len, out);
+    }
+    fclose(out);
+    return 0;
+}
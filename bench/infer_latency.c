@@ -0,0 +1,213 @@
+// Per-call latency of single-sample inference.
+//
+// Times predict() from ann_openmp1.h and ann_infer_predict() from
+// ann_infer.h one sample at a time on the same inputs, after pinning the
+// calling thread to one CPU, and prints latency percentiles in nanoseconds.
+// The two paths must agree on every label. With --csv the percentiles are
+// appended as one row per path.
+#define _GNU_SOURCE  // sched_setaffinity, sched_getcpu
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ann_csv.h"
+#include "ann_infer.h"
+#include "ann_openmp1.h"
+
+#define N_PIXELS 784
+
+static void usage(const char* program) {
+    printf("Usage: %s [--model FILE | --hidden N] [--test FILE] [--calls N]\n"
+           "          [--cpu N] [--csv FILE]\n", program);
+    exit(1);
+}
+
+static long long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compare_ll(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Rows of the file without labels, or random sparse pixels when path is NULL
+static double** read_rows(const char* path, int* n_rows) {
+    if (path == NULL) {
+        int n = 1000;
+        double** rows = init_2Darray(n, MAX_SIZE);
+        srand(1);
+        for (int s = 0; s < n; s++) {
+            for (int k = 0; k < N_PIXELS; k++) {
+                rows[s][k] = (rand() % 5 == 0) ? (double)(rand() % 256) / 255.0 : 0;
+            }
+        }
+        *n_rows = n;
+        return rows;
+    }
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Unable to open file %s\n", path);
+        exit(1);
+    }
+    static char line[16000];
+    int cap = 1024, n = 0;
+    double** rows = init_2Darray(cap, MAX_SIZE);
+    fgets(line, sizeof(line), f);  // skip header
+    while (fgets(line, sizeof(line), f)) {
+        if (n == cap) {
+            double** grown = init_2Darray(2 * cap, MAX_SIZE);
+            memcpy(grown[0], rows[0], (size_t)cap * MAX_SIZE * sizeof(double));
+            free_2Darray(rows);
+            rows = grown;
+            cap *= 2;
+        }
+        parse_csv_row(line, rows[n++], N_PIXELS, 0);
+    }
+    fclose(f);
+    *n_rows = n;
+    return rows;
+}
+
+static void report(FILE* csv, const char* path, long long* ns, int n) {
+    qsort(ns, n, sizeof(long long), compare_ll);
+    double mean = 0;
+    for (int i = 0; i < n; i++) {
+        mean += ns[i];
+    }
+    mean /= n;
+    printf("%-8s p50 %6lld  p90 %6lld  p99 %6lld  p99.9 %6lld  max %7lld  mean %8.1f ns\n", path,
+           ns[n / 2], ns[(int)(n * 0.9)], ns[(int)(n * 0.99)], ns[(int)(n * 0.999)], ns[n - 1], mean);
+    if (csv != NULL) {
+        fprintf(csv, "%s,%d,%lld,%lld,%lld,%lld,%lld,%.1f\n", path, n,
+                ns[n / 2], ns[(int)(n * 0.9)], ns[(int)(n * 0.99)], ns[(int)(n * 0.999)], ns[n - 1], mean);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* model_file = NULL;
+    const char* test_file = NULL;
+    const char* csv_path = NULL;
+    int hidden = 32;
+    int calls = 100000;
+    int cpu = -1;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--model") == 0) {
+            model_file = argv[++i];
+        } else if (strcmp(argv[i], "--hidden") == 0) {
+            hidden = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--test") == 0) {
+            test_file = argv[++i];
+        } else if (strcmp(argv[i], "--calls") == 0) {
+            calls = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv_path = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (calls < 1 || hidden < 1 || hidden > MAX_SIZE - 1) {
+        usage(argv[0]);
+    }
+
+    // Pin before anything is allocated so the pages land on this CPU's node
+    if (cpu < 0) {
+        cpu = sched_getcpu() >= 0 ? sched_getcpu() : 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Unable to pin to the CPU");
+        return 1;
+    }
+
+    network* ann;
+    if (model_file != NULL) {
+        ann = load_ann(model_file);
+        if (ann == NULL) {
+            printf("Unable to load model %s\n", model_file);
+            return 1;
+        }
+    } else {
+        ann = (network*)malloc(sizeof(network));
+        int dim[3] = { N_PIXELS, hidden, 10 };
+        init_ann(ann, dim, 3, 1);
+    }
+    ann_infer inf;
+    if (init_infer(&inf, ann) != 0) {
+        printf("Unable to allocate the inference workspace\n");
+        return 1;
+    }
+
+    int n_rows;
+    double** rows = read_rows(test_file, &n_rows);
+    if (n_rows == 0) {
+        printf("No rows in %s\n", test_file);
+        return 1;
+    }
+    long long* ns = (long long*)malloc(calls * sizeof(long long));
+    int* labels = (int*)malloc(n_rows * sizeof(int));
+
+    FILE* csv = NULL;
+    if (csv_path != NULL) {
+        FILE* probe = fopen(csv_path, "r");
+        int exists = (probe != NULL);
+        if (probe) {
+            fclose(probe);
+        }
+        if ((csv = fopen(csv_path, "a")) == NULL) {
+            printf("Unable to open file %s\n", csv_path);
+            return 1;
+        }
+        if (!exists) {
+            fprintf(csv, "path,calls,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns\n");
+        }
+    }
+    printf("%d call(s) on CPU %d, %d distinct row(s), %d OpenMP thread(s) for predict\n",
+           calls, cpu, n_rows, omp_get_max_threads());
+
+    // One pass over the rows first warms the caches and the branch predictors
+    for (int s = 0; s < n_rows; s++) {
+        labels[s] = predict(ann, rows[s]);
+    }
+    for (int c = 0; c < calls; c++) {
+        long long t0 = now_ns();
+        predict(ann, rows[c % n_rows]);
+        ns[c] = now_ns() - t0;
+    }
+    report(csv, "predict", ns, calls);
+
+    int mismatched = 0;
+    for (int s = 0; s < n_rows; s++) {
+        mismatched += ann_infer_predict(&inf, rows[s]) != labels[s];
+    }
+    for (int c = 0; c < calls; c++) {
+        long long t0 = now_ns();
+        ann_infer_predict(&inf, rows[c % n_rows]);
+        ns[c] = now_ns() - t0;
+    }
+    report(csv, "infer", ns, calls);
+
+    if (csv != NULL) {
+        fclose(csv);
+    }
+    if (mismatched) {
+        printf("%d of %d label(s) differ between predict and ann_infer_predict\n", mismatched, n_rows);
+    }
+    ann_infer_free(&inf);
+    free_ann(ann);
+    free_2Darray(rows);
+    free(ns);
+    free(labels);
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+// Microbenchmarks for the hot kernels of one network variant.
+//
+// Built once per header (bench_micro_mpi, bench_micro_openmp,
+// bench_micro_openmp1) so the variants can be compared kernel by kernel on
+// the same host. Results are appended to a CSV file.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ann_csv.h"
+#include "ann_prof.h"
+
+#if defined(ANN_BENCH_MPI)
+#include "ann_mpi.h"
+#define VARIANT "mpi"
+#elif defined(ANN_BENCH_OPENMP)
+#include "ann_openmp.h"
+#define VARIANT "openmp"
+#elif defined(ANN_BENCH_OPENMP1)
+#include "ann_openmp1.h"
+#define VARIANT "openmp1"
+#else
+#error "define one of ANN_BENCH_MPI, ANN_BENCH_OPENMP or ANN_BENCH_OPENMP1"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define PARSE_LINES 256
+
+static double output[LAYER_SIZE][MAX_SIZE];
+static double d[LAYER_SIZE][MAX_SIZE];
+
+typedef struct bench_ctx {
+    network* ann;
+    double* sample;
+    char** lines;
+    long parse_bytes;
+} bench_ctx;
+
+static void run_forward(bench_ctx* c) {
+    arrayCopy(output[0], c->sample, c->ann->dim[0]);
+    feed_forward(c->ann, output);
+}
+
+static void run_deltas(bench_ctx* c) {
+    compute_deltas(c->ann, output, d, c->sample[c->ann->dim[0]]);
+}
+
+static void run_update(bench_ctx* c) {
+    // A tiny rate keeps the weights stable over millions of repetitions
+    update_weights(c->ann, output, d, 1e-12);
+}
+
+static void run_backward_update(bench_ctx* c) {
+    backward_update(c->ann, output, d, c->sample[c->ann->dim[0]], 1e-12);
+}
+
+static void run_train_sample(bench_ctx* c) {
+    run_forward(c);
+    run_backward_update(c);
+}
+
+static void run_parse(bench_ctx* c) {
+    for (int i = 0; i < PARSE_LINES; i++) {
+        parse_csv_row(c->lines[i], output[0], c->ann->dim[0], 1);
+    }
+}
+
+// Repeats fn until min_time has elapsed and returns seconds per call
+static double time_kernel(void (*fn)(bench_ctx*), bench_ctx* c, double min_time, long* iterations) {
+    fn(c);  // warm up caches and page in the weights
+    long n = 1;
+    for (;;) {
+        double t0 = ann_wall_time();
+        for (long i = 0; i < n; i++) {
+            fn(c);
+        }
+        double elapsed = ann_wall_time() - t0;
+        if (elapsed >= min_time) {
+            *iterations = n;
+            return elapsed / n;
+        }
+        n = (elapsed > 0 && elapsed * 8 < min_time) ? n * 8 : n * 2;
+    }
+}
+
+static int parse_list(const char* text, int* values, int max) {
+    int n = 0;
+    const char* p = text;
+    while (*p && n < max) {
+        values[n++] = (int)strtol(p, (char**)&p, 10);
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return n;
+}
+
+static void usage(const char* program) {
+    printf("Usage: %s [--dims 784,32,10] [--threads 1,2,4] [--min-time SECONDS] [--csv FILE]\n", program);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    int dim[LAYER_SIZE] = { 784, 32, 10 };
+    int n_layers = 3;
+    int threads[64] = { 0 };
+    int n_threads = 1;
+    double min_time = 0.2;
+    const char* csv_path = NULL;
+#ifdef _OPENMP
+    threads[0] = omp_get_max_threads();
+#else
+    threads[0] = 1;
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--dims") == 0) {
+            n_layers = parse_list(argv[++i], dim, LAYER_SIZE);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            n_threads = parse_list(argv[++i], threads, 64);
+        } else if (strcmp(argv[i], "--min-time") == 0) {
+            min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            csv_path = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (n_layers < 2) {
+        usage(argv[0]);
+    }
+    for (int i = 0; i < n_layers; i++) {
+        if (dim[i] < 1 || dim[i] > MAX_SIZE - 1) {
+            printf("Layer widths must be between 1 and %d\n", MAX_SIZE - 1);
+            return 1;
+        }
+    }
+
+    bench_ctx c;
+    c.ann = (network*)malloc(sizeof(network));
+    init_ann(c.ann, dim, n_layers, 1);
+    c.sample = (double*)malloc(MAX_SIZE * sizeof(double));
+    srand(1);
+    for (int i = 0; i < dim[0]; i++) {
+        c.sample[i] = (rand() % 5 == 0) ? (double)(rand() % 256) / 255.0 : 0;
+    }
+    c.sample[dim[0]] = 3;
+
+    // Pre-render CSV lines with the same shape as the training file
+    c.lines = (char**)malloc(PARSE_LINES * sizeof(char*));
+    c.parse_bytes = 0;
+    for (int l = 0; l < PARSE_LINES; l++) {
+        c.lines[l] = (char*)malloc(8 * (dim[0] + 1) + 2);
+        int len = sprintf(c.lines[l], "%d", rand() % 10);
+        for (int i = 0; i < dim[0]; i++) {
+            len += sprintf(c.lines[l] + len, ",%d", (rand() % 5 == 0) ? rand() % 256 : 0);
+        }
+        len += sprintf(c.lines[l] + len, "\n");
+        c.parse_bytes += len;
+    }
+
+    FILE* csv = stdout;
+    if (csv_path != NULL) {
+        FILE* probe = fopen(csv_path, "r");
+        int exists = (probe != NULL);
+        if (probe) {
+            fclose(probe);
+        }
+        if ((csv = fopen(csv_path, "a")) == NULL) {
+            printf("Unable to open file %s\n", csv_path);
+            return 1;
+        }
+        if (!exists) {
+            fprintf(csv, "variant,benchmark,dims,threads,iterations,ns_per_op,gflops,mb_per_s\n");
+        }
+    } else {
+        fprintf(csv, "variant,benchmark,dims,threads,iterations,ns_per_op,gflops,mb_per_s\n");
+    }
+
+    char dims_text[128] = "";
+    for (int i = 0; i < n_layers; i++) {
+        sprintf(dims_text + strlen(dims_text), "%s%d", i ? "x" : "", dim[i]);
+    }
+
+    struct {
+        const char* name;
+        void (*fn)(bench_ctx*);
+        double flops;
+        double bytes;
+    } kernels[] = {
+        { "feed_forward", run_forward, ann_flops_forward(dim, n_layers), 0 },
+        { "compute_deltas", run_deltas, ann_flops_backward(dim, n_layers), 0 },
+        { "update_weights", run_update, ann_flops_update(dim, n_layers), 0 },
+        { "backward_update", run_backward_update,
+          ann_flops_backward(dim, n_layers) + ann_flops_update(dim, n_layers), 0 },
+        { "train_sample", run_train_sample,
+          ann_flops_forward(dim, n_layers) + ann_flops_backward(dim, n_layers) + ann_flops_update(dim, n_layers), 0 },
+        { "csv_parse", run_parse, 0, (double)c.parse_bytes },
+    };
+    int n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    for (int t = 0; t < n_threads; t++) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads[t]);
+#else
+        threads[t] = 1;
+#endif
+        run_forward(&c);
+        for (int k = 0; k < n_kernels; k++) {
+            long iterations = 0;
+            double seconds = time_kernel(kernels[k].fn, &c, min_time, &iterations);
+            fprintf(csv, "%s,%s,%s,%d,%ld,%.1f,%.4f,%.2f\n", VARIANT, kernels[k].name, dims_text,
+                    threads[t], iterations, seconds * 1e9,
+                    kernels[k].flops / seconds * 1e-9, kernels[k].bytes / seconds / (1024 * 1024));
+            fflush(csv);
+        }
+    }
+
+    if (csv != stdout) {
+        fclose(csv);
+    }
+    return 0;
+}
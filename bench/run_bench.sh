@@ -0,0 +1,114 @@
+#!/bin/sh
+# Runs the microbenchmarks and end-to-end throughput sweeps on synthetic data
+# and appends the results to CSV files for regression tracking.
+#
+#   bench/run_bench.sh [-b BUILD_DIR] [-r TRAIN_ROWS] [-e TEST_ROWS]
+#                      [-t "1 2 4"] [-n "1 2 4"] [-o RESULTS_DIR] [-m "MPIRUN ARGS"]
+#
+# Writes RESULTS_DIR/micro.csv (one row per kernel and thread count) and
+# RESULTS_DIR/e2e.csv (one row per driver, worker count and region).
+set -eu
+
+BUILD=build
+TRAIN_ROWS=20000
+TEST_ROWS=5000
+THREADS="1 2 4"
+RANKS="1 2 4"
+RESULTS=bench_results
+MPIRUN_ARGS="${MPIRUN_ARGS:-}"
+
+while getopts b:r:e:t:n:o:m: opt; do
+    case $opt in
+        b) BUILD=$OPTARG ;;
+        r) TRAIN_ROWS=$OPTARG ;;
+        e) TEST_ROWS=$OPTARG ;;
+        t) THREADS=$OPTARG ;;
+        n) RANKS=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        m) MPIRUN_ARGS=$OPTARG ;;
+        *) sed -n '2,9p' "$0"; exit 1 ;;
+    esac
+done
+
+BUILD=$(cd "$BUILD" && pwd)
+mkdir -p "$RESULTS"
+RESULTS=$(cd "$RESULTS" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+HOST=$(hostname)
+REV=$(git -C "$(dirname "$0")" rev-parse --short HEAD 2>/dev/null || echo unknown)
+STAMP=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+echo "Generating $TRAIN_ROWS training and $TEST_ROWS test rows"
+"$BUILD/bench/ann_gen_data" --rows "$TRAIN_ROWS" --seed 1 "$WORK/train.csv"
+"$BUILD/bench/ann_gen_data" --rows "$TEST_ROWS" --seed 2 --no-label "$WORK/test.csv"
+
+THREAD_LIST=$(echo "$THREADS" | tr ' ' ',')
+for variant in openmp openmp1 mpi; do
+    bin="$BUILD/bench/bench_micro_$variant"
+    [ -x "$bin" ] || continue
+    echo "Microbenchmarks: $variant"
+    if [ "$variant" = mpi ]; then
+        "$bin" --threads 1 --csv "$WORK/micro.csv" >/dev/null
+    else
+        "$bin" --threads "$THREAD_LIST" --csv "$WORK/micro.csv" >/dev/null
+    fi
+done
+
+# Prefix every microbenchmark row with run metadata
+if [ ! -f "$RESULTS/micro.csv" ]; then
+    echo "timestamp,host,revision,$(head -n 1 "$WORK/micro.csv")" > "$RESULTS/micro.csv"
+fi
+tail -n +2 "$WORK/micro.csv" | sed "s/^/$STAMP,$HOST,$REV,/" >> "$RESULTS/micro.csv"
+
+if [ ! -f "$RESULTS/e2e.csv" ]; then
+    echo "timestamp,host,revision,variant,workers,train_rows,test_rows,region,wall_seconds,samples,samples_per_second" > "$RESULTS/e2e.csv"
+fi
+
+# Summarizes a JSON report: per region, the slowest rank's wall time and the
+# samples processed by all ranks
+summarize() {
+    grep -o '"name": "[a-z]*", "wall_seconds": [0-9.e+-]*, "samples": [0-9]*' "$1" |
+    awk -F'"' '{
+        split($0, f, /[:,] */)
+        region = $4; wall = f[4] + 0; samples = f[6] + 0
+        if (!(region in max) || wall > max[region]) max[region] = wall
+        sum[region] += samples
+        if (!(region in seen)) { seen[region] = 1; order[n++] = region }
+    }
+    END {
+        for (i = 0; i < n; i++) {
+            r = order[i]
+            printf "%s,%.6f,%d,%.1f\n", r, max[r], sum[r], (max[r] > 0 ? sum[r] / max[r] : 0)
+        }
+    }'
+}
+
+record() {
+    variant=$1 workers=$2 report=$3
+    summarize "$report" | while IFS= read -r line; do
+        echo "$STAMP,$HOST,$REV,$variant,$workers,$TRAIN_ROWS,$TEST_ROWS,$line" >> "$RESULTS/e2e.csv"
+    done
+}
+
+cd "$WORK"
+for variant in openmp openmp1; do
+    [ -x "$BUILD/ann_$variant" ] || continue
+    for t in $THREADS; do
+        echo "End-to-end: ann_$variant with $t threads"
+        OMP_NUM_THREADS=$t "$BUILD/ann_$variant" --report "$WORK/report.json" >/dev/null
+        record "$variant" "$t" "$WORK/report.json"
+    done
+done
+
+if [ -x "$BUILD/ann_mpi" ]; then
+    for n in $RANKS; do
+        echo "End-to-end: ann_mpi with $n ranks"
+        # shellcheck disable=SC2086
+        OMP_NUM_THREADS=1 mpirun $MPIRUN_ARGS -np "$n" "$BUILD/ann_mpi" --report "$WORK/report.json" >/dev/null
+        record mpi "$n" "$WORK/report.json"
+    done
+fi
+
+echo "Results appended to $RESULTS/micro.csv and $RESULTS/e2e.csv"
@@ -0,0 +1,148 @@
+#!/bin/sh
+# Strong and weak scaling harness for the MPI and OpenMP drivers.
+#
+#   bench/run_scaling.sh [-b BUILD_DIR] [-w "1 2 4 8"] [-r ROWS] [-e TEST_ROWS]
+#                        [-v "mpi openmp openmp1"] [-s "strong weak"]
+#                        [-o RESULTS_DIR] [-m "MPIRUN ARGS"]
+#
+# Strong scaling keeps ROWS fixed; weak scaling gives every worker ROWS rows
+# (and TEST_ROWS test rows). Workers are MPI ranks for ann_mpi and OpenMP
+# threads for the OpenMP drivers. For every run and region (train, test), the
+# harness reports:
+#   speedup     T(base) / T(p), scaled by p/base for weak scaling
+#   efficiency  speedup / (p/base)
+#   karp_flatt  experimentally determined serial fraction
+#               (1/speedup - 1/q) / (1 - 1/q), q = p/base
+#   compute, comm, other
+#               seconds of forward/backward/update, of MPI communication,
+#               and of everything else (parse, output, imbalance), taken
+#               from the slowest thread of the slowest rank
+# The first worker count is the baseline and should normally be 1. Results
+# are appended to RESULTS_DIR/scaling.csv and printed as a table.
+set -eu
+
+BUILD=build
+WORKERS="1 2 4"
+ROWS=20000
+TEST_ROWS=5000
+VARIANTS="mpi openmp openmp1"
+MODES="strong weak"
+RESULTS=bench_results
+MPIRUN_ARGS="${MPIRUN_ARGS:-}"
+
+while getopts b:w:r:e:v:s:o:m: opt; do
+    case $opt in
+        b) BUILD=$OPTARG ;;
+        w) WORKERS=$OPTARG ;;
+        r) ROWS=$OPTARG ;;
+        e) TEST_ROWS=$OPTARG ;;
+        v) VARIANTS=$OPTARG ;;
+        s) MODES=$OPTARG ;;
+        o) RESULTS=$OPTARG ;;
+        m) MPIRUN_ARGS=$OPTARG ;;
+        *) sed -n '2,22p' "$0"; exit 1 ;;
+    esac
+done
+
+BUILD=$(cd "$BUILD" && pwd)
+mkdir -p "$RESULTS"
+RESULTS=$(cd "$RESULTS" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+HOST=$(hostname)
+REV=$(git -C "$(dirname "$0")" rev-parse --short HEAD 2>/dev/null || echo unknown)
+STAMP=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+BASE=$(echo "$WORKERS" | awk '{ print $1 }')
+CSV="$RESULTS/scaling.csv"
+
+if [ ! -f "$CSV" ]; then
+    echo "timestamp,host,revision,mode,variant,workers,train_rows,test_rows,region,wall_seconds,speedup,efficiency,karp_flatt,compute_seconds,comm_seconds,other_seconds" > "$CSV"
+fi
+
+# Prints "region wall compute comm" per region of a JSON report; wall is the
+# slowest rank, compute and comm the busiest thread of any rank
+summarize() {
+    awk '
+    function phase(name,    s) {
+        if (match($0, "\"" name "\": [{]\"seconds\": [0-9.e+-]*")) {
+            s = substr($0, RSTART, RLENGTH)
+            sub(/.*: /, "", s)
+            return s + 0
+        }
+        return 0
+    }
+    /"name": "/ {
+        match($0, /"name": "[a-z]*"/)
+        region = substr($0, RSTART + 9, RLENGTH - 10)
+        match($0, /"wall_seconds": [0-9.e+-]*/)
+        wall = substr($0, RSTART + 16, RLENGTH - 16) + 0
+        if (!(region in seen)) { seen[region] = 1; order[n++] = region }
+        if (wall > max_wall[region]) max_wall[region] = wall
+    }
+    /^ *[{]"thread": / {
+        compute = phase("forward") + phase("backward") + phase("update")
+        comm = phase("comm")
+        if (compute > max_compute[region]) max_compute[region] = compute
+        if (comm > max_comm[region]) max_comm[region] = comm
+    }
+    END {
+        for (i = 0; i < n; i++) {
+            r = order[i]
+            printf "%s %.6f %.6f %.6f\n", r, max_wall[r], max_compute[r], max_comm[r]
+        }
+    }' "$1"
+}
+
+run() {
+    variant=$1 workers=$2
+    if [ "$variant" = mpi ]; then
+        # shellcheck disable=SC2086
+        OMP_NUM_THREADS=1 mpirun $MPIRUN_ARGS -np "$workers" "$BUILD/ann_mpi" --report "$WORK/report.json" >/dev/null
+    else
+        OMP_NUM_THREADS=$workers "$BUILD/ann_$variant" --report "$WORK/report.json" >/dev/null
+    fi
+}
+
+cd "$WORK"
+printf "%-6s %-8s %7s %-6s %10s %8s %8s %8s %9s %9s\n" mode variant workers region wall speedup eff kf comm% other%
+for mode in $MODES; do
+    for variant in $VARIANTS; do
+        [ -x "$BUILD/ann_$variant" ] || continue
+        rm -f "$WORK/base"
+        for p in $WORKERS; do
+            if [ "$mode" = weak ]; then
+                rows=$((ROWS * p / BASE))
+                test_rows=$((TEST_ROWS * p / BASE))
+            else
+                rows=$ROWS
+                test_rows=$TEST_ROWS
+            fi
+            "$BUILD/bench/ann_gen_data" --rows "$rows" --seed 1 train.csv
+            "$BUILD/bench/ann_gen_data" --rows "$test_rows" --seed 2 --no-label test.csv
+            run "$variant" "$p"
+            summarize "$WORK/report.json" > "$WORK/current"
+            [ -f "$WORK/base" ] || cp "$WORK/current" "$WORK/base"
+
+            awk -v mode="$mode" -v variant="$variant" -v p="$p" -v base="$BASE" \
+                -v prefix="$STAMP,$HOST,$REV,$mode,$variant,$p,$rows,$test_rows" \
+                -v csv="$CSV" '
+            NR == FNR { base_wall[$1] = $2; next }
+            {
+                region = $1; wall = $2; compute = $3; comm = $4
+                other = wall - compute - comm
+                if (other < 0) other = 0
+                q = p / base
+                speedup = (wall > 0) ? base_wall[region] / wall : 0
+                if (mode == "weak") speedup *= q
+                eff = speedup / q
+                kf = ""
+                if (q > 1 && speedup > 0) kf = sprintf("%.4f", (1 / speedup - 1 / q) / (1 - 1 / q))
+                printf "%s,%s,%.6f,%.4f,%.4f,%s,%.6f,%.6f,%.6f\n", prefix, region, wall, speedup, eff, kf, compute, comm, other >> csv
+                printf "%-6s %-8s %7d %-6s %10.4f %8.3f %8.3f %8s %8.1f%% %8.1f%%\n", mode, variant, p, region, wall, speedup, eff,
+                    (kf == "" ? "-" : kf), (wall > 0 ? 100 * comm / wall : 0), (wall > 0 ? 100 * other / wall : 0)
+            }' "$WORK/base" "$WORK/current"
+        done
+    done
+done
+echo "Results appended to $CSV"
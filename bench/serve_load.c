@@ -0,0 +1,211 @@
+// Closed-loop load generator for ann_serve.
+//
+// Each of --clients OpenMP threads opens its own connection and sends the
+// rows of a test CSV file in requests of --batch samples, waiting for every
+// response before sending the next request. Prints throughput and latency
+// percentiles; with --output the predictions are written as a submission
+// file so they can be checked against the offline drivers.
+//
+// With --reset N every client first pipelines N requests without reading a
+// reply and then resets its connection, so the server drops clients in the
+// middle of a batch; the closed-loop run that follows checks that it still
+// answers correctly.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <omp.h>
+
+#include "ann_csv.h"
+#include "ann_serve.h"
+
+#define N_PIXELS 784
+
+static void usage(const char* program) {
+    printf("Usage: %s [--socket PATH | --port N] [--test FILE] [--clients N]\n"
+           "          [--batch N] [--rounds N] [--reset N] [--output FILE]\n", program);
+    exit(1);
+}
+
+static double now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Rows of the file as float32 pixels, the request payload format
+static float* read_rows(const char* path, int* n_rows) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Unable to open file %s\n", path);
+        exit(1);
+    }
+    static char line[16000];
+    double row[N_PIXELS + 1];
+    int cap = 1024, n = 0;
+    float* rows = (float*)malloc((size_t)cap * N_PIXELS * sizeof(float));
+    fgets(line, sizeof(line), f);  // skip header
+    while (fgets(line, sizeof(line), f)) {
+        if (n == cap) {
+            cap *= 2;
+            rows = (float*)realloc(rows, (size_t)cap * N_PIXELS * sizeof(float));
+        }
+        parse_csv_row(line, row, N_PIXELS, 0);
+        for (int k = 0; k < N_PIXELS; k++) {
+            rows[(size_t)n * N_PIXELS + k] = (float)row[k];
+        }
+        n++;
+    }
+    fclose(f);
+    *n_rows = n;
+    return rows;
+}
+
+int main(int argc, char* argv[]) {
+    const char* socket_path = "ann_serve.sock";
+    const char* test_file = "test.csv";
+    const char* output_file = NULL;
+    int port = 0;
+    int n_clients = 4;
+    int batch = 1;
+    int rounds = 1;
+    int reset = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        if (strcmp(argv[i], "--socket") == 0) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--test") == 0) {
+            test_file = argv[++i];
+        } else if (strcmp(argv[i], "--clients") == 0) {
+            n_clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rounds") == 0) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reset") == 0) {
+            reset = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--output") == 0) {
+            output_file = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (n_clients < 1 || batch < 1 || batch > ANN_SERVE_MAX_SAMPLES || rounds < 1 || reset < 0) {
+        usage(argv[0]);
+    }
+
+    int n_rows;
+    float* rows = read_rows(test_file, &n_rows);
+    int per_round = (n_rows + batch - 1) / batch;
+    int n_requests = per_round * rounds;
+    double* latency = (double*)malloc((n_requests > 0 ? n_requests : 1) * sizeof(double));
+    int* labels = (int*)malloc((n_rows > 0 ? n_rows : 1) * sizeof(int));
+    int failed = 0;
+
+    if (reset > 0 && n_rows > 0) {
+        #pragma omp parallel num_threads(n_clients) reduction(+:failed)
+        {
+            int fd = ann_serve_connect(socket_path, port);
+            if (fd < 0) {
+                perror("Unable to connect");
+                failed++;
+            }
+            for (int r = 0; fd >= 0 && r < reset; r++) {
+                int first = (r % per_round) * batch;
+                int count = first + batch <= n_rows ? batch : n_rows - first;
+                ann_serve_header h = { (uint32_t)count, N_PIXELS };
+                if (ann_serve_send_all(fd, &h, sizeof(h)) != 0
+                    || ann_serve_send_all(fd, rows + (size_t)first * N_PIXELS, (size_t)count * N_PIXELS * sizeof(float)) != 0) {
+                    break;
+                }
+            }
+            if (fd >= 0) {
+                // A zero linger turns close into a reset with replies unread
+                struct linger hard = { 1, 0 };
+                setsockopt(fd, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+                close(fd);
+            }
+        }
+        if (failed) {
+            printf("%d client(s) failed\n", failed);
+            return 1;
+        }
+        printf("%d client(s) pipelined %d request(s) each and reset\n", n_clients, reset);
+    }
+
+    double start = now_us();
+    // Request r covers rows r*batch..; client c sends requests c, c+clients, ...
+    #pragma omp parallel num_threads(n_clients) reduction(+:failed)
+    {
+        int c = omp_get_thread_num();
+        int fd = ann_serve_connect(socket_path, port);
+        if (fd < 0) {
+            perror("Unable to connect");
+            failed++;
+        }
+        for (int r = c; fd >= 0 && r < n_requests; r += n_clients) {
+            int first = (r % per_round) * batch;
+            int count = first + batch <= n_rows ? batch : n_rows - first;
+            ann_serve_header h = { (uint32_t)count, N_PIXELS };
+            int32_t reply[ANN_SERVE_MAX_SAMPLES + 1];
+            double t0 = now_us();
+            if (ann_serve_send_all(fd, &h, sizeof(h)) != 0
+                || ann_serve_send_all(fd, rows + (size_t)first * N_PIXELS, (size_t)count * N_PIXELS * sizeof(float)) != 0
+                || ann_serve_recv_all(fd, reply, sizeof(int32_t)) != 0
+                || reply[0] != count
+                || ann_serve_recv_all(fd, reply + 1, count * sizeof(int32_t)) != 0) {
+                failed++;
+                break;
+            }
+            latency[r] = now_us() - t0;
+            for (int s = 0; s < count; s++) {
+                labels[first + s] = reply[1 + s];
+            }
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    double seconds = (now_us() - start) / 1e6;
+
+    if (failed) {
+        printf("%d client(s) failed\n", failed);
+        return 1;
+    }
+    qsort(latency, n_requests, sizeof(double), compare_double);
+    printf("%d request(s) of %d sample(s) from %d client(s) in %.3f s\n", n_requests, batch, n_clients, seconds);
+    printf("%.0f requests/s, %.0f samples/s\n", n_requests / seconds, (double)n_rows * rounds / seconds);
+    if (n_requests > 0) {
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               latency[n_requests / 2], latency[(int)(n_requests * 0.9)],
+               latency[(int)(n_requests * 0.99)], latency[n_requests - 1]);
+    }
+
+    if (output_file != NULL) {
+        FILE* out = fopen(output_file, "w");
+        if (out == NULL) {
+            printf("Unable to open file %s\n", output_file);
+            return 1;
+        }
+        fprintf(out, "ImageId,Label\n");
+        for (int i = 0; i < n_rows; i++) {
+            fprintf(out, "%d,%d\n", i + 1, labels[i]);
+        }
+        fclose(out);
+    }
+    free(rows);
+    free(latency);
+    free(labels);
+    return 0;
+}
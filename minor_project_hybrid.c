@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+#include <omp.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_csv.h"
+#include "ann_numa.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+#include "ann_hybrid.h"
+#include "ann_mpi_util.h"
+
+#define BUFFER_SIZE 16000
+#define BATCH_SIZE 16
+#define LEARNING_RATE 2.0
+
+double** read_csv_rows(char* filename, int has_label, int* n_rows, int rank, int size);
+void train_from_csv(char* filename, int batch_size, int rank, int size);
+void predict_from_csv(char *sourceFile, char* destFile, int rank, int size);
+
+network* ann;
+
+int main(int argc, char* argv[]) {
+    ann_options opts = { "train.csv", "test.csv", "submission_hybrid.csv", NULL };
+    opts.batch_size = BATCH_SIZE;
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_TEST | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_AFFINITY | ANN_ACCEPT_BATCH
+                 | ANN_ACCEPT_SAVE_MODEL | ANN_ACCEPT_SEED;
+    ann_parse_options(argc, argv, &opts);
+    ann_configure_affinity(&opts, argv);
+
+    // Only the master thread of each rank talks to MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) {
+            printf("MPI library does not support MPI_THREAD_FUNNELED\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    omp_set_dynamic(0);
+    if (rank == 0) {
+        printf("Running %d rank(s) with %d thread(s) each\n", size, omp_get_max_threads());
+    }
+
+    ann = (network*)malloc(sizeof(network));
+    int *dim = (int*)malloc(3 * sizeof(int));
+    dim[0] = 784;
+    dim[1] = 32;
+    dim[2] = 10;
+    // Every rank draws the same initial weights from rank 0's seed, so the
+    // model needs no broadcast
+    unsigned long long seed = ann_seed(&opts);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    init_ann(ann, dim, 3, seed);
+
+    ann_prof_region_begin("train");
+    train_from_csv((char*)opts.train_file, opts.batch_size, rank, size);
+    print_region("training", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    // The ranks hold identical weights, so rank 0's copy is the model
+    if (rank == 0 && opts.save_model != NULL && save_ann(ann, opts.save_model) != 0) {
+        printf("Unable to write model %s\n", opts.save_model);
+    }
+
+    ann_prof_region_begin("test");
+    predict_from_csv((char*)opts.test_file, (char*)opts.output_file, rank, size);
+    print_region("testing", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    write_report(opts.report_file, "ann_hybrid", MPI_COMM_WORLD);
+
+    free_ann(ann);
+    free(dim);
+
+    MPI_Finalize();
+    return 0;
+}
+
+// Every rank scans the file and parses rows idx % size == rank, so each rank
+// holds only its share. Rows are dim[0] pixels followed by the label.
+double** read_csv_rows(char* filename, int has_label, int* n_rows, int rank, int size) {
+    FILE *fptr;
+    if ((fptr = fopen(filename, "r")) == NULL) {
+        printf("Unable to open file %s\n", filename);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    char* line = (char*)malloc(BUFFER_SIZE);
+    int width = ann->dim[0] + 1;
+    int capacity = MAX_SIZE;
+    int count = 0;
+    double* rows = (double*)malloc((size_t)capacity * width * sizeof(double));
+
+    fgets(line, BUFFER_SIZE, fptr); // skip header
+    for (int idx = 0; fgets(line, BUFFER_SIZE, fptr); idx++) {
+        if (idx % size != rank) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            rows = (double*)realloc(rows, (size_t)capacity * width * sizeof(double));
+            if (rows == NULL) {
+                printf("Unable to allocate %d rows\n", capacity);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+        double t0 = ann_prof_begin();
+        parse_csv_row(line, rows + (size_t)count * width, ann->dim[0], has_label);
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+        count++;
+    }
+    fclose(fptr);
+    free(line);
+
+    double** data = (double**)malloc((count > 0 ? count : 1) * sizeof(double*));
+    data[0] = rows;
+    for (int i = 0; i < count; i++) {
+        data[i] = rows + (size_t)i * width;
+    }
+    *n_rows = count;
+    return data;
+}
+
+void train_from_csv(char* filename, int batch_size, int rank, int size) {
+    int count = 0;
+    double** train_data = read_csv_rows(filename, 1, &count, rank, size);
+
+    train_hybrid(ann, train_data, count, LEARNING_RATE, batch_size, MPI_COMM_WORLD);
+
+    int total_samples = 0;
+    MPI_Reduce(&count, &total_samples, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Done Reading and Training %d samples...\n", total_samples);
+    }
+    free_2Darray(train_data);
+}
+
+void predict_from_csv(char *sourceFile, char* destFile, int rank, int size) {
+    int count = 0;
+    double** test_data = read_csv_rows(sourceFile, 0, &count, rank, size);
+
+    int* labels = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+        labels[i] = predict(ann, test_data[i]);
+    }
+    if (rank == 16 % size && count > 16 / size) {
+        save_image_as_png("sample_17_hybrid.png", test_data[16 / size], 28, 28);
+    }
+
+    int *counts = NULL, *displs = NULL, *all_labels = NULL;
+    int total_lines = 0;
+    if (rank == 0) {
+        counts = (int*)malloc(size * sizeof(int));
+        displs = (int*)malloc(size * sizeof(int));
+    }
+    double t0 = ann_prof_begin();
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            displs[r] = total_lines;
+            total_lines += counts[r];
+        }
+        all_labels = (int*)malloc((total_lines > 0 ? total_lines : 1) * sizeof(int));
+    }
+    MPI_Gatherv(labels, count, MPI_INT, all_labels, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+
+    if (rank == 0) {
+        // Row i of the file was parsed by rank i % size as its (i / size)-th row
+        t0 = ann_prof_begin();
+        ann_writer out;
+        if (ann_writer_open(&out, destFile) != 0) {
+            printf("Unable to open file %s\n", destFile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        int* ordered = (int*)malloc((total_lines > 0 ? total_lines : 1) * sizeof(int));
+        for (int i = 0; i < total_lines; i++) {
+            ordered[i] = all_labels[displs[i % size] + i / size];
+        }
+        ann_writer_predictions(&out, ordered, total_lines);
+        if (ann_writer_close(&out) != 0) {
+            printf("Unable to write file %s\n", destFile);
+        }
+        ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+        free(ordered);
+        free(all_labels);
+        free(counts);
+        free(displs);
+    }
+
+    free(labels);
+    free_2Darray(test_data);
+}
@@ -1,205 +1,312 @@
-#include <stdio.h>
-#include <math.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include <mpi.h>
-#include <sys/resource.h>  // For getrusage
-
-#include "alloc_mpi.h"
-#include "ann_mpi.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-void train_from_csv(char* filename, double** train_data, int* total_samples, int rank, int size);
-void predict_from_csv(char *sourceFile, char* destFile, int rank, int size);
-void save_image_as_png(const char *filename, double *pixels, int width, int height);
-
-network* ann;
-
-long get_memory_usage() {
-    struct rusage usage;
-    getrusage(RUSAGE_SELF, &usage);
-    return usage.ru_maxrss * 1024L;
-}
-
-int main(int argc, char* argv[]) {
-    MPI_Init(&argc, &argv);
-    int rank, size;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
-
-    ann = (network*)malloc(sizeof(network));
-    double **train_data = init_2Darray(MAX_SIZE, MAX_SIZE);
-    int *dim = (int*)malloc(3 * sizeof(int));
-    dim[0] = 784;
-    dim[1] = 32;
-    dim[2] = 10;
-    init_ann(ann, dim, 3);
-
-    clock_t start_train_time = clock();
-    long start_train_memory = get_memory_usage();
-
-    int total_samples = 0;
-    train_from_csv("train.csv", train_data, &total_samples, rank, size);
-
-    clock_t end_train_time = clock();
-    long end_train_memory = get_memory_usage();
-
-    double train_time_taken = (double)(end_train_time - start_train_time) / CLOCKS_PER_SEC;
-    long train_memory_used = end_train_memory - start_train_memory;
-
-    if (rank == 0) {
-        printf("Time taken for training: %.2f seconds\n", train_time_taken);
-        printf("Memory used during training: %ld bytes (%.2f MB)\n", train_memory_used, (double)train_memory_used / (1024 * 1024));
-    }
-
-    clock_t start_test_time = clock();
-    long start_test_memory = get_memory_usage();
-
-    predict_from_csv("test.csv", "submission.csv", rank, size);
-
-    clock_t end_test_time = clock();
-    long end_test_memory = get_memory_usage();
-
-    double test_time_taken = (double)(end_test_time - start_test_time) / CLOCKS_PER_SEC;
-    long test_memory_used = end_test_memory - start_test_memory;
-
-    if (rank == 0) {
-        printf("Time taken for testing: %.2f seconds\n", test_time_taken);
-        printf("Memory used during testing: %ld bytes (%.2f MB)\n", test_memory_used, (double)test_memory_used / (1024 * 1024));
-    }
-
-    free_ann(ann);
-    free(train_data);
-    free(dim);
-
-    MPI_Finalize();
-    return 0;
-}
-
-void train_from_csv(char* filename, double** train_data, int* total_samples, int rank, int size) {
-    FILE *fptr = NULL;
-    int total_count = 0;
-
-    if (rank == 0) {
-        char line[16000];
-        if ((fptr = fopen(filename, "r")) == NULL) {
-            printf("Unable to open file %s\n", filename);
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
-        fgets(line, sizeof(line), fptr);  // skip header
-
-        while (fgets(line, sizeof(line), fptr)) {
-            char *token = strtok(line, ",");
-            train_data[total_count][784] = atof(token);
-            for (int i = 0; i < 784; i++) {
-                token = strtok(NULL, ",");
-                train_data[total_count][i] = atof(token) / 255.0;
-            }
-            total_count++;
-            if (total_count >= MAX_SIZE) break;
-        }
-        fclose(fptr);
-    }
-
-    // Broadcast sample count to all
-    MPI_Bcast(&total_count, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    *total_samples = total_count;
-
-    // Broadcast data to all processes
-    MPI_Bcast(&(train_data[0][0]), MAX_SIZE * MAX_SIZE, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-    // Train in parallel
-    train(ann, train_data, total_count, 0.25, rank, size);
-
-    if (rank == 0) printf("Done Reading and Training...\n");
-}
-
-void predict_from_csv(char *sourceFile, char* destFile, int rank, int size) {
-    FILE *fptr = NULL;
-    char line[16000];
-    int total_lines = 0;
-    int lines_per_proc = 0;
-
-    if (rank == 0) {
-        if ((fptr = fopen(sourceFile, "r")) == NULL) {
-            printf("Unable to open file %s\n", sourceFile);
-            MPI_Abort(MPI_COMM_WORLD, 1);
-        }
-        fgets(line, sizeof(line), fptr); // skip header
-
-        while (fgets(line, sizeof(line), fptr)) {
-            total_lines++;
-        }
-        fclose(fptr);
-    }
-
-    MPI_Bcast(&total_lines, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    lines_per_proc = (total_lines + size - 1) / size;
-    int my_start = rank * lines_per_proc;
-    int my_end = (rank + 1) * lines_per_proc;
-    if (my_end > total_lines) my_end = total_lines;
-
-    double **local_data = init_2Darray(lines_per_proc, MAX_SIZE);
-    int count = 0;
-
-    if (rank == 0) {
-        fptr = fopen(sourceFile, "r");
-        fgets(line, sizeof(line), fptr); // skip header
-        int idx = 0;
-        while (fgets(line, sizeof(line), fptr)) {
-            if (idx >= my_start && idx < my_end) {
-                char *token = strtok(line, ",");
-                for (int i = 0; i < 784; i++) {
-                    if (i > 0) token = strtok(NULL, ",");
-                    local_data[count][i] = atof(token) / 255.0;
-                }
-                count++;
-            }
-            idx++;
-        }
-        fclose(fptr);
-    }
-
-    // Broadcast local data for this rank
-    MPI_Bcast(&(local_data[0][0]), lines_per_proc * MAX_SIZE, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-    // Prediction and gather results
-    int *labels = (int*)malloc(lines_per_proc * sizeof(int));
-    for (int i = 0; i < count; i++) {
-        labels[i] = predict(ann, local_data[i]);
-        if (rank == 0 && (i == 16)) {
-            save_image_as_png("sample_17.png", local_data[i], 28, 28);
-        }
-    }
-
-    int *all_labels = NULL;
-    if (rank == 0) all_labels = (int*)malloc(total_lines * sizeof(int));
-
-    MPI_Gather(labels, lines_per_proc, MPI_INT, all_labels, lines_per_proc, MPI_INT, 0, MPI_COMM_WORLD);
-
-    if (rank == 0) {
-        FILE *out = fopen(destFile, "w");
-        fprintf(out, "ImageId,Label\n");
-        for (int i = 0; i < total_lines; i++) {
-            fprintf(out, "%d,%d\n", i + 1, all_labels[i]);
-        }
-        fclose(out);
-        free(all_labels);
-    }
-
-    free(labels);
-    free(local_data);
-}
-
-void save_image_as_png(const char *filename, double *pixels, int width, int height) {
-    unsigned char *image_data = (unsigned char*)malloc(width * height * sizeof(unsigned char));
-    for (int i = 0; i < width * height; i++) {
-        image_data[i] = (unsigned char)(pixels[i] * 255);
-    }
-
-    stbi_write_png(filename, width, height, 1, image_data, width);
-    free(image_data);
-}
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mpi.h>
+
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_eval.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+#include "ann_mpi.h"
+#include "ann_mpi_util.h"
+
+void train_from_csv(char* filename, double** train_data, int* total_samples, const ann_options* opts, int rank, int size);
+void train_async_from_csv(char* filename, double** train_data, int* total_samples, const ann_options* opts, int rank, int size);
+void predict_from_csv(char *sourceFile, char* destFile, int mpiio, int rank, int size);
+void evaluate_from_csv(const char* filename, const char* misclassified_file, double** data, int rank, int size);
+
+network* ann;
+ensemble* ens = NULL;
+
+// Every rank reads its own byte range of filename with MPI-IO
+static void open_input(mpi_csv* csv, const char* filename, int rank) {
+    if (mpi_csv_open(csv, filename, MPI_COMM_WORLD) != 0) {
+        if (rank == 0) {
+            printf("Unable to read file %s\n", filename);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    ann_options opts = { "train.csv", "test.csv", "submission.csv", NULL };
+    opts.batch_size = 16;
+    opts.staleness = 4;
+    opts.compress = "none";
+    opts.topk_ratio = 0.01;
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_TEST | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_BATCH | ANN_ACCEPT_PS
+                 | ANN_ACCEPT_STALENESS | ANN_ACCEPT_SYNC | ANN_ACCEPT_COMPRESS | ANN_ACCEPT_TOPK
+                 | ANN_ACCEPT_SAVE_MODEL | ANN_ACCEPT_SEED | ANN_ACCEPT_EVAL | ANN_ACCEPT_MISCLASSIFIED
+                 | ANN_ACCEPT_MPIIO | ANN_ACCEPT_ENSEMBLE;
+    ann_parse_options(argc, argv, &opts);
+
+    ann = (network*)malloc(sizeof(network));
+    double **train_data = init_2Darray(MAX_SIZE, MAX_SIZE);
+    int *dim = (int*)malloc(3 * sizeof(int));
+    dim[0] = 784;
+    dim[1] = 32;
+    dim[2] = 10;
+    // Every rank draws the same initial weights from rank 0's seed
+    unsigned long long seed = ann_seed(&opts);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    init_ann(ann, dim, 3, seed);
+
+    ann_prof_region_begin("train");
+    int total_samples = 0;
+    if (opts.ps_servers > 0) {
+        train_async_from_csv((char*)opts.train_file, train_data, &total_samples, &opts, rank, size);
+    } else {
+        train_from_csv((char*)opts.train_file, train_data, &total_samples, &opts, rank, size);
+    }
+    print_region("training", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    // Without --sync or --ps every rank ends up with its own model, trained
+    // on its own rows; --ensemble puts them all to use instead of rank 0's
+    int ensemble_outputs = opts.ensemble != NULL && strcmp(opts.ensemble, "outputs") == 0;
+    if (opts.ensemble != NULL && rank == 0 && (opts.sync_interval > 0 || opts.ps_servers > 0)) {
+        printf("The ranks trained one shared model; --ensemble %s changes nothing\n", opts.ensemble);
+    }
+    if (opts.ensemble != NULL && strcmp(opts.ensemble, "weights") == 0) {
+        average_ann(ann, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("Averaged the weights of %d model(s)\n", size);
+        }
+    }
+
+    // Rank 0's model (the averaged one with --ensemble weights) is saved
+    if (rank == 0 && opts.save_model != NULL && save_ann(ann, opts.save_model) != 0) {
+        printf("Unable to write model %s\n", opts.save_model);
+    }
+
+    // Inference is read-only, so each node keeps one copy of rank 0's model
+    // in shared memory and the private copies are released. An ensemble
+    // instead keeps every rank's packed model on every rank.
+    shared_network shared;
+    ensemble ens_storage;
+    if (ensemble_outputs) {
+        ensemble_init(&ens_storage, ann, MPI_COMM_WORLD);
+        ens = &ens_storage;
+        if (rank == 0) {
+            printf("Inference averages the outputs of %d model(s)\n", ens->n_models);
+        }
+    } else {
+        network* trained = ann;
+        ann = share_ann(&shared, trained, 0, MPI_COMM_WORLD);
+        free(trained);
+    }
+
+    if (opts.eval_file != NULL) {
+        ann_prof_region_begin("eval");
+        evaluate_from_csv(opts.eval_file, opts.misclassified_file, train_data, rank, size);
+        print_region("evaluation", ann_prof_region_end(), MPI_COMM_WORLD);
+    }
+
+    ann_prof_region_begin("test");
+    predict_from_csv((char*)opts.test_file, (char*)opts.output_file, opts.mpiio, rank, size);
+    print_region("testing", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    write_report(opts.report_file, "ann_mpi", MPI_COMM_WORLD);
+
+    if (ens != NULL) {
+        ensemble_free(ens);
+        free(ann);
+    } else {
+        free_shared_ann(&shared);
+    }
+    free_2Darray(train_data);
+    free(dim);
+
+    MPI_Finalize();
+    return 0;
+}
+
+void train_from_csv(char* filename, double** train_data, int* total_samples, const ann_options* opts, int rank, int size) {
+    mpi_csv csv;
+    open_input(&csv, filename, rank);
+    *total_samples = (int)csv.total_rows;
+
+    // With --sync the ranks average their models every sync_interval samples
+    // instead of training independent copies
+    model_sync sync;
+    if (opts->sync_interval > 0) {
+        ann_codec codec;
+        if (ann_codec_from_name(opts->compress, &codec) != 0) {
+            if (rank == 0) {
+                printf("Unknown codec %s; use none, fp16, bf16 or topk\n", opts->compress);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        sync_init(&sync, ann, codec, opts->topk_ratio, opts->sync_interval, MPI_COMM_WORLD);
+    }
+
+    // Every rank trains on its own rows in chunks of MAX_SIZE. The ranks'
+    // row counts differ slightly, so all of them run as many rounds as the
+    // rank with the most rows.
+    long rounds = (csv.n_rows + MAX_SIZE - 1) / MAX_SIZE;
+    MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+    for (long r = 0; r < rounds; r++) {
+        int chunk = mpi_csv_read(&csv, train_data, MAX_SIZE, 784, 1);
+        if (opts->sync_interval > 0) {
+            int steps = chunk;
+            double t0 = ann_prof_begin();
+            MPI_Allreduce(MPI_IN_PLACE, &steps, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+            ann_prof_end(ANN_PHASE_COMM, t0, 0);
+            train_sync_rows(ann, &sync, train_data, chunk, steps, 0.25);
+        } else {
+            train(ann, train_data, chunk, 0.25, 0, 1);
+        }
+    }
+    mpi_csv_close(&csv);
+
+    if (rank == 0) {
+        printf("Done Reading and Training %d samples...\n", *total_samples);
+    }
+    if (opts->sync_interval > 0) {
+        if (rank == 0) {
+            printf("Averaged every %d samples with %s: %.2f MB sent per rank, %.2f MB uncompressed\n",
+                   sync.interval, ann_codec_name(sync.codec), sync.bytes / 1e6, sync.raw_bytes / 1e6);
+        }
+        sync_finish(&sync);
+    }
+}
+
+// Asynchronous mode: every rank trains on its own rows against the
+// parameter server, so no rank waits on another's progress
+void train_async_from_csv(char* filename, double** train_data, int* total_samples, const ann_options* opts, int rank, int size) {
+    (void)size;
+    mpi_csv csv;
+    open_input(&csv, filename, rank);
+
+    param_server ps;
+    ps_init(&ps, ann, opts->ps_servers, opts->batch_size, opts->staleness, MPI_COMM_WORLD);
+
+    int chunk;
+    while ((chunk = mpi_csv_read(&csv, train_data, MAX_SIZE, 784, 1)) > 0) {
+        train_async(ann, &ps, train_data, chunk, 0.25);
+    }
+    mpi_csv_close(&csv);
+
+    ps_finish(&ps, ann);
+    *total_samples = (int)csv.total_rows;
+    if (rank == 0) {
+        printf("Done Reading and Training %d samples asynchronously on %d server(s)...\n", *total_samples, ps.n_servers);
+    }
+}
+
+// Every rank predicts the rows it read. With mpiio it also writes them;
+// otherwise rank 0 gathers the labels and writes them all.
+void predict_from_csv(char *sourceFile, char* destFile, int mpiio, int rank, int size) {
+    int n_pixels = ann->dim[0];
+    mpi_csv csv;
+    open_input(&csv, sourceFile, rank);
+
+    double **chunk_data = init_2Darray(MAX_SIZE, n_pixels);
+    int *labels = (int*)malloc((csv.n_rows > 0 ? csv.n_rows : 1) * sizeof(int));
+    int done = 0;
+    int chunk;
+    while ((chunk = mpi_csv_read(&csv, chunk_data, MAX_SIZE, n_pixels, 0)) > 0) {
+        if (ens != NULL) {
+            ensemble_predict(ens, chunk_data, chunk, labels + done);
+        } else {
+            for (int i = 0; i < chunk; i++) {
+                labels[done + i] = predict(ann, chunk_data[i]);
+            }
+        }
+        if (rank == 0 && done == 0 && chunk > 16) {
+            save_image_as_png("sample_17.png", chunk_data[16], 28, 28);
+        }
+        done += chunk;
+    }
+    mpi_csv_close(&csv);
+
+    if (mpiio) {
+        // The ranks' rows are consecutive in rank order, as the writer needs
+        mpi_writer out;
+        if (mpi_writer_open(&out, destFile, MPI_COMM_WORLD) != 0) {
+            if (rank == 0) {
+                printf("Unable to open file %s\n", destFile);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        double t0 = ann_prof_begin();
+        mpi_writer_predictions(&out, csv.first_row + 1, labels, done);
+        ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+        mpi_writer_close(&out);
+    } else {
+        int *counts = NULL, *displs = NULL, *all_labels = NULL;
+        if (rank == 0) {
+            counts = (int*)malloc(size * sizeof(int));
+            displs = (int*)malloc(size * sizeof(int));
+            all_labels = (int*)malloc((csv.total_rows > 0 ? csv.total_rows : 1) * sizeof(int));
+        }
+        double t0 = ann_prof_begin();
+        MPI_Gather(&done, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            for (int r = 0; r < size; r++) {
+                displs[r] = (r == 0) ? 0 : displs[r - 1] + counts[r - 1];
+            }
+        }
+        MPI_Gatherv(labels, done, MPI_INT, all_labels, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+        ann_prof_end(ANN_PHASE_COMM, t0, 0);
+
+        if (rank == 0) {
+            ann_writer out;
+            if (ann_writer_open(&out, destFile) != 0) {
+                printf("Unable to open file %s\n", destFile);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            t0 = ann_prof_begin();
+            ann_writer_predictions(&out, all_labels, (int)csv.total_rows);
+            if (ann_writer_close(&out) != 0) {
+                printf("Unable to write file %s\n", destFile);
+            }
+            ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+        }
+        free(counts);
+        free(displs);
+        free(all_labels);
+    }
+    free_2Darray(chunk_data);
+    free(labels);
+}
+
+// Every rank tallies the rows it read and the tallies meet on rank 0 in one
+// reduction
+void evaluate_from_csv(const char* filename, const char* misclassified_file, double** data, int rank, int size) {
+    (void)size;
+    mpi_csv csv;
+    open_input(&csv, filename, rank);
+
+    ann_eval e;
+    ann_eval_init(&e, ann->dim[ann->n_layers - 1], misclassified_file != NULL);
+    long seen = 0;
+    int chunk;
+    while ((chunk = mpi_csv_read(&csv, data, MAX_SIZE, 784, 1)) > 0) {
+        if (ens != NULL) {
+            ensemble_evaluate(ens, data, chunk, csv.first_row + seen + 1, &e);
+        } else {
+            evaluate(ann, data, chunk, csv.first_row + seen + 1, &e, 0, 1);
+        }
+        seen += chunk;
+    }
+    mpi_csv_close(&csv);
+
+    double t0 = ann_prof_begin();
+    reduce_eval(&e, 0, MPI_COMM_WORLD);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    if (rank == 0) {
+        ann_eval_print(&e, filename, stdout);
+        if (misclassified_file != NULL && ann_eval_write_misclassified(&e, misclassified_file) != 0) {
+            printf("Unable to write %s\n", misclassified_file);
+        }
+    }
+    ann_eval_free(&e);
+}
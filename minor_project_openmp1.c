@@ -1,219 +1,436 @@
-#include <stdio.h>
-#include <math.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-#include <windows.h>
-#include <psapi.h>
-#include <omp.h>
-#include "alloc.h"
-#include "ann_openmp1.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-#define BUFFER_SIZE 10000
-
-void train_from_csv(char* filename, char* buffer, double** train_data);
-void predict_from_csv(char *sourceFile, char* destFile, char* buffer);
-network* ann;
-
-void save_image_as_png(const char *filename, double *pixels, int width, int height);
-
-int main() {
-    omp_set_dynamic(0);
-    omp_set_num_threads(omp_get_num_procs());
-    setvbuf(stdout, NULL, _IONBF, 0);
-
-    ann = (network*)malloc(sizeof(network));
-    double **train_data = init_2Darray(MAX_SIZE, MAX_SIZE);
-
-    int *dim = (int*)malloc(3 * sizeof(int));
-    dim[0] = 784;
-    dim[1] = 32;
-    dim[2] = 10;
-    init_ann(ann, dim, 3);
-
-    char* buffer = (char*)malloc(BUFFER_SIZE * sizeof(char));
-
-    clock_t start_train_time = clock();
-    PROCESS_MEMORY_COUNTERS memCounter;
-    SIZE_T start_train_memory = 0;
-    if (GetProcessMemoryInfo(GetCurrentProcess(), &memCounter, sizeof(memCounter))) {
-        start_train_memory = memCounter.WorkingSetSize;
-    }
-
-    train_from_csv("train.csv", buffer, train_data);
-
-    clock_t end_train_time = clock();
-    SIZE_T end_train_memory = 0;
-    if (GetProcessMemoryInfo(GetCurrentProcess(), &memCounter, sizeof(memCounter))) {
-        end_train_memory = memCounter.WorkingSetSize;
-    }
-
-    double train_time_taken = (double)(end_train_time - start_train_time) / CLOCKS_PER_SEC;
-    SIZE_T train_memory_used = end_train_memory - start_train_memory;
-
-    printf("Time taken for training: %.2f seconds\n", train_time_taken);
-    printf("Memory used during training: %zu bytes (%.2f MB)\n", train_memory_used, (double)train_memory_used / (1024 * 1024));
-    fflush(stdout);
-
-    clock_t start_test_time = clock();
-    SIZE_T start_test_memory = 0;
-    if (GetProcessMemoryInfo(GetCurrentProcess(), &memCounter, sizeof(memCounter))) {
-        start_test_memory = memCounter.WorkingSetSize;
-    }
-
-    predict_from_csv("test.csv", "submission_openmp1.csv", buffer);
-
-    clock_t end_test_time = clock();
-    SIZE_T end_test_memory = 0;
-    if (GetProcessMemoryInfo(GetCurrentProcess(), &memCounter, sizeof(memCounter))) {
-        end_test_memory = memCounter.WorkingSetSize;
-    }
-
-    double test_time_taken = (double)(end_test_time - start_test_time) / CLOCKS_PER_SEC;
-    SIZE_T test_memory_used = end_test_memory - start_test_memory;
-
-    printf("Time taken for testing: %.2f seconds\n", test_time_taken);
-    printf("Memory used during testing: %zu bytes (%.2f MB)\n", test_memory_used, (double)test_memory_used / (1024 * 1024));
-    fflush(stdout);
-
-    free(ann);
-    free(train_data);
-    free(buffer);
-    free(dim);
-
-    return 0;
-}
-
-void train_from_csv(char* filename, char* buffer, double** train_data) {
-    FILE *fptr;
-    if ((fptr = fopen(filename, "r")) == NULL) {
-        printf("Unable to open file %s\n", filename);
-        exit(1);
-    }
-
-    int count = 0;
-    fgets(buffer, BUFFER_SIZE, fptr); // skip header
-
-    char* tokens[785];
-
-    while (fgets(buffer, BUFFER_SIZE, fptr)) {
-        tokens[0] = strtok(buffer, ",");
-        for (int i = 1; i < 785 && tokens[i - 1] != NULL; i++) {
-            tokens[i] = strtok(NULL, ",");
-        }
-
-        train_data[count][784] = atof(tokens[0]);
-
-        for (int i = 0; i < 784; i++) {
-            train_data[count][i] = atof(tokens[i + 1]) / 255.0;
-        }
-
-        count++;
-        if (count == MAX_SIZE) {
-            #pragma omp parallel
-            {
-                #pragma omp for schedule(static)
-                for (int i = 0; i < omp_get_num_threads(); i++) {
-                    int start = i * (MAX_SIZE / omp_get_num_threads());
-                    int end = (i == omp_get_num_threads() - 1) ? MAX_SIZE : start + (MAX_SIZE / omp_get_num_threads());
-                    train(ann, &train_data[start], end - start, 0.25);
-                }
-            }
-            printf("Trained 1000 samples..\n");
-            fflush(stdout);
-            count = 0;
-        }
-    }
-
-    if (count > 0) {
-        train(ann, train_data, count, 0.25);
-        printf("Trained remaining %d samples..\n", count);
-        fflush(stdout);
-    }
-
-    fclose(fptr);
-    printf("Done Reading..\n");
-    fflush(stdout);
-}
-
-void predict_from_csv(char *sourceFile, char* destFile, char* buffer) {
-    FILE *fptr;
-    FILE *dest;
-    if ((fptr = fopen(sourceFile, "r")) == NULL) {
-        printf("Unable to open file %s\n", sourceFile);
-        exit(1);
-    }
-    if ((dest = fopen(destFile, "w")) == NULL) {
-        printf("Unable to open file %s\n", destFile);
-        exit(1);
-    }
-
-    fprintf(dest, "ImageId,Label\n");
-
-    fgets(buffer, BUFFER_SIZE, fptr); // skip header
-
-    double** batch_data = init_2Darray(MAX_SIZE, 784);
-    int* batch_results = (int*)malloc(MAX_SIZE * sizeof(int));
-    int count = 0;
-    char* tokens[784];
-
-    while (fgets(buffer, BUFFER_SIZE, fptr)) {
-        char* token = strtok(buffer, ",");
-        for (int i = 0; i < 784 && token != NULL; i++) {
-            tokens[i] = token;
-            token = strtok(NULL, ",");
-        }
-
-        for (int i = 0; i < 784; i++) {
-            batch_data[count][i] = atof(tokens[i]) / 255.0;
-        }
-
-        count++;
-
-        if (count == MAX_SIZE) {
-            #pragma omp parallel for schedule(static)
-            for (int i = 0; i < count; i++) {
-                batch_results[i] = predict(ann, batch_data[i]);
-            }
-
-            for (int i = 0; i < count; i++) {
-                fprintf(dest, "%d,%d\n", i + 1, batch_results[i]);
-                if (i == 16) {
-                    save_image_as_png("sample_17_openmp1.png", batch_data[i], 28, 28);
-                }
-            }
-
-            count = 0;
-        }
-    }
-
-    if (count > 0) {
-        #pragma omp parallel for schedule(static)
-        for (int i = 0; i < count; i++) {
-            batch_results[i] = predict(ann, batch_data[i]);
-        }
-
-        for (int i = 0; i < count; i++) {
-            fprintf(dest, "%d,%d\n", i + 1, batch_results[i]);
-        }
-    }
-
-    fclose(fptr);
-    fclose(dest);
-    free(batch_data);
-    free(batch_results);
-}
-
-void save_image_as_png(const char *filename, double *pixels, int width, int height) {
-    unsigned char *image_data = (unsigned char*)malloc(width * height * sizeof(unsigned char));
-
-    for (int i = 0; i < width * height; i++) {
-        image_data[i] = (unsigned char)(pixels[i] * 255);
-    }
-
-    stbi_write_png(filename, width, height, 1, image_data, width);
-    free(image_data);
-}
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <omp.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_csv.h"
+#include "ann_eval.h"
+#include "ann_numa.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+#include "ann_tune.h"
+#include "ann_openmp1.h"
+
+#define BUFFER_SIZE 10000
+
+void train_from_csv(char* filename, char* buffer, double** train_data, unsigned char** keep);
+long long train_from_stream(FILE* fptr, char* buffer, double** train_data, unsigned char** keep, long long* end);
+void resume_from_csv(const ann_options* opts, char* buffer, double** train_data, long long* end, long long* seen);
+void save_resumed(const char* path, long long end, long long seen);
+void predict_from_csv(char *sourceFile, char* destFile, char* buffer);
+void evaluate_from_csv(const char* filename, const char* misclassified_file, char* buffer, double** data);
+void tune_from_csv(const char* filename, const char* profile, char* buffer, double** data, int* dim);
+network* ann;
+replica_set* replicas = NULL;
+
+int main(int argc, char* argv[]) {
+    ann_options opts = { "train.csv", "test.csv", "submission_openmp1.csv", NULL };
+    opts.prune_block = 1;
+    opts.tune_profile = ANN_TUNE_PROFILE;
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_TEST | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_AFFINITY | ANN_ACCEPT_REPLICAS
+                 | ANN_ACCEPT_MODEL | ANN_ACCEPT_SAVE_MODEL | ANN_ACCEPT_SEED | ANN_ACCEPT_PRUNE
+                 | ANN_ACCEPT_PRUNE_BLOCK | ANN_ACCEPT_FINETUNE | ANN_ACCEPT_EVAL | ANN_ACCEPT_MISCLASSIFIED
+                 | ANN_ACCEPT_PROFILE | ANN_ACCEPT_AUTOTUNE | ANN_ACCEPT_RESUME;
+    ann_parse_options(argc, argv, &opts);
+    ann_configure_affinity(&opts, argv);
+    if (!opts.autotune) {
+        ann_tune_configure(opts.tune_profile);
+    }
+
+    omp_set_dynamic(0);
+    if (getenv("OMP_NUM_THREADS") == NULL) {  // let benchmark sweeps override
+        omp_set_num_threads(ann_tune.threads > 0 ? ann_tune.threads : omp_get_num_procs());
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    ann = (network*)malloc(sizeof(network));
+    double **train_data = init_2Darray(MAX_SIZE, MAX_SIZE);
+
+    int *dim = (int*)malloc(3 * sizeof(int));
+    dim[0] = 784;
+    dim[1] = 32;
+    dim[2] = 10;
+    init_ann(ann, dim, 3, ann_seed(&opts));
+
+    char* buffer = (char*)malloc(BUFFER_SIZE * sizeof(char));
+
+    if (opts.autotune) {
+        tune_from_csv(opts.train_file, opts.tune_profile, buffer, train_data, dim);
+    }
+
+    ann_prof_region_begin("train");
+    long long resume_end = -1, resume_seen = 0;
+    if (opts.resume) {
+        if (opts.model_file == NULL) {
+            opts.model_file = "model.ann";
+        }
+        resume_from_csv(&opts, buffer, train_data, &resume_end, &resume_seen);
+    } else {
+        train_from_csv((char*)opts.train_file, buffer, train_data, NULL);
+    }
+
+    // Prune, fine-tune with the pruned weights held at zero, then switch the
+    // pruned layers to sparse kernels for inference. Fine-tuning rereads the
+    // whole file, and the next resume would train the pruned weights dense
+    // again, so incremental runs keep the model dense.
+    if (opts.prune > 0 && opts.resume) {
+        printf("--prune is ignored with --resume\n");
+    } else if (opts.prune > 0) {
+        unsigned char** keep = prune_ann(ann, opts.prune, opts.prune_block);
+        for (int pass = 0; pass < opts.finetune; pass++) {
+            train_from_csv((char*)opts.train_file, buffer, train_data, keep);
+            // The final pass is evaluated below, after the switch to sparse kernels
+            if (opts.eval_file != NULL && pass + 1 < opts.finetune) {
+                printf("Fine-tuning pass %d: ", pass + 1);
+                evaluate_from_csv(opts.eval_file, NULL, buffer, train_data);
+            }
+        }
+        free_prune_mask(ann, keep);
+        sparsify_ann(ann, opts.prune_block);
+        for (int i = 1; i < ann->n_layers; i++) {
+            if (ann->sparse[i - 1] != NULL) {
+                printf("Layer %d: %d of %d weights stored as %s\n", i, ann->sparse[i - 1]->nnz,
+                       ann->dim[i] * ann->dim[i - 1], opts.prune_block > 1 ? "BSR" : "CSR");
+            }
+        }
+    }
+    const ann_prof_region* train_region = ann_prof_region_end();
+    ann_prof_print_region("training", train_region, train_region->wall_seconds);
+    fflush(stdout);
+
+    if (opts.resume) {
+        save_resumed(opts.save_model != NULL ? opts.save_model : opts.model_file, resume_end, resume_seen);
+    } else if (opts.save_model != NULL && save_ann(ann, opts.save_model) != 0) {
+        printf("Unable to write model %s\n", opts.save_model);
+    }
+
+    if (opts.eval_file != NULL) {
+        ann_prof_region_begin("eval");
+        evaluate_from_csv(opts.eval_file, opts.misclassified_file, buffer, train_data);
+        const ann_prof_region* eval_region = ann_prof_region_end();
+        ann_prof_print_region("evaluation", eval_region, eval_region->wall_seconds);
+        fflush(stdout);
+    }
+
+    replica_set replica_storage;
+    if (opts.replicas) {
+        init_replicas(&replica_storage, ann);
+        replicas = &replica_storage;
+        printf("Inference uses %d weight replica(s)\n", replicas->n);
+    }
+
+    ann_prof_region_begin("test");
+    predict_from_csv((char*)opts.test_file, (char*)opts.output_file, buffer);
+    const ann_prof_region* test_region = ann_prof_region_end();
+    ann_prof_print_region("testing", test_region, test_region->wall_seconds);
+    fflush(stdout);
+
+    ann_prof_write_report_file(opts.report_file, "ann_openmp1");
+
+    if (replicas != NULL) {
+        free_replicas(replicas);
+    }
+    free_ann(ann);
+    free_2Darray(train_data);
+    free(buffer);
+    free(dim);
+
+    return 0;
+}
+
+// Tunes on the first rows of the training file and saves the profile; the
+// run then carries on with the tuned settings
+void tune_from_csv(const char* filename, const char* profile, char* buffer, double** data, int* dim) {
+    FILE *fptr;
+    if ((fptr = fopen(filename, "r")) == NULL) {
+        printf("Unable to open file %s\n", filename);
+        exit(1);
+    }
+    int count = 0;
+    fgets(buffer, BUFFER_SIZE, fptr); // skip header
+    while (count < MAX_SIZE && fgets(buffer, BUFFER_SIZE, fptr)) {
+        parse_csv_row(buffer, data[count++], 784, 1);
+    }
+    fclose(fptr);
+    if (count == 0) {
+        printf("No rows in %s to tune on\n", filename);
+        exit(1);
+    }
+
+    printf("Tuning on %d rows of %s\n", count, filename);
+    ann_prof_region_begin("tune");
+    ann_tuning tuned;
+    autotune(&tuned, dim, 3, data, count, 1);
+    const ann_prof_region* tune_region = ann_prof_region_end();
+    ann_prof_print_region("tuning", tune_region, tune_region->wall_seconds);
+    printf("Tuned: %d thread(s), threshold %d, eval batch %d, sparse tile %d\n",
+           tuned.threads, tuned.par_threshold, tuned.eval_batch, tuned.sparse_tile);
+    if (profile == NULL || strcmp(profile, "none") == 0) {
+        return;
+    }
+    if (ann_tune_save(profile, &tuned) != 0) {
+        printf("Unable to write tuning profile %s\n", profile);
+    } else {
+        printf("Saved tuning profile %s\n", profile);
+    }
+}
+
+void train_from_csv(char* filename, char* buffer, double** train_data, unsigned char** keep) {
+    FILE *fptr;
+    if ((fptr = fopen(filename, "r")) == NULL) {
+        printf("Unable to open file %s\n", filename);
+        exit(1);
+    }
+
+    fgets(buffer, BUFFER_SIZE, fptr); // skip header
+    train_from_stream(fptr, buffer, train_data, keep, NULL);
+
+    fclose(fptr);
+    printf("Done Reading..\n");
+    fflush(stdout);
+}
+
+// Trains on the rows left in fptr, MAX_SIZE at a time. With end set, a last
+// line without its newline is left unread, since the writer may still be
+// appending it, and *end advances past every row trained on.
+long long train_from_stream(FILE* fptr, char* buffer, double** train_data, unsigned char** keep, long long* end) {
+    int count = 0;
+    long long rows = 0;
+
+    while (fgets(buffer, BUFFER_SIZE, fptr)) {
+        size_t length = strlen(buffer);
+        if (end != NULL) {
+            if (length == 0 || buffer[length - 1] != '\n') {
+                break;
+            }
+            *end += (long long)length;
+        }
+        double t0 = ann_prof_begin();
+        parse_csv_row(buffer, train_data[count], 784, 1);
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+
+        count++;
+        rows++;
+        if (count == MAX_SIZE) {
+            #pragma omp parallel
+            {
+                #pragma omp for schedule(static)
+                for (int i = 0; i < omp_get_num_threads(); i++) {
+                    int start = i * (MAX_SIZE / omp_get_num_threads());
+                    int end = (i == omp_get_num_threads() - 1) ? MAX_SIZE : start + (MAX_SIZE / omp_get_num_threads());
+                    train(ann, &train_data[start], end - start, 0.25);
+                }
+            }
+            if (keep != NULL) {
+                apply_prune_mask(ann, keep);
+            }
+            printf("Trained 1000 samples..\n");
+            fflush(stdout);
+            count = 0;
+        }
+    }
+
+    if (count > 0) {
+        train(ann, train_data, count, 0.25);
+        if (keep != NULL) {
+            apply_prune_mask(ann, keep);
+        }
+        printf("Trained remaining %d samples..\n", count);
+        fflush(stdout);
+    }
+    return rows;
+}
+
+// Incremental training: continues from the saved model on the rows appended
+// to the training file since its offset sidecar, or on the headerless rows
+// of stdin with --train -. A missing model starts from the fresh weights and
+// the top of the file. *end and *seen receive the new sidecar values; stdin
+// leaves the file offset as it was, and *end is -1 when there is none.
+void resume_from_csv(const ann_options* opts, char* buffer, double** train_data, long long* end, long long* seen) {
+    const char* model = opts->model_file;
+    int from_stdin = strcmp(opts->train_file, "-") == 0;
+    long long offset = 0;
+    int has_offset = 0;
+    *seen = 0;
+    network* loaded = load_ann(model);
+    if (loaded != NULL) {
+        if (loaded->n_layers < 2 || loaded->dim[0] != 784) {
+            printf("Model %s does not take 784 inputs\n", model);
+            exit(1);
+        }
+        if (loaded->dim[loaded->n_layers - 1] != 10) {
+            printf("Model %s does not have 10 output classes\n", model);
+            exit(1);
+        }
+        free_ann(ann);
+        ann = loaded;
+        // Without the offset every row the model has seen would be trained again
+        has_offset = ann_model_read_offset(model, &offset, seen) == 0;
+        if (!has_offset && !from_stdin) {
+            printf("%s has no readable offset sidecar %s.offset; remove the model to start over\n", model, model);
+            exit(1);
+        }
+        printf("Resuming %s after %lld row(s)\n", model, *seen);
+    } else if (access(model, F_OK) == 0) {
+        // load_ann also refuses valid files the kernels have no room for
+        ann_model probe;
+        if (ann_model_load(model, &probe) == 0) {
+            ann_model_free(&probe);
+            printf("Model %s does not fit in %d layers of at most %d units\n", model, LAYER_SIZE, MAX_SIZE);
+        } else {
+            printf("Unable to load model %s\n", model);
+        }
+        exit(1);
+    } else {
+        printf("No model %s yet; starting from fresh weights\n", model);
+    }
+
+    if (from_stdin) {
+        *end = has_offset ? offset : -1;
+        *seen += train_from_stream(stdin, buffer, train_data, NULL, NULL);
+        printf("Done Reading..\n");
+        return;
+    }
+
+    FILE *fptr;
+    if ((fptr = fopen(opts->train_file, "r")) == NULL) {
+        printf("Unable to open file %s\n", opts->train_file);
+        exit(1);
+    }
+    fseeko(fptr, 0, SEEK_END);
+    if (ftello(fptr) < offset) {
+        printf("%s is shorter than the recorded offset %lld; it was rewritten, not appended to\n",
+               opts->train_file, offset);
+        exit(1);
+    }
+    fseeko(fptr, offset, SEEK_SET);
+    *end = offset;
+    if (offset == 0 && fgets(buffer, BUFFER_SIZE, fptr)) { // skip header
+        *end = (long long)strlen(buffer);
+    }
+    long long rows = train_from_stream(fptr, buffer, train_data, NULL, end);
+    *seen += rows;
+    fclose(fptr);
+    printf("Done Reading.. %lld new row(s), offset now %lld\n", rows, *end);
+    fflush(stdout);
+}
+
+// Replaces the model through a temporary file and rename, then records the
+// offset, so an interrupted run never pairs an offset with an older model
+void save_resumed(const char* path, long long end, long long seen) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (save_ann(ann, tmp) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        printf("Unable to write model %s\n", path);
+        return;
+    }
+    if (end >= 0 && ann_model_write_offset(path, end, seen) != 0) {
+        printf("Unable to write the offset sidecar of %s\n", path);
+        return;
+    }
+    printf("Saved %s after %lld row(s)\n", path, seen);
+}
+
+void predict_from_csv(char *sourceFile, char* destFile, char* buffer) {
+    FILE *fptr;
+    ann_writer dest;
+    if ((fptr = fopen(sourceFile, "r")) == NULL) {
+        printf("Unable to open file %s\n", sourceFile);
+        exit(1);
+    }
+    if (ann_writer_open(&dest, destFile) != 0) {
+        printf("Unable to open file %s\n", destFile);
+        exit(1);
+    }
+
+    fgets(buffer, BUFFER_SIZE, fptr); // skip header
+
+    double** batch_data = init_2Darray(MAX_SIZE, 784);
+    int* batch_results = (int*)malloc(MAX_SIZE * sizeof(int));
+    int count = 0;
+
+    while (fgets(buffer, BUFFER_SIZE, fptr)) {
+        double t0 = ann_prof_begin();
+        parse_csv_row(buffer, batch_data[count], 784, 0);
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+
+        count++;
+
+        if (count == MAX_SIZE) {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < count; i++) {
+                batch_results[i] = predict(replicas ? local_replica(replicas) : ann, batch_data[i]);
+            }
+
+            if (dest.next_id == 1) {
+                save_image_as_png("sample_17_openmp1.png", batch_data[16], 28, 28);
+            }
+            double t0 = ann_prof_begin();
+            ann_writer_predictions(&dest, batch_results, count);
+            ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+
+            count = 0;
+        }
+    }
+
+    if (count > 0) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < count; i++) {
+            batch_results[i] = predict(replicas ? local_replica(replicas) : ann, batch_data[i]);
+        }
+
+        double t0 = ann_prof_begin();
+        ann_writer_predictions(&dest, batch_results, count);
+        ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+    }
+
+    fclose(fptr);
+    if (ann_writer_close(&dest) != 0) {
+        printf("Unable to write file %s\n", destFile);
+    }
+    free_2Darray(batch_data);
+    free(batch_results);
+}
+
+void evaluate_from_csv(const char* filename, const char* misclassified_file, char* buffer, double** data) {
+    FILE *fptr;
+    if ((fptr = fopen(filename, "r")) == NULL) {
+        printf("Unable to open file %s\n", filename);
+        exit(1);
+    }
+    fgets(buffer, BUFFER_SIZE, fptr); // skip header
+
+    ann_eval e;
+    ann_eval_init(&e, ann->dim[ann->n_layers - 1], misclassified_file != NULL);
+    long seen = 0;
+    int count = 0;
+    for (;;) {
+        int more = fgets(buffer, BUFFER_SIZE, fptr) != NULL;
+        if (more) {
+            double t0 = ann_prof_begin();
+            parse_csv_row(buffer, data[count], 784, 1);
+            ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+            count++;
+        }
+        if (count == MAX_SIZE || (!more && count > 0)) {
+            evaluate(ann, data, count, seen + 1, &e);
+            seen += count;
+            count = 0;
+        }
+        if (!more) {
+            break;
+        }
+    }
+    fclose(fptr);
+
+    ann_eval_print(&e, filename, stdout);
+    if (misclassified_file != NULL && ann_eval_write_misclassified(&e, misclassified_file) != 0) {
+        printf("Unable to write %s\n", misclassified_file);
+    }
+    ann_eval_free(&e);
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_csv.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+#include "ann_pp.h"
+#include "ann_mpi_util.h"
+
+#define CHUNK_SIZE 1000
+#define HIDDEN_SIZE 32
+#define DEPTH 2
+#define BATCH_SIZE 16
+#define MICRO_BATCHES 4
+#define LEARNING_RATE 4.0
+
+int read_chunk(FILE* fptr, double** chunk_data, int has_label, int rank);
+void train_from_csv(char* filename, int rank);
+void predict_from_csv(char *sourceFile, char* destFile, int rank);
+
+pp_network ann;
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    ann_options opts = { "train.csv", "test.csv", "submission_pp.csv", NULL };
+    opts.hidden_size = HIDDEN_SIZE;
+    opts.depth = DEPTH;
+    opts.batch_size = BATCH_SIZE;
+    opts.micro_batches = MICRO_BATCHES;
+    opts.schedule = "1f1b";
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_TEST | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_BATCH | ANN_ACCEPT_HIDDEN
+                 | ANN_ACCEPT_DEPTH | ANN_ACCEPT_MICRO_BATCHES | ANN_ACCEPT_SCHEDULE | ANN_ACCEPT_SEED;
+    ann_parse_options(argc, argv, &opts);
+
+    enum pp_schedule schedule = PP_1F1B;
+    if (strcmp(opts.schedule, "gpipe") == 0) {
+        schedule = PP_GPIPE;
+    } else if (strcmp(opts.schedule, "1f1b") != 0) {
+        if (rank == 0) {
+            printf("Unknown schedule %s; use gpipe or 1f1b\n", opts.schedule);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // 784 inputs, depth hidden layers and 10 outputs
+    int n_layers = opts.depth + 2;
+    int dim[n_layers];
+    dim[0] = 784;
+    for (int i = 1; i <= opts.depth; i++) {
+        dim[i] = opts.hidden_size;
+    }
+    dim[n_layers - 1] = 10;
+    int micro_rows = (opts.batch_size + opts.micro_batches - 1) / opts.micro_batches;
+    unsigned long long seed = ann_seed(&opts);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    pp_init_ann(&ann, dim, n_layers, opts.micro_batches, micro_rows, schedule, seed, MPI_COMM_WORLD);
+    printf("Stage %d of %d: layers %d..%d\n", rank, size, ann.first, ann.last);
+
+    ann_prof_region_begin("train");
+    train_from_csv((char*)opts.train_file, rank);
+    print_region("training", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    ann_prof_region_begin("test");
+    predict_from_csv((char*)opts.test_file, (char*)opts.output_file, rank);
+    print_region("testing", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    write_report(opts.report_file, "ann_pp", MPI_COMM_WORLD);
+
+    pp_free_ann(&ann);
+
+    MPI_Finalize();
+    return 0;
+}
+
+// Only the first stage reads samples; the others just need the row count
+int read_chunk(FILE* fptr, double** chunk_data, int has_label, int rank) {
+    static char line[16000];
+    int chunk = 0;
+    if (rank == 0) {
+        while (chunk < CHUNK_SIZE && fgets(line, sizeof(line), fptr)) {
+            double t0 = ann_prof_begin();
+            parse_csv_row(line, chunk_data[chunk], ann.dim[0], has_label);
+            ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+            chunk++;
+        }
+    }
+    double t0 = ann_prof_begin();
+    MPI_Bcast(&chunk, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    return chunk;
+}
+
+void train_from_csv(char* filename, int rank) {
+    FILE *fptr = NULL;
+    double **train_data = NULL;
+    char line[16000];
+    if (rank == 0) {
+        if ((fptr = fopen(filename, "r")) == NULL) {
+            printf("Unable to open file %s\n", filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fgets(line, sizeof(line), fptr);  // skip header
+        train_data = init_2Darray(CHUNK_SIZE, ann.dim[0] + 1);
+    }
+
+    int total_samples = 0;
+    int chunk = CHUNK_SIZE;
+    while (chunk == CHUNK_SIZE) {
+        chunk = read_chunk(fptr, train_data, 1, rank);
+        pp_train(&ann, train_data, chunk, LEARNING_RATE);
+        total_samples += chunk;
+    }
+
+    if (rank == 0) {
+        fclose(fptr);
+        free_2Darray(train_data);
+        printf("Done Reading and Training %d samples...\n", total_samples);
+    }
+}
+
+void predict_from_csv(char *sourceFile, char* destFile, int rank) {
+    FILE *fptr = NULL;
+    ann_writer out;
+    double **test_data = NULL;
+    char line[16000];
+    if (rank == 0) {
+        if ((fptr = fopen(sourceFile, "r")) == NULL) {
+            printf("Unable to open file %s\n", sourceFile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (ann_writer_open(&out, destFile) != 0) {
+            printf("Unable to open file %s\n", destFile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fgets(line, sizeof(line), fptr); // skip header
+        test_data = init_2Darray(CHUNK_SIZE, ann.dim[0] + 1);
+    }
+
+    int *labels = (int*)malloc(CHUNK_SIZE * sizeof(int));
+    int chunk = CHUNK_SIZE;
+    while (chunk == CHUNK_SIZE) {
+        chunk = read_chunk(fptr, test_data, 0, rank);
+        pp_predict(&ann, test_data, chunk, labels);
+        if (rank == 0) {
+            double t0 = ann_prof_begin();
+            ann_writer_predictions(&out, labels, chunk);
+            ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+        }
+    }
+
+    if (rank == 0) {
+        fclose(fptr);
+        if (ann_writer_close(&out) != 0) {
+            printf("Unable to write file %s\n", destFile);
+        }
+        free_2Darray(test_data);
+    }
+    free(labels);
+}
@@ -0,0 +1,422 @@
+#define _GNU_SOURCE  // ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <omp.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_infer.h"
+#include "ann_prof.h"
+#include "ann_serve.h"
+#include "ann_tune.h"
+#include "ann_openmp1.h"
+
+// Long-running inference server. It loads a trained model once and answers
+// requests (see ann_serve.h for the wire protocol) from any number of local
+// clients. One thread runs the event loop; requests that arrive close
+// together are gathered into one dynamic batch, which is dispatched through
+// predict_batch (and its OpenMP threads) when it holds --batch samples or
+// its oldest request has waited --max-latency microseconds. A batch of one
+// sample skips OpenMP and goes through the packed ann_infer.h path instead.
+
+#define MAX_CLIENTS 256
+#define MAX_BATCH 64
+#define MAX_LATENCY_US 200
+
+typedef struct client {
+    int fd;                 // -1 once the connection is closed
+    char* in;               // bytes of requests not yet complete
+    size_t in_len, in_cap;
+    char* out;              // responses not yet sent
+    size_t out_len, out_sent, out_cap;
+    int queued;             // requests of this client in the current batch
+} client;
+
+typedef struct queued_request {
+    int client;
+    int first;              // first row in the batch
+    int count;
+} queued_request;
+
+typedef struct batch {
+    int capacity;           // rows; a single request always fits
+    int max_rows;           // dispatch as soon as this many rows are queued
+    int n_rows;
+    double** rows;
+    int* labels;
+    queued_request* requests;
+    int n_requests;
+    struct timespec opened; // arrival of the oldest queued request
+} batch;
+
+typedef struct serve_stats {
+    long long requests;
+    long long samples;
+    long long batches;
+    long long rejected;
+} serve_stats;
+
+static volatile sig_atomic_t stop = 0;
+
+static network* ann;
+static ann_infer infer;
+static client clients[MAX_CLIENTS];
+static int n_clients = 0;
+static serve_stats stats;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static double elapsed_us(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e6 + (now.tv_nsec - since->tv_nsec) / 1e3;
+}
+
+static void reserve(char** buf, size_t* cap, size_t needed) {
+    if (needed > *cap) {
+        *cap = needed > 2 * *cap ? needed : 2 * *cap;
+        *buf = (char*)realloc(*buf, *cap);
+    }
+}
+
+static void close_client(int c) {
+    if (clients[c].fd >= 0) {
+        close(clients[c].fd);
+        clients[c].fd = -1;
+    }
+    clients[c].in_len = 0;
+    clients[c].out_len = 0;
+    clients[c].out_sent = 0;
+}
+
+// Sends as much pending output as the socket takes without blocking
+static void flush_output(int c) {
+    client* cl = &clients[c];
+    while (cl->fd >= 0 && cl->out_sent < cl->out_len) {
+        ssize_t n = send(cl->fd, cl->out + cl->out_sent, cl->out_len - cl->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            cl->out_sent += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            close_client(c);
+            return;
+        }
+    }
+    cl->out_len = 0;
+    cl->out_sent = 0;
+}
+
+static void respond(int c, const int32_t* values, int n) {
+    client* cl = &clients[c];
+    if (cl->fd < 0) {
+        return;
+    }
+    reserve(&cl->out, &cl->out_cap, cl->out_len + n * sizeof(int32_t));
+    memcpy(cl->out + cl->out_len, values, n * sizeof(int32_t));
+    cl->out_len += n * sizeof(int32_t);
+}
+
+static void dispatch(batch* b) {
+    if (b->n_rows == 0) {
+        return;
+    }
+    if (b->n_rows == 1) {
+        double t0 = ann_prof_begin();
+        b->labels[0] = ann_infer_predict(&infer, b->rows[0]);
+        ann_prof_end(ANN_PHASE_FORWARD, t0, ann_flops_forward(ann->dim, ann->n_layers));
+        ann_prof_samples(1);
+    } else {
+        predict_batch(ann, b->rows, b->n_rows, b->labels);
+    }
+
+    double t0 = ann_prof_begin();
+    for (int r = 0; r < b->n_requests; r++) {
+        queued_request* q = &b->requests[r];
+        int32_t count = q->count;
+        respond(q->client, &count, 1);
+        respond(q->client, (const int32_t*)b->labels + q->first, q->count);
+        clients[q->client].queued--;
+    }
+    for (int r = 0; r < b->n_requests; r++) {
+        flush_output(b->requests[r].client);
+    }
+    ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+
+    stats.requests += b->n_requests;
+    stats.samples += b->n_rows;
+    stats.batches++;
+    b->n_rows = 0;
+    b->n_requests = 0;
+}
+
+// Moves every complete request in the client's input buffer into the batch.
+// Returns -1 if the client sent a malformed request.
+static int queue_requests(int c, batch* b) {
+    client* cl = &clients[c];
+    int n_features = ann->dim[0];
+    size_t used = 0;
+    while (cl->in_len - used >= sizeof(ann_serve_header)) {
+        ann_serve_header h;
+        memcpy(&h, cl->in + used, sizeof(h));
+        if (h.n_samples < 1 || h.n_samples > ANN_SERVE_MAX_SAMPLES || (int)h.n_features != n_features) {
+            return -1;
+        }
+        size_t body = (size_t)h.n_samples * n_features * sizeof(float);
+        if (cl->in_len - used < sizeof(h) + body) {
+            break;
+        }
+        // dispatch flushes output, which drops a client that has reset
+        if (b->n_rows + (int)h.n_samples > b->capacity) {
+            dispatch(b);
+            if (cl->fd < 0) {
+                return 0;
+            }
+        }
+        if (b->n_rows == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &b->opened);
+        }
+
+        double t0 = ann_prof_begin();
+        const char* pixels = cl->in + used + sizeof(h);
+        for (uint32_t s = 0; s < h.n_samples; s++) {
+            double* row = b->rows[b->n_rows + s];
+            for (int k = 0; k < n_features; k++) {
+                float v;
+                memcpy(&v, pixels + ((size_t)s * n_features + k) * sizeof(float), sizeof(v));
+                row[k] = v;
+            }
+        }
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+
+        queued_request* q = &b->requests[b->n_requests++];
+        q->client = c;
+        q->first = b->n_rows;
+        q->count = (int)h.n_samples;
+        b->n_rows += q->count;
+        cl->queued++;
+        used += sizeof(h) + body;
+
+        if (b->n_rows >= b->max_rows) {
+            dispatch(b);
+            if (cl->fd < 0) {
+                return 0;
+            }
+        }
+    }
+    memmove(cl->in, cl->in + used, cl->in_len - used);
+    cl->in_len -= used;
+    return 0;
+}
+
+static void read_client(int c, batch* b) {
+    client* cl = &clients[c];
+    for (;;) {
+        reserve(&cl->in, &cl->in_cap, cl->in_len + 65536);
+        ssize_t n = recv(cl->fd, cl->in + cl->in_len, cl->in_cap - cl->in_len, 0);
+        if (n > 0) {
+            cl->in_len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // Peer closed: answer what it already sent, then drop it
+        queue_requests(c, b);
+        dispatch(b);
+        close_client(c);
+        return;
+    }
+    if (queue_requests(c, b) != 0) {
+        // Earlier requests are answered before the rejection
+        dispatch(b);
+        int32_t rejected = ANN_SERVE_REJECTED;
+        respond(c, &rejected, 1);
+        flush_output(c);
+        close_client(c);
+        stats.rejected++;
+    }
+}
+
+static void accept_clients(int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        int c = 0;
+        while (c < n_clients && (clients[c].fd >= 0 || clients[c].queued > 0)) {
+            c++;
+        }
+        if (c == MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        if (c == n_clients) {
+            memset(&clients[c], 0, sizeof(client));
+            n_clients++;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        clients[c].fd = fd;
+        clients[c].in_len = 0;
+        clients[c].out_len = 0;
+        clients[c].out_sent = 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ann_options opts = { "train.csv", "test.csv", "submission.csv", NULL };
+    opts.model_file = "model.ann";
+    opts.socket_path = "ann_serve.sock";
+    opts.batch_size = MAX_BATCH;
+    opts.max_latency_us = MAX_LATENCY_US;
+    opts.prune_block = 1;
+    opts.tune_profile = ANN_TUNE_PROFILE;
+    opts.accepts = ANN_ACCEPT_AFFINITY | ANN_ACCEPT_BATCH | ANN_ACCEPT_MODEL | ANN_ACCEPT_SOCKET | ANN_ACCEPT_PORT
+                 | ANN_ACCEPT_MAX_LATENCY | ANN_ACCEPT_PRUNE_BLOCK | ANN_ACCEPT_PROFILE;
+    ann_parse_options(argc, argv, &opts);
+    ann_configure_affinity(&opts, argv);
+    ann_tune_configure(opts.tune_profile);
+    if (ann_tune.threads > 0 && getenv("OMP_NUM_THREADS") == NULL) {
+        omp_set_num_threads(ann_tune.threads);
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    ann = load_ann(opts.model_file);
+    if (ann == NULL) {
+        printf("Unable to load model %s\n", opts.model_file);
+        exit(1);
+    }
+    // Pruned models are served through the sparse kernels
+    sparsify_ann(ann, opts.prune_block);
+    if (init_infer(&infer, ann) != 0) {
+        printf("Unable to allocate the inference workspace\n");
+        exit(1);
+    }
+
+    int listen_fd = ann_serve_listen(opts.socket_path, opts.port);
+    if (listen_fd < 0) {
+        perror("Unable to listen");
+        exit(1);
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    // SIGINT and SIGTERM are only delivered inside ppoll, so the loop always
+    // stops between batches
+    sigset_t blocked, waiting;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    batch b;
+    b.max_rows = opts.batch_size;
+    b.capacity = opts.batch_size > ANN_SERVE_MAX_SAMPLES ? opts.batch_size : ANN_SERVE_MAX_SAMPLES;
+    b.n_rows = 0;
+    b.n_requests = 0;
+    b.rows = init_2Darray(b.capacity, ann->dim[0]);
+    b.labels = (int*)malloc(b.capacity * sizeof(int));
+    b.requests = (queued_request*)malloc(b.capacity * sizeof(queued_request));
+
+    char address[128];
+    if (opts.port > 0) {
+        snprintf(address, sizeof(address), "127.0.0.1:%d", opts.port);
+    } else {
+        snprintf(address, sizeof(address), "%s", opts.socket_path);
+    }
+    printf("Serving %s (%d layers) on %s, batch %d, max latency %d us\n",
+           opts.model_file, ann->n_layers, address, opts.batch_size, opts.max_latency_us);
+
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int fd_client[MAX_CLIENTS + 1];
+    ann_prof_region_begin("serve");
+    while (!stop) {
+        int nfds = 0;
+        fds[nfds].fd = listen_fd;
+        fds[nfds].events = POLLIN;
+        fd_client[nfds++] = -1;
+        for (int c = 0; c < n_clients; c++) {
+            if (clients[c].fd >= 0) {
+                fds[nfds].fd = clients[c].fd;
+                fds[nfds].events = POLLIN | (clients[c].out_len > clients[c].out_sent ? POLLOUT : 0);
+                fd_client[nfds++] = c;
+            }
+        }
+
+        // Sleep until there is I/O or the open batch runs out of time
+        struct timespec timeout, *wait = NULL;
+        if (b.n_rows > 0) {
+            double left = opts.max_latency_us - elapsed_us(&b.opened);
+            long ns = left > 0 ? (long)(left * 1e3) : 0;
+            timeout.tv_sec = ns / 1000000000L;
+            timeout.tv_nsec = ns % 1000000000L;
+            wait = &timeout;
+        }
+        int ready = ppoll(fds, nfds, wait, &waiting);
+        if (ready < 0 && errno != EINTR) {
+            perror("ppoll");
+            break;
+        }
+
+        for (int i = 1; ready > 0 && i < nfds; i++) {
+            int c = fd_client[i];
+            if (fds[i].revents & POLLOUT) {
+                flush_output(c);
+            }
+            if (clients[c].fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                read_client(c, &b);
+            }
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            accept_clients(listen_fd);
+        }
+        if (b.n_rows > 0 && elapsed_us(&b.opened) >= opts.max_latency_us) {
+            dispatch(&b);
+        }
+    }
+    dispatch(&b);
+    const ann_prof_region* region = ann_prof_region_end();
+
+    printf("Served %lld request(s), %lld sample(s) in %lld batch(es), %.1f samples per batch, %lld rejected\n",
+           stats.requests, stats.samples, stats.batches,
+           stats.batches > 0 ? (double)stats.samples / stats.batches : 0.0, stats.rejected);
+    ann_prof_print_region("serving", region, region->wall_seconds);
+    ann_prof_write_report_file(opts.report_file, "ann_serve");
+
+    for (int c = 0; c < n_clients; c++) {
+        close_client(c);
+        free(clients[c].in);
+        free(clients[c].out);
+    }
+    close(listen_fd);
+    if (opts.port == 0) {
+        unlink(opts.socket_path);
+    }
+    free_2Darray(b.rows);
+    free(b.labels);
+    free(b.requests);
+    ann_infer_free(&infer);
+    free_ann(ann);
+    return 0;
+}
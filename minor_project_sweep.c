@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_csv.h"
+#include "ann_eval.h"
+#include "ann_numa.h"
+#include "ann_prof.h"
+#include "ann_tune.h"
+#include "ann_openmp1.h"
+
+// Hyperparameter sweep over learning rates and hidden widths. The training
+// rows, and the evaluation rows, are parsed once into read-only arrays that
+// every model trains and scores from. The threads are split into --groups
+// teams. Each team trains one configuration at a time with its own threads
+// for the kernels inside, then takes the next untried one. The results are
+// printed as a leaderboard ranked by held-out accuracy.
+
+#define N_PIXELS 784
+#define N_CLASSES 10
+#define HOLDOUT_FRACTION 0.1
+
+typedef struct sweep_config {
+    double rate;
+    int hidden;
+    double accuracy;
+    double loss;
+    double seconds;
+    int team;
+} sweep_config;
+
+// Comma-separated values of list; returns how many were stored in values
+static int parse_list(const char* list, double* values, int max) {
+    int n = 0;
+    const char* p = list;
+    while (*p != '\0' && n < max) {
+        char* end;
+        values[n] = strtod(p, &end);
+        if (end == p) {
+            return -1;
+        }
+        n++;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+// Every labelled row of path, parsed in parallel after one read of the file
+static double** read_rows(const char* path, int* n_rows) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Unable to open file %s\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = (char*)malloc(size + 1);
+    if (fread(text, 1, size, f) != (size_t)size) {
+        printf("Unable to read file %s\n", path);
+        exit(1);
+    }
+    text[size] = '\0';
+    fclose(f);
+
+    // Index the line starts, skipping the header and empty lines
+    int cap = 1024, n = 0;
+    char** lines = (char**)malloc(cap * sizeof(char*));
+    char* p = strchr(text, '\n');
+    while (p != NULL && *++p != '\0') {
+        if (*p != '\n' && *p != '\r') {
+            if (n == cap) {
+                cap *= 2;
+                lines = (char**)realloc(lines, cap * sizeof(char*));
+            }
+            lines[n++] = p;
+        }
+        p = strchr(p, '\n');
+    }
+
+    double** rows = init_2Darray(n, N_PIXELS + 1);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        double t0 = ann_prof_begin();
+        parse_csv_row(lines[i], rows[i], N_PIXELS, 1);
+        ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+    }
+    free(lines);
+    free(text);
+    *n_rows = n;
+    return rows;
+}
+
+static int compare_results(const void* a, const void* b) {
+    const sweep_config* x = (const sweep_config*)a;
+    const sweep_config* y = (const sweep_config*)b;
+    if (x->accuracy != y->accuracy) {
+        return x->accuracy < y->accuracy ? 1 : -1;
+    }
+    return (x->loss > y->loss) - (x->loss < y->loss);
+}
+
+int main(int argc, char* argv[]) {
+    ann_options opts = { "train.csv", "test.csv", "sweep.csv", NULL };
+    opts.rates = "0.25";
+    opts.hidden_sizes = "32";
+    opts.epochs = 1;
+    opts.tune_profile = ANN_TUNE_PROFILE;
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_AFFINITY | ANN_ACCEPT_SEED | ANN_ACCEPT_EVAL
+                 | ANN_ACCEPT_RATES | ANN_ACCEPT_HIDDEN_SIZES | ANN_ACCEPT_GROUPS | ANN_ACCEPT_EPOCHS
+                 | ANN_ACCEPT_PROFILE;
+    ann_parse_options(argc, argv, &opts);
+    ann_configure_affinity(&opts, argv);
+    ann_tune_configure(opts.tune_profile);
+
+    omp_set_dynamic(0);
+    if (getenv("OMP_NUM_THREADS") == NULL) {
+        omp_set_num_threads(ann_tune.threads > 0 ? ann_tune.threads : omp_get_num_procs());
+    }
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    double rates[64], widths[64];
+    int n_rates = parse_list(opts.rates, rates, 64);
+    int n_widths = parse_list(opts.hidden_sizes, widths, 64);
+    if (n_rates < 1 || n_widths < 1) {
+        printf("--rates and --hidden-sizes take comma-separated numbers\n");
+        return 1;
+    }
+    int n_configs = n_rates * n_widths;
+    sweep_config* configs = (sweep_config*)calloc(n_configs, sizeof(sweep_config));
+    for (int w = 0; w < n_widths; w++) {
+        for (int r = 0; r < n_rates; r++) {
+            configs[w * n_rates + r].hidden = (int)widths[w];
+            configs[w * n_rates + r].rate = rates[r];
+            if (configs[w * n_rates + r].hidden < 1 || configs[w * n_rates + r].hidden > MAX_SIZE) {
+                printf("Hidden width %g is outside 1..%d\n", widths[w], MAX_SIZE);
+                return 1;
+            }
+        }
+    }
+
+    // Parse once; without --eval the last rows of the training file are held out
+    ann_prof_region_begin("load");
+    int n_train, n_eval;
+    double** train_rows = read_rows(opts.train_file, &n_train);
+    double** eval_rows;
+    if (opts.eval_file != NULL) {
+        eval_rows = read_rows(opts.eval_file, &n_eval);
+    } else {
+        n_eval = (int)(n_train * HOLDOUT_FRACTION);
+        n_train -= n_eval;
+        eval_rows = train_rows + n_train;
+    }
+    const ann_prof_region* load_region = ann_prof_region_end();
+    ann_prof_print_region("loading", load_region, load_region->wall_seconds);
+    printf("%d training and %d evaluation rows\n", n_train, n_eval);
+    if (n_train == 0 || n_eval == 0) {
+        printf("Need both training and evaluation rows\n");
+        return 1;
+    }
+
+    int n_threads = omp_get_max_threads();
+    int n_teams = opts.groups > 0 ? opts.groups : n_threads;
+    if (n_teams > n_configs) {
+        n_teams = n_configs;
+    }
+    int team_threads = n_threads / n_teams > 0 ? n_threads / n_teams : 1;
+    printf("Sweeping %d configuration(s) with %d team(s) of %d thread(s)\n", n_configs, n_teams, team_threads);
+    unsigned long long seed = ann_seed(&opts);
+
+    ann_prof_region_begin("sweep");
+    omp_set_max_active_levels(2);
+    // Every configuration starts from the same seed, so a width's rates
+    // differ only in the rate, whatever the team layout
+    #pragma omp parallel num_threads(n_teams)
+    {
+        omp_set_num_threads(team_threads);
+        #pragma omp for schedule(dynamic, 1)
+        for (int c = 0; c < n_configs; c++) {
+            sweep_config* cfg = &configs[c];
+            double t0 = ann_wall_time();
+            network* net = (network*)malloc(sizeof(network));
+            int dim[3] = { N_PIXELS, cfg->hidden, N_CLASSES };
+            init_ann(net, dim, 3, seed);
+            for (int epoch = 0; epoch < opts.epochs; epoch++) {
+                train(net, train_rows, n_train, cfg->rate);
+            }
+            ann_eval e;
+            ann_eval_init(&e, N_CLASSES, 0);
+            evaluate(net, eval_rows, n_eval, 1, &e);
+            cfg->accuracy = ann_eval_accuracy(&e);
+            cfg->loss = ann_eval_mean_loss(&e);
+            cfg->seconds = ann_wall_time() - t0;
+            cfg->team = omp_get_thread_num();
+            ann_eval_free(&e);
+            free_ann(net);
+            printf("hidden %d, rate %g: accuracy %.2f%% in %.2f s\n",
+                   cfg->hidden, cfg->rate, 100 * cfg->accuracy, cfg->seconds);
+        }
+    }
+    const ann_prof_region* sweep_region = ann_prof_region_end();
+    ann_prof_print_region("sweep", sweep_region, sweep_region->wall_seconds);
+
+    qsort(configs, n_configs, sizeof(sweep_config), compare_results);
+    printf("\n%-5s %-7s %-9s %-9s %-8s %s\n", "Rank", "Hidden", "Rate", "Accuracy", "Loss", "Seconds");
+    for (int c = 0; c < n_configs; c++) {
+        printf("%-5d %-7d %-9g %7.2f%%  %-8.4f %.2f\n", c + 1, configs[c].hidden, configs[c].rate,
+               100 * configs[c].accuracy, configs[c].loss, configs[c].seconds);
+    }
+
+    FILE* out = fopen(opts.output_file, "w");
+    if (out == NULL) {
+        printf("Unable to open file %s\n", opts.output_file);
+    } else {
+        fprintf(out, "rank,hidden,rate,accuracy,loss,seconds,team\n");
+        for (int c = 0; c < n_configs; c++) {
+            fprintf(out, "%d,%d,%g,%.6f,%.6f,%.3f,%d\n", c + 1, configs[c].hidden, configs[c].rate,
+                    configs[c].accuracy, configs[c].loss, configs[c].seconds, configs[c].team);
+        }
+        fclose(out);
+    }
+
+    ann_prof_write_report_file(opts.report_file, "ann_sweep");
+
+    if (opts.eval_file != NULL) {
+        free_2Darray(eval_rows);
+    }
+    free_2Darray(train_rows);
+    free(configs);
+    return 0;
+}
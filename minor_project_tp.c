@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "alloc.h"
+#include "ann_common.h"
+#include "ann_csv.h"
+#include "ann_output.h"
+#include "ann_prof.h"
+#include "ann_tp.h"
+#include "ann_mpi_util.h"
+
+#define CHUNK_SIZE 1000
+#define HIDDEN_SIZE 32
+
+int read_chunk(FILE* fptr, double** chunk_data, int has_label, int rank);
+void train_from_csv(char* filename, int rank);
+void predict_from_csv(char *sourceFile, char* destFile, int rank);
+
+tp_network ann;
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    ann_options opts = { "train.csv", "test.csv", "submission_tp.csv", NULL };
+    opts.hidden_size = HIDDEN_SIZE;
+    opts.accepts = ANN_ACCEPT_TRAIN | ANN_ACCEPT_TEST | ANN_ACCEPT_OUTPUT | ANN_ACCEPT_HIDDEN | ANN_ACCEPT_SEED;
+    ann_parse_options(argc, argv, &opts);
+
+    // Every rank builds only its slice of each layer; the seed is shared so
+    // the slices form one consistent network
+    unsigned long long seed = ann_seed(&opts);
+    MPI_Bcast(&seed, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+    int dim[3] = { 784, opts.hidden_size, 10 };
+    tp_init_ann(&ann, dim, 3, seed, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("Layers 784x%dx10 split across %d rank(s)\n", opts.hidden_size, size);
+    }
+
+    ann_prof_region_begin("train");
+    train_from_csv((char*)opts.train_file, rank);
+    print_region("training", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    ann_prof_region_begin("test");
+    predict_from_csv((char*)opts.test_file, (char*)opts.output_file, rank);
+    print_region("testing", ann_prof_region_end(), MPI_COMM_WORLD);
+
+    write_report(opts.report_file, "ann_tp", MPI_COMM_WORLD);
+
+    tp_free_ann(&ann);
+
+    MPI_Finalize();
+    return 0;
+}
+
+// Rank 0 parses up to CHUNK_SIZE rows and broadcasts them, since every rank
+// needs every sample. Returns the number of rows in the chunk.
+int read_chunk(FILE* fptr, double** chunk_data, int has_label, int rank) {
+    static char line[16000];
+    int width = ann.dim[0] + 1;
+    int chunk = 0;
+    if (rank == 0) {
+        while (chunk < CHUNK_SIZE && fgets(line, sizeof(line), fptr)) {
+            double t0 = ann_prof_begin();
+            parse_csv_row(line, chunk_data[chunk], ann.dim[0], has_label);
+            ann_prof_end(ANN_PHASE_PARSE, t0, 0);
+            chunk++;
+        }
+    }
+    double t0 = ann_prof_begin();
+    MPI_Bcast(&chunk, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (chunk > 0) {
+        MPI_Bcast(&(chunk_data[0][0]), chunk * width, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    }
+    ann_prof_end(ANN_PHASE_COMM, t0, 0);
+    return chunk;
+}
+
+void train_from_csv(char* filename, int rank) {
+    FILE *fptr = NULL;
+    char line[16000];
+    if (rank == 0) {
+        if ((fptr = fopen(filename, "r")) == NULL) {
+            printf("Unable to open file %s\n", filename);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fgets(line, sizeof(line), fptr);  // skip header
+    }
+
+    double **train_data = init_2Darray(CHUNK_SIZE, ann.dim[0] + 1);
+    int total_samples = 0;
+    int chunk = CHUNK_SIZE;
+    while (chunk == CHUNK_SIZE) {
+        chunk = read_chunk(fptr, train_data, 1, rank);
+        tp_train(&ann, train_data, chunk, 0.25);
+        total_samples += chunk;
+    }
+
+    if (rank == 0) {
+        fclose(fptr);
+        printf("Done Reading and Training %d samples...\n", total_samples);
+    }
+    free_2Darray(train_data);
+}
+
+void predict_from_csv(char *sourceFile, char* destFile, int rank) {
+    FILE *fptr = NULL;
+    ann_writer out;
+    char line[16000];
+    if (rank == 0) {
+        if ((fptr = fopen(sourceFile, "r")) == NULL) {
+            printf("Unable to open file %s\n", sourceFile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (ann_writer_open(&out, destFile) != 0) {
+            printf("Unable to open file %s\n", destFile);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fgets(line, sizeof(line), fptr); // skip header
+    }
+
+    double **test_data = init_2Darray(CHUNK_SIZE, ann.dim[0] + 1);
+    int *labels = (int*)malloc(CHUNK_SIZE * sizeof(int));
+    int chunk = CHUNK_SIZE;
+    while (chunk == CHUNK_SIZE) {
+        chunk = read_chunk(fptr, test_data, 0, rank);
+        for (int i = 0; i < chunk; i++) {
+            labels[i] = tp_predict(&ann, test_data[i]);
+        }
+        if (rank == 0) {
+            double t0 = ann_prof_begin();
+            ann_writer_predictions(&out, labels, chunk);
+            ann_prof_end(ANN_PHASE_OUTPUT, t0, 0);
+        }
+    }
+
+    if (rank == 0) {
+        fclose(fptr);
+        if (ann_writer_close(&out) != 0) {
+            printf("Unable to write file %s\n", destFile);
+        }
+    }
+    free_2Darray(test_data);
+    free(labels);
+}